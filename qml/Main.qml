@@ -1,8 +1,84 @@
 import QtQuick
 
 Window {
+    id: root
+
+    required property var instances
+    required property var downloads
+
     width: 640
     height: 480
     visible: true
     title: qsTr("Hello World")
+
+    function formatBytes(bytes) {
+        if (bytes >= 1024 * 1024)
+            return `${(bytes / (1024 * 1024)).toFixed(1)} MiB`
+        return `${Math.round(bytes / 1024)} KiB`
+    }
+
+    ListView {
+        anchors.top: parent.top
+        anchors.left: parent.left
+        anchors.right: parent.right
+        anchors.bottom: progress.top
+        model: root.instances
+
+        delegate: Text {
+            required property string name
+            required property string type
+            required property string inheritsFrom
+
+            text: inheritsFrom ? `${name} (${type}, based on ${inheritsFrom})` : `${name} (${type})`
+        }
+    }
+
+    // one bar per kind of download, updated at a fixed rate by the model
+    Column {
+        id: progress
+
+        anchors.left: parent.left
+        anchors.right: parent.right
+        anchors.bottom: parent.bottom
+        anchors.margins: 4
+        spacing: 2
+
+        Repeater {
+            model: root.downloads
+
+            delegate: Item {
+                required property string category
+                required property double bytesDone
+                required property double bytesTotal
+                required property int filesDone
+                required property int filesTotal
+                required property double rate
+                required property double eta
+                required property double progress
+
+                width: parent.width
+                height: filesTotal > 0 ? 18 : 0
+                visible: filesTotal > 0
+
+                Rectangle {
+                    anchors.fill: parent
+                    color: "#e0e0e0"
+                }
+
+                Rectangle {
+                    width: parent.width * parent.progress
+                    height: parent.height
+                    color: "#8bc34a"
+                }
+
+                Text {
+                    anchors.verticalCenter: parent.verticalCenter
+                    x: 4
+                    text: `${category}: ${filesDone}/${filesTotal} files, ${root.formatBytes(bytesDone)} of ${root.formatBytes(bytesTotal)}`
+                          + (rate > 0 ? `, ${root.formatBytes(rate)}/s` : "")
+                          + (eta > 0 ? `, ${Math.ceil(eta)} s left` : "")
+                }
+            }
+        }
+    }
 }
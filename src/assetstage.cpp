@@ -0,0 +1,331 @@
+#include "assetstage.h"
+
+#include "config.h"
+#include "downloader.h"
+#include "tracelog.h"
+
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QSet>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcAssets, "randomly.MyLauncher.Assets")
+
+constexpr auto tcAssets = "randomly.MyLauncher.Assets";
+
+constexpr auto ObjectsUrl = "https://resources.download.minecraft.net";
+
+} // namespace
+
+AssetStage::AssetStage(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads}
+{
+    QFile file{markerPath()};
+    if (file.open(QFile::ReadOnly))
+        m_completed = QCborValue::fromCbor(file.readAll()).toMap();
+}
+
+QString AssetStage::prepare(const QJsonObject &assetIndex, const QString &gameDirectory)
+{
+    const auto indexId = assetIndex["id"].toString();
+    const auto indexSha1 = assetIndex["sha1"].toString();
+
+    if (indexId.isEmpty())
+        return assetsRoot();
+
+    const auto index = loadIndex(assetIndex);
+    if (!index)
+        return assetsRoot();
+
+    // pre-1.6 reads them from the game directory, 1.6 and 1.7.2 from a virtual tree
+    auto layout = Layout::Objects;
+    if ((*index)["map_to_resources"].toBool())
+        layout = Layout::Resources;
+    else if ((*index)["virtual"].toBool())
+        layout = Layout::Virtual;
+
+    const auto directory = layoutDirectory(layout, indexId, gameDirectory);
+    const auto key = QString("%1|%2").arg(indexId, directory);
+
+    const QDir layoutDir{directory};
+    const auto objects = (*index)["objects"].toObject();
+
+    // launched before, so only a sample of the objects needs to be looked at
+    if (isComplete(key, indexSha1)) {
+        if (isIntact(layout, layoutDir, objects)) {
+            traceDebug(tcAssets, "assets %1 are complete in %2", indexId, directory);
+            return directory;
+        }
+
+        qCInfo(lcAssets, "assets %ls in %ls were removed since, repairing them", qUtf16Printable(indexId), qUtf16Printable(directory));
+        forget(key);
+    }
+
+    auto pending = std::make_shared<int>(0);
+    auto failed = std::make_shared<int>(0);
+
+    const auto finishIfDone = [this, pending, failed, key, indexSha1, indexId]() {
+        if (*pending > 0)
+            return;
+
+        if (*failed > 0) {
+            qCWarning(lcAssets, "%i objects of %ls are missing", *failed, qUtf16Printable(indexId));
+            return;
+        }
+
+        markComplete(key, indexSha1);
+    };
+
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        const auto object = it->toObject();
+        const auto hash = object["hash"].toString();
+        const auto size = object["size"].toInteger();
+        const auto target = layout == Layout::Objects ? QString() : layoutDir.absoluteFilePath(it.key());
+
+        if (QFileInfo{objectPath(hash)}.size() == size) {
+            if (!target.isEmpty() && !linkObject(hash, target))
+                ++*failed;
+            continue;
+        }
+
+        const auto info = objectDownload(hash, size);
+
+        ++*pending;
+
+        // names sharing an object share the transfer too, each of them gets linked once it's there
+        m_downloads->download(info, [this, hash, target, pending, failed, finishIfDone](const DownloadInfo &, bool success) {
+            if (!success || (!target.isEmpty() && !linkObject(hash, target)))
+                ++*failed;
+
+            --*pending;
+            finishIfDone();
+        });
+    }
+
+    qCInfo(lcAssets) << "assets" << indexId << ":" << *pending << "of" << objects.size() << "objects to download";
+
+    finishIfDone();
+    return directory;
+}
+
+QList<DownloadInfo> AssetStage::missingObjects(const QJsonObject &assetIndex)
+{
+    if (assetIndex["id"].toString().isEmpty())
+        return {};
+
+    const auto index = loadIndex(assetIndex);
+    if (!index)
+        return {};
+
+    QList<DownloadInfo> missing;
+    QSet<QString> seen;
+
+    const auto objects = (*index)["objects"].toObject();
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        const auto object = it->toObject();
+        const auto hash = object["hash"].toString();
+        const auto size = object["size"].toInteger();
+
+        if (seen.contains(hash) || QFileInfo{objectPath(hash)}.size() == size)
+            continue;
+
+        seen.insert(hash);
+        missing.append(objectDownload(hash, size));
+    }
+
+    return missing;
+}
+
+std::optional<QJsonObject> AssetStage::loadIndex(const QJsonObject &assetIndex)
+{
+    const auto path = QString("%1/indexes/%2.json").arg(assetsRoot(), assetIndex["id"].toString());
+    const auto sha1 = assetIndex["sha1"].toString();
+
+    const auto read = [&path]() -> std::optional<QJsonObject> {
+        QFile file{path};
+        if (!file.open(QFile::ReadOnly))
+            return {};
+
+        return QJsonDocument::fromJson(file.readAll()).object();
+    };
+
+    // the index itself is only trusted after the objects are complete, so check its hash unless they are
+    bool upToDate = false;
+    for (auto it = m_completed.cbegin(); it != m_completed.cend() && !upToDate; ++it)
+        upToDate = it.key().toString().startsWith(assetIndex["id"].toString() + '|') && it.value().toString() == sha1;
+
+    if (!upToDate) {
+        QFile file{path};
+        upToDate = file.open(QFile::ReadOnly) && QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1).toHex() == sha1.toLatin1();
+    }
+
+    if (upToDate)
+        return read();
+
+    DownloadInfo info;
+    info.url = assetIndex["url"].toString();
+    info.path = path;
+    info.size = assetIndex["size"].toInteger();
+    info.sha1 = sha1;
+    info.transferClass = TransferClass::Assets;
+
+    bool ok = false;
+    bool done = false;
+
+    QEventLoop loop;
+    m_downloads->download(info, [&](const DownloadInfo &, bool success) {
+        ok = success;
+        done = true;
+        loop.quit();
+    });
+
+    if (!done)
+        loop.exec();
+
+    if (!ok) {
+        qCWarning(lcAssets, "cannot download asset index %ls", qUtf16Printable(info.url));
+        return {};
+    }
+
+    return read();
+}
+
+QString AssetStage::layoutDirectory(Layout layout, const QString &indexId, const QString &gameDirectory) const
+{
+    switch (layout) {
+    case Layout::Objects:
+        return assetsRoot();
+    case Layout::Virtual:
+        return QString("%1/virtual/%2").arg(assetsRoot(), indexId);
+    case Layout::Resources:
+        return gameDirectory + "/resources";
+    }
+
+    return assetsRoot();
+}
+
+QString AssetStage::assetsRoot() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/assets";
+}
+
+QString AssetStage::objectPath(const QString &hash) const
+{
+    return QString("%1/objects/%2/%3").arg(assetsRoot(), hash.left(2), hash);
+}
+
+DownloadInfo AssetStage::objectDownload(const QString &hash, qint64 size) const
+{
+    DownloadInfo info;
+    info.url = QString("%1/%2/%3").arg(ObjectsUrl, hash.left(2), hash);
+    info.path = objectPath(hash);
+    info.size = size;
+    info.sha1 = hash;
+    info.transferClass = TransferClass::Assets;
+
+    return info;
+}
+
+bool AssetStage::linkObject(const QString &hash, const QString &target)
+{
+    const auto source = objectPath(hash);
+
+    // left over from an earlier, interrupted run
+    if (const QFileInfo existing{target}; existing.exists()) {
+        if (existing.size() == QFileInfo{source}.size())
+            return true;
+
+        QFile::remove(target);
+    }
+
+    QDir{}.mkpath(QFileInfo{target}.absolutePath());
+
+#ifdef Q_OS_UNIX
+    if (::link(QFile::encodeName(source).constData(), QFile::encodeName(target).constData()) == 0)
+        return true;
+#endif
+
+    // i.e. the game directory is on another filesystem
+    traceDebug(tcAssets, "cannot link %1, copying it", target);
+    return QFile::copy(source, target);
+}
+
+bool AssetStage::isComplete(const QString &key, const QString &indexSha1) const
+{
+    return !indexSha1.isEmpty() && m_completed.value(key).toString() == indexSha1;
+}
+
+bool AssetStage::isIntact(Layout layout, const QDir &layoutDir, const QJsonObject &objects) const
+{
+    // deleting resources/, virtual/<id> or objects/ as a whole is the common case
+    if (!layoutDir.exists(layout == Layout::Objects ? "objects" : "."))
+        return false;
+
+    // a few objects spread over the index catch most of the rest, without a stat() per object
+    constexpr qsizetype Samples = 16;
+    const auto names = objects.keys();
+    const auto step = std::max<qsizetype>(names.size() / Samples, 1);
+
+    for (qsizetype i = 0; i < names.size(); i += step) {
+        const auto object = objects[names[i]].toObject();
+        const auto hash = object["hash"].toString();
+
+        if (QFileInfo{objectPath(hash)}.size() != object["size"].toInteger())
+            return false;
+
+        if (layout != Layout::Objects && !layoutDir.exists(names[i]))
+            return false;
+    }
+
+    return true;
+}
+
+void AssetStage::markComplete(const QString &key, const QString &indexSha1)
+{
+    m_completed.insert(key, indexSha1);
+    saveMarkers();
+
+    qCInfo(lcAssets, "assets complete in %ls", qUtf16Printable(key.section('|', 1)));
+}
+
+void AssetStage::forget(const QString &key)
+{
+    m_completed.remove(key);
+    saveMarkers();
+}
+
+void AssetStage::saveMarkers() const
+{
+    QDir{}.mkpath(QFileInfo{markerPath()}.absolutePath());
+
+    QSaveFile file{markerPath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcAssets, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{m_completed}.toCbor());
+    file.commit();
+}
+
+QString AssetStage::markerPath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/assets.cbor";
+}
+
+} // namespace randomly
@@ -0,0 +1,54 @@
+#ifndef ASSETSTAGE_H
+#define ASSETSTAGE_H
+
+#include <QCborMap>
+#include <QDir>
+#include <QJsonObject>
+#include <QObject>
+
+namespace randomly {
+
+class Downloader;
+struct DownloadInfo;
+
+// the asset index of a version and its objects. Old versions want them under their real names,
+// in assets/virtual/<index> or <game directory>/resources; those trees are hardlinks into assets/objects
+class AssetStage : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AssetStage(Downloader *downloads, QObject *parent = nullptr);
+
+    // blocks for the index only, objects are downloaded in the background and linked as they come in.
+    // returns the directory the game expects its assets in, for ${game_assets}
+    QString prepare(const QJsonObject &assetIndex, const QString &gameDirectory);
+
+    // objects of the index that aren't in assets/objects yet, once per hash. Only the index gets downloaded
+    QList<DownloadInfo> missingObjects(const QJsonObject &assetIndex);
+
+private:
+    enum class Layout { Objects, Virtual, Resources };
+
+    std::optional<QJsonObject> loadIndex(const QJsonObject &assetIndex);
+    QString layoutDirectory(Layout layout, const QString &indexId, const QString &gameDirectory) const;
+    QString assetsRoot() const;
+    QString objectPath(const QString &hash) const;
+    DownloadInfo objectDownload(const QString &hash, qint64 size) const;
+
+    bool linkObject(const QString &hash, const QString &target);
+
+    bool isComplete(const QString &key, const QString &indexSha1) const;
+    bool isIntact(Layout layout, const QDir &layoutDir, const QJsonObject &objects) const;
+    void markComplete(const QString &key, const QString &indexSha1);
+    void forget(const QString &key);
+    void saveMarkers() const;
+    QString markerPath() const;
+
+    Downloader *m_downloads;
+
+    QCborMap m_completed; // "<index id>|<layout directory>" -> sha1 of the index it was completed for
+};
+
+} // namespace randomly
+
+#endif // ASSETSTAGE_H
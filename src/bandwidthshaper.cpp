@@ -0,0 +1,170 @@
+#include "bandwidthshaper.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QLoggingCategory>
+
+#include <algorithm>
+#include <limits>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcShaper, "randomly.MyLauncher.Bandwidth")
+
+constexpr auto tcShaper = "randomly.MyLauncher.Bandwidth";
+
+constexpr int TickInterval = 100;        // ms
+constexpr double ThroughputWeight = 0.2; // of the newest sample, ~half a second to follow a change
+constexpr qint64 MinimumBurst = 16 * 1024;
+constexpr qint64 MinimumReadBuffer = 16 * 1024;
+constexpr qint64 UnlimitedReadBuffer = 1024 * 1024;
+
+} // namespace
+
+QString transferClassName(TransferClass transferClass)
+{
+    switch (transferClass) {
+    case TransferClass::Libraries:
+        return "libraries";
+    case TransferClass::Assets:
+        return "assets";
+    case TransferClass::Runtimes:
+        return "runtimes";
+    case TransferClass::Modpacks:
+        return "modpacks";
+    }
+
+    return {};
+}
+
+void TokenBucket::setRate(qint64 bytesPerSecond)
+{
+    m_rate = bytesPerSecond;
+
+    // a quarter of a second worth of burst, so short stalls don't lose bandwidth
+    m_capacity = std::max(MinimumBurst, m_rate / 4);
+    m_tokens = m_lastRefill.isValid() ? std::min<double>(m_tokens, m_capacity) : m_capacity;
+    m_lastRefill.start();
+}
+
+qint64 TokenBucket::available()
+{
+    if (!isLimited())
+        return std::numeric_limits<qint64>::max();
+
+    m_tokens = std::min<double>(m_capacity, m_tokens + m_rate * m_lastRefill.restart() / 1000.0);
+
+    return std::max<qint64>(0, m_tokens);
+}
+
+void TokenBucket::consume(qint64 bytes)
+{
+    if (isLimited())
+        m_tokens -= bytes;
+}
+
+BandwidthShaper::BandwidthShaper(QObject *parent)
+    : QObject{parent}
+{
+    reloadLimits();
+
+    m_ticker.setInterval(TickInterval);
+    connect(&m_ticker, &QTimer::timeout, this, &BandwidthShaper::tick);
+}
+
+void BandwidthShaper::reloadLimits()
+{
+    auto cfg = Config::instance();
+
+    m_totalLimit = cfg->getConfig("bandwidth_limit").toLongLong() * 1024;
+    m_total.setRate(m_totalLimit);
+
+    for (int i = 0; i < TransferClassCount; ++i) {
+        m_limits[i] = cfg->getConfig("bandwidth_limit_" + transferClassName(TransferClass(i))).toLongLong() * 1024;
+        m_classes[i].setRate(m_limits[i]);
+    }
+
+    if (m_totalLimit > 0)
+        qCInfo(lcShaper) << "limiting downloads to" << m_totalLimit / 1024 << "KiB/s";
+}
+
+qint64 BandwidthShaper::grant(TransferClass transferClass, qint64 wanted)
+{
+    auto &bucket = m_classes[int(transferClass)];
+
+    const auto granted = std::min({wanted, m_total.available(), bucket.available()});
+    account(transferClass, granted);
+
+    if (granted < wanted)
+        traceDebug(tcShaper, "throttling %1: %2 of %3 B", transferClassName(transferClass), granted, wanted);
+
+    return granted;
+}
+
+void BandwidthShaper::account(TransferClass transferClass, qint64 bytes)
+{
+    m_total.consume(bytes);
+    m_classes[int(transferClass)].consume(bytes);
+    m_bytesSinceTick[int(transferClass)] += bytes;
+}
+
+qint64 BandwidthShaper::readBufferSize(TransferClass transferClass) const
+{
+    auto limit = m_limits[int(transferClass)];
+    if (m_totalLimit > 0)
+        limit = limit > 0 ? std::min(limit, m_totalLimit) : m_totalLimit;
+
+    if (limit == 0)
+        return UnlimitedReadBuffer;
+
+    // about one tick worth of data
+    return std::clamp(limit * TickInterval / 1000, MinimumReadBuffer, UnlimitedReadBuffer);
+}
+
+double BandwidthShaper::throughput() const
+{
+    double total = 0;
+    for (const auto throughput: m_throughput)
+        total += throughput;
+
+    return total;
+}
+
+void BandwidthShaper::setActive(bool active)
+{
+    if (active == m_ticker.isActive())
+        return;
+
+    if (active) {
+        m_sinceTick.start();
+        m_ticker.start();
+        return;
+    }
+
+    m_ticker.stop();
+
+    m_bytesSinceTick = {};
+    m_throughput = {};
+    emit throughputUpdated();
+}
+
+void BandwidthShaper::tick()
+{
+    const auto elapsed = m_sinceTick.restart();
+    if (elapsed <= 0)
+        return;
+
+    for (int i = 0; i < TransferClassCount; ++i) {
+        const auto sample = m_bytesSinceTick[i] * 1000.0 / elapsed;
+        m_throughput[i] = ThroughputWeight * sample + (1 - ThroughputWeight) * m_throughput[i];
+        m_bytesSinceTick[i] = 0;
+    }
+
+    emit throughputUpdated();
+    emit tokensAvailable();
+}
+
+} // namespace randomly
@@ -0,0 +1,79 @@
+#ifndef BANDWIDTHSHAPER_H
+#define BANDWIDTHSHAPER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+#include <array>
+
+namespace randomly {
+
+enum class TransferClass { Libraries, Assets, Runtimes, Modpacks };
+constexpr int TransferClassCount = 4;
+
+QString transferClassName(TransferClass transferClass);
+
+class TokenBucket
+{
+public:
+    void setRate(qint64 bytesPerSecond); // 0 means unlimited
+    bool isLimited() const { return m_rate > 0; }
+
+    qint64 available();
+    void consume(qint64 bytes); // may go into debt, the next refills pay it back
+
+private:
+    qint64 m_rate = 0;
+    qint64 m_capacity = 0;
+    double m_tokens = 0;
+    QElapsedTimer m_lastRefill;
+};
+
+// hands out how much each transfer may read right now. Limits come from the config in KiB/s,
+// `bandwidth_limit` for everything together and `bandwidth_limit_<class>` per transfer class
+class BandwidthShaper : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BandwidthShaper(QObject *parent = nullptr);
+
+    void reloadLimits();
+
+    // how much of `wanted` may be read now, already accounted for
+    qint64 grant(TransferClass transferClass, qint64 wanted);
+    // for data that has to be read anyway, i.e. the rest of a finished reply
+    void account(TransferClass transferClass, qint64 bytes);
+
+    // small enough that not reading stops the socket quickly, so the sender backs off
+    qint64 readBufferSize(TransferClass transferClass) const;
+
+    // bytes per second, averaged over the last few seconds
+    double throughput(TransferClass transferClass) const { return m_throughput[int(transferClass)]; }
+    double throughput() const;
+
+    void setActive(bool active);
+
+signals:
+    // throttled transfers should try reading again
+    void tokensAvailable();
+    void throughputUpdated();
+
+private:
+    void tick();
+
+    TokenBucket m_total;
+    std::array<TokenBucket, TransferClassCount> m_classes;
+    std::array<qint64, TransferClassCount> m_limits{};
+    qint64 m_totalLimit = 0;
+
+    std::array<qint64, TransferClassCount> m_bytesSinceTick{};
+    std::array<double, TransferClassCount> m_throughput{};
+
+    QTimer m_ticker;
+    QElapsedTimer m_sinceTick;
+};
+
+} // namespace randomly
+
+#endif // BANDWIDTHSHAPER_H
@@ -0,0 +1,604 @@
+#include "commandlineinterface.h"
+
+#include "auth.h"
+#include "downloader.h"
+#include "instancestore.h"
+#include "launchhistory.h"
+#include "minecraftcommandlineprovider.h"
+#include "modindexer.h"
+#include "peercache.h"
+#include "modrinthpackinstaller.h"
+#include "pagecacheprefetcher.h"
+#include "processsupervisor.h"
+#include "snapshotstore.h"
+#include "upgradeplanner.h"
+#include "versioncatalogue.h"
+
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTextStream>
+
+#include <cstring>
+
+namespace randomly {
+
+CommandLineInterface::CommandLineInterface(QObject *parent)
+    : QObject{parent}
+    , m_downloads{new Downloader(this)}
+    , m_provider{new MinecraftCommandLineProvider(m_downloads, this)}
+    , m_catalogue{new VersionCatalogue(this)}
+{
+    connect(m_downloads, &Downloader::downloadCompleted, this, [this](int remaining) {
+        report({{"event", "progress"}, {"remaining", remaining}, {"failed", m_failedDownloads}},
+               QString("%1 downloads remaining").arg(remaining));
+    });
+
+    connect(m_downloads, &Downloader::downloadFailed, this, [this](const QString &url, const QString &reason) {
+        ++m_failedDownloads;
+        report({{"event", "failed"}, {"url", url}, {"reason", reason}},
+               QString("failed to download %1: %2").arg(url, reason));
+    });
+}
+
+bool CommandLineInterface::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int CommandLineInterface::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("MyLauncher without the GUI");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"headless", "Run without the GUI (required for all other options)."},
+        {"prefetch", "Download everything the given versions need, sharing one download queue."},
+        {"verify", "Check that all files of the given versions exist and match their hashes."},
+        {"print-command", "Print the resolved command line of each version."},
+        {"mods", "List the mods of each version, with duplicate ids and missing dependencies."},
+        {"launch", "Launch the first given version."},
+        {"install-mrpack", "Install a Modrinth modpack, its version is worked on before the given ones.", "file"},
+        {"clone-from", "Create each given version as a clone of an installed one.", "version"},
+        {"snapshot", "Snapshot the game directory of each given version, before anything else touches it."},
+        {"restore", "Restore the game directory of each given version to a snapshot (\"latest\" for the newest).", "snapshot"},
+        {"snapshots", "List the snapshots of each given version."},
+        {"keep-snapshots", "Keep only the newest <count> snapshots of each given version and drop unused chunks.", "count"},
+        {"plan-upgrade", "Report what switching from <version> to each given version downloads, and prefetch just that.", "version"},
+        {"dry-run", "With --plan-upgrade, only report."},
+        {"serve", "Keep running afterwards and serve downloaded files to other launchers (needs peer_port)."},
+        {"launch-report", "Compare the recorded launches of the given versions (or all) and flag regressions."},
+        {"window", "With --launch-report, compare the last <days> to the ones before instead of launcher versions.", "days"},
+        {"rebalance", "With cpu_placement, split the cores again between every running instance on this host."},
+        {"json", "Report progress as one JSON object per line."},
+    });
+    parser.addPositionalArgument("versions", "Versions to work on.", "<version>...");
+
+    parser.process(arguments);
+
+    m_json = parser.isSet("json");
+
+    auto versions = parser.positionalArguments();
+
+    // 0 would drop every snapshot, so would a typo
+    int keepSnapshots = 0;
+    if (parser.isSet("keep-snapshots")) {
+        bool valid = false;
+        keepSnapshots = parser.value("keep-snapshots").toInt(&valid);
+
+        if (!valid || keepSnapshots < 1) {
+            report({{"event", "invalid-option"}, {"option", "keep-snapshots"}, {"value", parser.value("keep-snapshots")}},
+                   QString("--keep-snapshots needs a count of at least 1, not \"%1\"").arg(parser.value("keep-snapshots")));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // a snapshot first, so it still has the game directory as it was before this run. That includes the pack's own
+    // instance, its overrides are written on install. A first install has nothing to keep yet
+    if (parser.isSet("snapshot")) {
+        auto snapshotted = versions;
+
+        if (parser.isSet("install-mrpack")) {
+            const auto pack = ModrinthPackInstaller::versionIdOf(parser.value("install-mrpack"));
+            if (!pack.isEmpty() && QFileInfo{InstanceStore::gameDirectory(pack)}.isDir())
+                snapshotted.prepend(pack);
+        }
+
+        // nothing runs on a game directory we couldn't save
+        for (const auto &version: std::as_const(snapshotted)) {
+            if (!snapshot(version))
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (parser.isSet("install-mrpack")) {
+        const auto version = installPack(parser.value("install-mrpack"));
+        if (version.isEmpty())
+            return EXIT_FAILURE;
+
+        versions.prepend(version);
+    }
+
+    if (parser.isSet("launch-report"))
+        return launchReport(versions, parser.value("window").toInt()) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (parser.isSet("rebalance")) {
+        ProcessSupervisor supervisor;
+        const auto moved = supervisor.rebalance();
+        report({{"event", "rebalanced"}, {"moved", moved}}, QString("moved %1 instances").arg(moved));
+
+        if (versions.isEmpty())
+            return EXIT_SUCCESS;
+    }
+
+    // a site cache doesn't need to work on any version itself
+    if (versions.isEmpty() && parser.isSet("serve")) {
+        serve();
+        return EXIT_SUCCESS;
+    }
+
+    if (versions.isEmpty())
+        parser.showHelp(EXIT_FAILURE);
+
+    bool ok = true;
+
+    if (parser.isSet("restore")) {
+        for (const auto &version: versions)
+            ok &= restore(version, parser.value("restore"));
+    }
+
+    if (parser.isSet("keep-snapshots")) {
+        for (const auto &version: versions) {
+            const auto removed = SnapshotStore::prune(version, keepSnapshots);
+            report({{"event", "snapshots-pruned"}, {"version", version}, {"chunksRemoved", removed}},
+                   QString("%1: %2 unused chunks removed").arg(version).arg(removed));
+        }
+    }
+
+    if (parser.isSet("snapshots")) {
+        for (const auto &version: versions)
+            listSnapshots(version);
+    }
+
+    if (parser.isSet("clone-from")) {
+        for (const auto &version: versions)
+            ok &= clone(parser.value("clone-from"), version);
+    }
+
+    if (parser.isSet("plan-upgrade"))
+        ok &= planUpgrade(parser.value("plan-upgrade"), versions, !parser.isSet("dry-run"));
+
+    if (parser.isSet("prefetch"))
+        ok &= prefetch(versions);
+
+    if (parser.isSet("verify"))
+        ok &= verify(versions);
+
+    if (parser.isSet("print-command")) {
+        for (const auto &version: versions)
+            ok &= printCommand(version);
+    }
+
+    if (parser.isSet("mods")) {
+        for (const auto &version: versions)
+            ok &= listMods(version);
+    }
+
+    if (parser.isSet("launch"))
+        return launch(versions.first());
+
+    if (parser.isSet("serve"))
+        serve();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+QString CommandLineInterface::installPack(const QString &packPath)
+{
+    ModrinthPackInstaller installer(m_downloads);
+    bool done = false;
+    bool ok = false;
+
+    connect(&installer, &ModrinthPackInstaller::progress, this, [this](int filesDone, int filesTotal) {
+        report({{"event", "pack-progress"}, {"done", filesDone}, {"total", filesTotal}},
+               QString("%1/%2 modpack files").arg(filesDone).arg(filesTotal));
+    });
+
+    QEventLoop loop;
+    connect(&installer, &ModrinthPackInstaller::finished, &loop, [&](bool success) {
+        done = true;
+        ok = success;
+        loop.quit();
+    });
+
+    if (!installer.install(packPath)) {
+        report({{"event", "pack-failed"}, {"pack", packPath}}, QString("cannot install %1").arg(packPath));
+        return {};
+    }
+
+    // finished() already came if every file was up to date
+    if (!done)
+        loop.exec();
+
+    // failures that a mirror made up for don't count, the installer knows the real result
+    m_failedDownloads = 0;
+
+    report({{"event", "pack-installed"}, {"pack", packPath}, {"version", installer.versionId()}, {"ok", ok}},
+           ok ? QString("installed %1").arg(installer.versionId()) : QString("some files of %1 could not be downloaded").arg(packPath));
+    return ok ? installer.versionId() : QString();
+}
+
+bool CommandLineInterface::clone(const QString &templateId, const QString &id)
+{
+    const auto result = InstanceStore::clone(templateId, id);
+
+    report({{"event", "cloned"}, {"template", templateId}, {"version", id}, {"ok", result.ok},
+            {"hardlinked", result.hardlinked}, {"reflinked", result.reflinked}, {"copied", result.copied}, {"bytesCopied", result.bytesCopied}},
+           result.ok ? QString("cloned %1 to %2, %3 KiB copied").arg(templateId, id).arg(result.bytesCopied / 1024)
+                     : QString("cannot clone %1 to %2").arg(templateId, id));
+    return result.ok;
+}
+
+bool CommandLineInterface::snapshot(const QString &id)
+{
+    const auto result = SnapshotStore::snapshot(id);
+
+    report({{"event", "snapshot"}, {"version", id}, {"ok", result.ok}, {"snapshot", result.id}, {"files", result.files},
+            {"filesChanged", result.filesChanged}, {"bytesRead", result.bytesRead}, {"chunksStored", result.chunksStored},
+            {"bytesStored", result.bytesStored}, {"elapsed", result.elapsed}},
+           result.ok ? QString("snapshot %1 of %2: %3 of %4 files changed, %5 KiB stored in %6 ms")
+                           .arg(result.id, id).arg(result.filesChanged).arg(result.files).arg(result.bytesStored / 1024).arg(result.elapsed)
+                     : QString("cannot snapshot %1").arg(id));
+    return result.ok;
+}
+
+bool CommandLineInterface::restore(const QString &id, const QString &snapshotId)
+{
+    const auto result = SnapshotStore::restore(id, snapshotId);
+
+    report({{"event", "restored"}, {"version", id}, {"ok", result.ok}, {"snapshot", snapshotId}, {"filesRestored", result.filesRestored},
+            {"filesUnchanged", result.filesUnchanged}, {"filesRemoved", result.filesRemoved}, {"bytesWritten", result.bytesWritten}},
+           result.ok ? QString("restored %1 to %2: %3 files written, %4 unchanged, %5 removed")
+                           .arg(id, snapshotId).arg(result.filesRestored).arg(result.filesUnchanged).arg(result.filesRemoved)
+                     : QString("cannot restore %1 to %2").arg(id, snapshotId));
+    return result.ok;
+}
+
+void CommandLineInterface::listSnapshots(const QString &id)
+{
+    for (const auto &info: SnapshotStore::list(id)) {
+        report({{"event", "snapshot-info"}, {"version", id}, {"snapshot", info.id}, {"created", info.created.toString(Qt::ISODate)},
+                {"files", info.files}, {"size", info.size}},
+               QString("%1 %2: %3 files, %4 MiB").arg(id, info.id).arg(info.files).arg(info.size >> 20));
+    }
+}
+
+bool CommandLineInterface::planUpgrade(const QString &from, const QStringList &versions, bool prefetch)
+{
+    UpgradePlanner planner{m_downloads};
+    bool ok = true;
+
+    for (const auto &version: versions) {
+        const auto plan = planner.plan(from, version);
+        if (!plan) {
+            report({{"event", "unknown-version"}, {"version", version}}, QString("cannot plan %1 -> %2").arg(from, version));
+            ok = false;
+            continue;
+        }
+
+        QJsonObject bytes;
+        QStringList perClass;
+        for (int i = 0; i < TransferClassCount; ++i) {
+            bytes[transferClassName(TransferClass(i))] = plan->bytes[i];
+            if (plan->bytes[i] > 0)
+                perClass.append(QString("%1 MiB %2").arg(plan->bytes[i] >> 20).arg(transferClassName(TransferClass(i))));
+        }
+
+        QStringList changes{QString("%1 libraries added, %2 removed").arg(plan->librariesAdded.size()).arg(plan->librariesRemoved.size())};
+        if (plan->clientChanged)
+            changes.append("new client jar");
+        if (plan->assetIndexFrom != plan->assetIndexTo)
+            changes.append(QString("assets %1 -> %2").arg(plan->assetIndexFrom, plan->assetIndexTo));
+        if (plan->runtimeFrom != plan->runtimeTo)
+            changes.append(QString("java %1 -> %2").arg(plan->runtimeFrom, plan->runtimeTo));
+
+        report({{"event", "upgrade-plan"}, {"from", from}, {"to", version},
+                {"librariesAdded", QJsonArray::fromStringList(plan->librariesAdded)}, {"librariesRemoved", QJsonArray::fromStringList(plan->librariesRemoved)},
+                {"assetIndexFrom", plan->assetIndexFrom}, {"assetIndexTo", plan->assetIndexTo},
+                {"runtimeFrom", plan->runtimeFrom}, {"runtimeTo", plan->runtimeTo}, {"clientChanged", plan->clientChanged},
+                {"files", plan->files.size()}, {"bytes", bytes}, {"totalBytes", plan->totalBytes()}, {"unknownSizes", plan->unknownSizes}},
+               QString("%1 -> %2: %3\n  %4 files to download, %5 MiB%6%7")
+                   .arg(from, version, changes.join(", "))
+                   .arg(plan->files.size())
+                   .arg(plan->totalBytes() >> 20)
+                   .arg(perClass.isEmpty() ? QString() : " (" + perClass.join(", ") + ")")
+                   .arg(plan->unknownSizes > 0 ? QString(", %1 files of unknown size").arg(plan->unknownSizes) : QString()));
+
+        if (prefetch)
+            planner.prefetch(*plan);
+    }
+
+    if (prefetch)
+        ok &= waitForDownloads();
+
+    return ok;
+}
+
+bool CommandLineInterface::prefetch(const QStringList &versions)
+{
+    bool ok = true;
+
+    // everything goes into the same queue first, so shared libraries are only transferred once
+    for (const auto &version: versions) {
+        if (!ensureVersion(version)) {
+            ok = false;
+            continue;
+        }
+
+        report({{"event", "prefetch"}, {"version", version}}, QString("prefetching %1").arg(version));
+        m_provider->prefetch(version);
+    }
+
+    ok &= waitForDownloads();
+
+    report({{"event", "prefetched"}, {"ok", ok}, {"transferred", m_downloads->bytesTransferred()}, {"written", m_downloads->bytesDecoded()}},
+           QString("prefetch %1, transferred %2 MiB for %3 MiB")
+               .arg(ok ? "done" : "failed")
+               .arg(m_downloads->bytesTransferred() >> 20)
+               .arg(m_downloads->bytesDecoded() >> 20));
+    return ok;
+}
+
+bool CommandLineInterface::verify(const QStringList &versions)
+{
+    bool ok = true;
+
+    for (const auto &version: versions) {
+        // without its json we wouldn't even know which files to check
+        if (!ensureVersion(version)) {
+            ok = false;
+            continue;
+        }
+
+        const auto broken = m_provider->verify(version);
+        ok &= broken.isEmpty();
+
+        report({{"event", "verified"}, {"version", version}, {"ok", broken.isEmpty()}, {"broken", QJsonArray::fromStringList(broken)}},
+               broken.isEmpty() ? QString("%1 is complete").arg(version)
+                                : QString("%1 is missing or has corrupt files:\n  %2").arg(version, broken.join("\n  ")));
+    }
+
+    return ok;
+}
+
+bool CommandLineInterface::printCommand(const QString &version)
+{
+    if (!ensureVersion(version))
+        return false;
+
+    const auto commandLine = m_provider->getCommandLine(version);
+    if (!commandLine)
+        return false;
+
+    // getCommandLine schedules missing downloads, don't exit before they're done
+    const auto ok = waitForDownloads();
+
+    report({{"event", "command"}, {"version", version}, {"program", commandLine->first}, {"arguments", QJsonArray::fromStringList(commandLine->second)}},
+           commandLine->first + " " + commandLine->second.join(' '));
+    return ok;
+}
+
+bool CommandLineInterface::listMods(const QString &version)
+{
+    const auto mods = ModIndexer::scan(InstanceStore::gameDirectory(version) + "/mods");
+
+    for (const auto &mod: mods) {
+        report({{"event", "mod"}, {"version", version}, {"file", mod.file}, {"loader", mod.loader}, {"id", mod.id},
+                {"modVersion", mod.version}, {"name", mod.name}, {"depends", QJsonArray::fromStringList(mod.depends)}},
+               mod.id.isEmpty() ? QString("%1: no metadata").arg(mod.file) : QString("%1 %2 (%3)").arg(mod.id, mod.version, mod.file));
+    }
+
+    const auto duplicates = ModIndexer::duplicates(mods);
+    for (auto it = duplicates.cbegin(); it != duplicates.cend(); ++it) {
+        report({{"event", "mod-duplicate"}, {"version", version}, {"id", it.key()}, {"files", QJsonArray::fromStringList(*it)}},
+               QString("%1 is provided by %2").arg(it.key(), it->join(", ")));
+    }
+
+    const auto missing = ModIndexer::missingDependencies(mods);
+    for (auto it = missing.cbegin(); it != missing.cend(); ++it) {
+        report({{"event", "mod-missing"}, {"version", version}, {"id", it.key()}, {"requiredBy", QJsonArray::fromStringList(*it)}},
+               QString("%1 is required by %2, but missing").arg(it.key(), it->join(", ")));
+    }
+
+    return duplicates.isEmpty() && missing.isEmpty();
+}
+
+int CommandLineInterface::launch(const QString &version)
+{
+    if (!ensureVersion(version))
+        return EXIT_FAILURE;
+
+    const auto files = m_provider->launchFiles(version);
+    LaunchMeter meter{version, files, m_downloads};
+
+    // the disk reads the JVM's working set while authentication waits for the network
+    PageCachePrefetcher::prefetch(files).then(this, [this](const PrefetchResult &result) {
+        report({{"event", "warmed"}, {"files", result.files}, {"bytes", result.bytes}, {"skipped", result.skipped}, {"elapsed", result.elapsed}},
+               QString("prefetched %1 MiB in %2 ms").arg(result.bytes >> 20).arg(result.elapsed));
+    });
+
+    Auth auth;
+    auth.obtainMinecraftToken();
+    meter.authenticated();
+
+    const auto commandLine = m_provider->getCommandLine(version);
+    if (!commandLine)
+        return EXIT_FAILURE;
+
+    meter.resolved();
+
+    if (!waitForDownloads())
+        return EXIT_FAILURE;
+
+    meter.downloaded(commandLine->first);
+
+    report({{"event", "launch"}, {"version", version}}, QString("launching %1").arg(version));
+
+    ProcessSupervisor supervisor;
+    auto game = supervisor.launch(version, commandLine->first, commandLine->second);
+    meter.recordOnExit(game);
+
+    connect(game, &GameInstance::statsUpdated, this, [this, game]() {
+        const auto stats = game->stats();
+        report({{"event", "stats"}, {"pid", stats.pid}, {"cpu", stats.cpuPercent}, {"rss", stats.rss}, {"threads", stats.threads}, {"uptime", stats.uptime}},
+               QString("pid %1: %2% cpu, %3 MiB, %4 threads").arg(stats.pid).arg(stats.cpuPercent, 0, 'f', 1).arg(stats.rss >> 20).arg(stats.threads));
+    });
+
+    QEventLoop loop;
+    connect(game, &GameInstance::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    const auto exitCode = game->exitCode();
+
+    report({{"event", "exit"}, {"version", version}, {"code", exitCode}, {"peakRss", game->stats().peakRss}, {"firstWindow", game->stats().firstWindow}},
+           QString("%1 exited with %2").arg(version).arg(exitCode));
+    return exitCode;
+}
+
+bool CommandLineInterface::launchReport(const QStringList &versions, int windowDays)
+{
+    const auto records = LaunchHistory::load(versions);
+
+    QList<LaunchRecord> before;
+    QList<LaunchRecord> after;
+    QString beforeLabel;
+    QString afterLabel;
+
+    if (windowDays > 0) {
+        const auto start = QDateTime::currentDateTime().addDays(-windowDays);
+        const auto previousStart = start.addDays(-windowDays);
+
+        for (const auto &record: records) {
+            if (record.time >= start)
+                after.append(record);
+            else if (record.time >= previousStart)
+                before.append(record);
+        }
+
+        afterLabel = QString("the last %1 days").arg(windowDays);
+        beforeLabel = QString("the %1 days before").arg(windowDays);
+    } else {
+        // in the order they were first used, the newest one against the one before it
+        QStringList launcherVersions;
+        for (const auto &record: records) {
+            if (!launcherVersions.contains(record.launcherVersion))
+                launcherVersions.append(record.launcherVersion);
+        }
+
+        if (launcherVersions.size() < 2) {
+            report({{"event", "launch-report"}, {"launches", records.size()}},
+                   QString("%1 launches recorded, all with the same launcher version. Use --window to compare time windows").arg(records.size()));
+            return true;
+        }
+
+        beforeLabel = launcherVersions[launcherVersions.size() - 2];
+        afterLabel = launcherVersions.last();
+
+        for (const auto &record: records) {
+            if (record.launcherVersion == beforeLabel)
+                before.append(record);
+            else if (record.launcherVersion == afterLabel)
+                after.append(record);
+        }
+    }
+
+    report({{"event", "launch-report"}, {"before", beforeLabel}, {"after", afterLabel}, {"launchesBefore", before.size()}, {"launchesAfter", after.size()}},
+           QString("%1 (%2 launches) vs. %3 (%4 launches)").arg(beforeLabel).arg(before.size()).arg(afterLabel).arg(after.size()));
+
+    bool regressed = false;
+
+    for (const auto &change: LaunchHistory::compare(before, after)) {
+        regressed |= change.regressed;
+
+        report({{"event", "launch-metric"}, {"metric", change.metric}, {"unit", change.unit}, {"before", change.before}, {"after", change.after},
+                {"beforeP90", change.beforeP90}, {"afterP90", change.afterP90}, {"regressed", change.regressed}},
+               QString("%1: median %2 -> %3 %4, p90 %5 -> %6%7")
+                   .arg(change.metric)
+                   .arg(change.before, 0, 'f', 0)
+                   .arg(change.after, 0, 'f', 0)
+                   .arg(change.unit)
+                   .arg(change.beforeP90, 0, 'f', 0)
+                   .arg(change.afterP90, 0, 'f', 0)
+                   .arg(change.regressed ? "  REGRESSION" : ""));
+    }
+
+    // a different runtime explains a lot
+    QStringList javaBefore;
+    QStringList javaAfter;
+    for (const auto &record: std::as_const(before))
+        javaBefore.append(record.java);
+    for (const auto &record: std::as_const(after))
+        javaAfter.append(record.java);
+
+    javaBefore.removeDuplicates();
+    javaBefore.sort();
+    javaAfter.removeDuplicates();
+    javaAfter.sort();
+
+    if (!before.isEmpty() && !after.isEmpty() && javaBefore != javaAfter) {
+        report({{"event", "launch-java-changed"}, {"before", QJsonArray::fromStringList(javaBefore)}, {"after", QJsonArray::fromStringList(javaAfter)}},
+               QString("java changed:\n  %1\n->\n  %2").arg(javaBefore.join("\n  "), javaAfter.join("\n  ")));
+    }
+
+    return !regressed;
+}
+
+void CommandLineInterface::serve()
+{
+    const auto port = m_downloads->peers()->port();
+    if (port == 0) {
+        report({{"event", "serve-failed"}}, "not serving, peer_port isn't set or the port is taken");
+        return;
+    }
+
+    report({{"event", "serving"}, {"port", port}}, QString("serving downloaded files on port %1").arg(port));
+
+    // until killed
+    QEventLoop loop;
+    loop.exec();
+}
+
+bool CommandLineInterface::ensureVersion(const QString &version)
+{
+    if (m_catalogue->ensureVersionJson(version, m_downloads))
+        return true;
+
+    report({{"event", "unknown-version"}, {"version", version}}, QString("unknown version %1").arg(version));
+    return false;
+}
+
+bool CommandLineInterface::waitForDownloads()
+{
+    // failures before this wait count too, they're what the launch is missing
+    m_downloads->waitForPending();
+    return m_failedDownloads == 0;
+}
+
+void CommandLineInterface::report(const QJsonObject &event, const QString &message)
+{
+    static QTextStream out(stdout);
+
+    if (m_json)
+        out << QJsonDocument(event).toJson(QJsonDocument::Compact) << Qt::endl;
+    else
+        out << message << Qt::endl;
+}
+
+} // namespace randomly
@@ -0,0 +1,57 @@
+#ifndef COMMANDLINEINTERFACE_H
+#define COMMANDLINEINTERFACE_H
+
+#include <QJsonObject>
+#include <QObject>
+
+namespace randomly {
+
+class Downloader;
+class MinecraftCommandLineProvider;
+class VersionCatalogue;
+
+// headless mode: runs on a QCoreApplication and never touches QML or the GUI
+class CommandLineInterface : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CommandLineInterface(QObject *parent = nullptr);
+
+    // checked before any application object exists, so we know which one to create
+    static bool isRequested(int argc, char *argv[]);
+
+    int run(const QStringList &arguments);
+
+private:
+    QString installPack(const QString &packPath);
+    bool clone(const QString &templateId, const QString &id);
+    bool snapshot(const QString &id);
+    bool restore(const QString &id, const QString &snapshotId);
+    void listSnapshots(const QString &id);
+    bool planUpgrade(const QString &from, const QStringList &versions, bool prefetch);
+    bool prefetch(const QStringList &versions);
+    bool verify(const QStringList &versions);
+    bool printCommand(const QString &version);
+    bool listMods(const QString &version);
+    int launch(const QString &version);
+    bool launchReport(const QStringList &versions, int windowDays);
+    void serve();
+
+    // fetches the version json (and installs loaders) if needed, reports the version as unknown otherwise
+    bool ensureVersion(const QString &version);
+    bool waitForDownloads();
+
+    // one JSON object per line with --json, a human readable message otherwise
+    void report(const QJsonObject &event, const QString &message);
+
+    Downloader *m_downloads;
+    MinecraftCommandLineProvider *m_provider;
+    VersionCatalogue *m_catalogue;
+
+    bool m_json = false;
+    int m_failedDownloads = 0;
+};
+
+} // namespace randomly
+
+#endif // COMMANDLINEINTERFACE_H
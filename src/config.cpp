@@ -1,12 +1,17 @@
 #include "config.h"
 
+#include "tracelog.h"
+
 #include <QDir>
 #include <QLoggingCategory>
 
 namespace randomly {
 
 Q_LOGGING_CATEGORY(lcConfig, "randomly.MyLauncher.Config")
-Q_LOGGING_CATEGORY(lcTmpConfig, "randomly.MyLauncher.Config.Tmp")
+
+// these are hit for every single placeholder, so they go to the trace buffer instead of QDebug
+constexpr auto tcConfig = "randomly.MyLauncher.Config";
+constexpr auto tcTmpConfig = "randomly.MyLauncher.Config.Tmp";
 
 Config::Config(QObject *parent)
     : QObject{parent}
@@ -64,25 +69,25 @@ QPointer<Config> Config::instance()
 
 QVariant Config::getConfig(QString name)
 {
-    qCInfo(lcConfig) << "getting config" << name;
+    traceDebug(tcConfig, "getting config %1", name);
     return m_settings.value(name, QVariant{});
 }
 
 void Config::setConfig(QString name, QVariant value)
 {
-    qCInfo(lcConfig) << "setting config" << name << "->" << value.toString();
+    traceDebug(tcConfig, "setting config %1 -> %2", name, value);
     m_settings.setValue(name, value);
 }
 
 QVariant Config::getTemp(QString name)
 {
-    qCInfo(lcTmpConfig) << "getting temp" << name;
+    traceDebug(tcTmpConfig, "getting temp %1", name);
     return m_temp.value(name, QVariant{});
 }
 
 void Config::setTemp(QString name, QVariant value)
 {
-    qCInfo(lcTmpConfig) << "setting temp" << name << "->" << value.toString();
+    traceDebug(tcTmpConfig, "setting temp %1 -> %2", name, value);
 
     m_temp[name] = value;
 }
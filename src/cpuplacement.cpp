@@ -0,0 +1,450 @@
+#include "cpuplacement.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCborMap>
+#include <QCborValue>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QLoggingCategory>
+#include <QMap>
+#include <QProcess>
+#include <QSaveFile>
+#include <QThread>
+
+#include <algorithm>
+#include <cerrno>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcPlacement, "randomly.MyLauncher.Placement")
+
+constexpr auto tcPlacement = "randomly.MyLauncher.Placement";
+
+constexpr int LockTimeout = 5000; // ms
+constexpr int LockStaleTime = 30000; // ms
+
+// placed, but not started yet. Downloads happen before placing, so spawning is all that's left
+constexpr qint64 PendingTimeout = 5 * 60 * 1000; // ms
+
+#ifdef Q_OS_LINUX
+QByteArray readSysFile(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    return file.readAll().trimmed();
+}
+
+// "0-3,8-11"
+QList<int> parseCpuList(const QByteArray &list)
+{
+    QList<int> cpus;
+
+    for (const auto &range: list.split(',')) {
+        const auto bounds = range.split('-');
+        bool ok = false;
+        const auto first = bounds[0].toInt(&ok);
+        if (!ok)
+            continue;
+
+        const auto last = bounds.size() > 1 ? bounds[1].toInt() : first;
+        for (auto cpu = first; cpu <= last; ++cpu)
+            cpus.append(cpu);
+    }
+
+    return cpus;
+}
+
+// hyperthreads share a core id within a package
+QList<QList<int>> groupByCore(const QList<int> &cpus)
+{
+    QMap<QPair<int, int>, QList<int>> cores;
+
+    for (const auto cpu: cpus) {
+        const auto topology = QString("/sys/devices/system/cpu/cpu%1/topology/").arg(cpu);
+        const auto package = readSysFile(topology + "physical_package_id").toInt();
+
+        bool ok = false;
+        auto core = readSysFile(topology + "core_id").toInt(&ok);
+        if (!ok)
+            core = cpu; // no topology, every cpu is a core of its own
+
+        cores[{package, core}].append(cpu);
+    }
+
+    return cores.values();
+}
+#endif
+
+// clock ticks after boot, field 22 of /proc/<pid>/stat. Pids are reused, a pid with this start time isn't.
+// 0 if it can't be told
+qint64 startTimeOf(qint64 pid)
+{
+#ifdef Q_OS_LINUX
+    QFile file{QString("/proc/%1/stat").arg(pid)};
+    if (pid <= 0 || !file.open(QFile::ReadOnly))
+        return 0;
+
+    // the command in field 2 may contain spaces and parentheses of its own, the fields after its last ) don't
+    const auto stat = file.readAll();
+    const auto fields = stat.mid(stat.lastIndexOf(')') + 1).simplified().split(' ');
+    if (fields.size() < 20)
+        return 0;
+
+    return fields[19].toLongLong();
+#else
+    Q_UNUSED(pid);
+    return 0;
+#endif
+}
+
+} // namespace
+
+int CpuTopology::Node::cpuCount() const
+{
+    int count = 0;
+    for (const auto &core: cores)
+        count += core.size();
+
+    return count;
+}
+
+CpuTopology CpuTopology::detect()
+{
+    CpuTopology topology;
+
+#ifdef Q_OS_LINUX
+    // a cpuset or taskset restricts us, and everything we start
+    QList<int> allowed;
+
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &affinity))
+                allowed.append(cpu);
+        }
+    }
+
+    const QDir nodes{"/sys/devices/system/node"};
+    for (const auto &entry: nodes.entryList({"node*"}, QDir::Dirs)) {
+        bool ok = false;
+        const auto id = entry.mid(4).toInt(&ok);
+        if (!ok)
+            continue;
+
+        auto cpus = parseCpuList(readSysFile(nodes.filePath(entry + "/cpulist")));
+        cpus.removeIf([&allowed](int cpu) { return !allowed.contains(cpu); });
+
+        // memory only nodes, or none of their cpus are ours
+        if (cpus.isEmpty())
+            continue;
+
+        topology.nodes.append({id, groupByCore(cpus)});
+    }
+
+    // no NUMA support in the kernel
+    if (topology.nodes.isEmpty() && !allowed.isEmpty())
+        topology.nodes.append({0, groupByCore(allowed)});
+
+    std::sort(topology.nodes.begin(), topology.nodes.end(), [](const Node &a, const Node &b) { return a.id < b.id; });
+#endif
+
+    if (topology.nodes.isEmpty()) {
+        Node node;
+        for (int cpu = 0; cpu < QThread::idealThreadCount(); ++cpu)
+            node.cores.append({cpu});
+
+        topology.nodes.append(node);
+    }
+
+    for (const auto &node: std::as_const(topology.nodes))
+        traceInfo(tcPlacement, "node %1: %2 cores, %3 cpus", node.id, node.cores.size(), node.cpuCount());
+
+    return topology;
+}
+
+CpuPlacement::CpuPlacement(const CpuTopology &topology)
+    : m_topology{topology}
+{}
+
+bool CpuPlacement::isEnabled() const
+{
+    return Config::instance()->getConfig("cpu_placement").toBool();
+}
+
+QHash<QString, Placement> CpuPlacement::add(const QString &name)
+{
+    return locked([this, &name]() {
+        // relaunched, it starts over
+        const auto previous = m_entries.take(name);
+
+        // the node whose instances would get the most cores each
+        int best = m_topology.nodes.first().id;
+        double bestShare = -1;
+
+        for (const auto &node: std::as_const(m_topology.nodes)) {
+            const auto instances = std::count_if(m_entries.cbegin(), m_entries.cend(), [&node](const Entry &entry) { return entry.node == node.id; });
+            const auto share = double(node.cores.size()) / (instances + 1);
+
+            if (share > bestShare) {
+                best = node.id;
+                bestShare = share;
+            }
+        }
+
+        m_entries.insert(name, {best, 0, QDateTime::currentMSecsSinceEpoch()});
+
+        auto placements = splitNode(best);
+        if (previous.node >= 0 && previous.node != best)
+            placements.insert(splitNode(previous.node));
+
+        return placements;
+    });
+}
+
+void CpuPlacement::started(const QString &name, qint64 pid)
+{
+    locked([this, &name, pid]() {
+        if (auto entry = m_entries.find(name); entry != m_entries.end()) {
+            entry->pid = pid;
+            entry->startTime = startTimeOf(pid);
+        }
+
+        return QHash<QString, Placement>{};
+    });
+}
+
+QHash<QString, Placement> CpuPlacement::remove(const QString &name)
+{
+    return locked([this, &name]() -> QHash<QString, Placement> {
+        if (!m_entries.contains(name))
+            return {};
+
+        return splitNode(m_entries.take(name).node);
+    });
+}
+
+QHash<QString, Placement> CpuPlacement::rebalance()
+{
+    return locked([this]() {
+        QHash<QString, Placement> placements;
+        for (const auto &node: std::as_const(m_topology.nodes))
+            placements.insert(splitNode(node.id));
+
+        return placements;
+    });
+}
+
+template<typename Function>
+QHash<QString, Placement> CpuPlacement::locked(Function function)
+{
+    QDir{}.mkpath(QFileInfo{registryPath()}.absolutePath());
+
+    // held for a few file operations only, a lock older than that belongs to a launcher that died holding it
+    QLockFile lock{registryPath() + ".lock"};
+    lock.setStaleLockTime(LockStaleTime);
+
+    if (!lock.tryLock(LockTimeout)) {
+        qCWarning(lcPlacement, "cannot lock %ls, placing without the other launchers", qUtf16Printable(registryPath()));
+        return function();
+    }
+
+    load();
+    dropStale();
+
+    const auto placements = function();
+    save();
+
+    return placements;
+}
+
+void CpuPlacement::load()
+{
+    m_entries.clear();
+
+    QFile file{registryPath()};
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    const auto map = QCborValue::fromCbor(file.readAll()).toMap();
+    for (auto it = map.cbegin(); it != map.cend(); ++it) {
+        const auto entry = it.value().toMap();
+        m_entries.insert(it.key().toString(), {int(entry.value("node").toInteger(-1)), entry.value("pid").toInteger(), entry.value("since").toInteger(),
+                                               entry.value("startTime").toInteger()});
+    }
+}
+
+void CpuPlacement::save() const
+{
+    QCborMap map;
+    for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it)
+        map.insert(it.key(), QCborMap{{"node", it->node}, {"pid", it->pid}, {"since", it->since}, {"startTime", it->startTime}});
+
+    QSaveFile file{registryPath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcPlacement, "cannot write %ls: %ls", qUtf16Printable(registryPath()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{map}.toCbor());
+    file.commit();
+}
+
+void CpuPlacement::dropStale()
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+
+    m_entries.removeIf([now](const QHash<QString, Entry>::iterator it) {
+        // the launcher died before it could spawn
+        if (it->pid <= 0)
+            return now - it->since > PendingTimeout;
+
+#ifdef Q_OS_UNIX
+        // EPERM: it runs, just as another user
+        if (::kill(pid_t(it->pid), 0) != 0 && errno == ESRCH)
+            return true;
+#endif
+
+        // the instance died and something else got its pid
+        const auto startTime = startTimeOf(it->pid);
+        return it->startTime != 0 && startTime != 0 && startTime != it->startTime;
+    });
+}
+
+QString CpuPlacement::registryPath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/placements.cbor";
+}
+
+QHash<QString, Placement> CpuPlacement::splitNode(int nodeId) const
+{
+    const auto node = std::find_if(m_topology.nodes.cbegin(), m_topology.nodes.cend(), [nodeId](const CpuTopology::Node &node) { return node.id == nodeId; });
+    if (node == m_topology.nodes.cend())
+        return {};
+
+    QStringList instances;
+    for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it) {
+        if (it->node == nodeId)
+            instances.append(it.key());
+    }
+
+    // launch order, the first instances get the first cores
+    std::sort(instances.begin(), instances.end(), [this](const QString &a, const QString &b) {
+        const auto sinceA = m_entries[a].since;
+        const auto sinceB = m_entries[b].since;
+        return sinceA != sinceB ? sinceA < sinceB : a < b;
+    });
+
+    const auto cores = node->cores.size();
+    QHash<QString, Placement> placements;
+
+    // whole cores each, hyperthreads of one core never end up with different instances.
+    // With more instances than cores, they have to share
+    for (qsizetype i = 0; i < instances.size(); ++i) {
+        Placement placement;
+        placement.node = nodeId;
+        placement.pid = m_entries[instances[i]].pid;
+        placement.startTime = m_entries[instances[i]].startTime;
+
+        auto first = i * cores / instances.size();
+        auto last = (i + 1) * cores / instances.size();
+        if (first == last) {
+            first = i % cores;
+            last = first + 1;
+        }
+
+        for (auto core = first; core < last; ++core)
+            placement.cpus += node->cores[core];
+
+        placements.insert(instances[i], placement);
+
+        traceDebug(tcPlacement, "%1: node %2, %3 cpus", instances[i], nodeId, placement.cpus.size());
+    }
+
+    return placements;
+}
+
+void CpuPlacement::applyAtSpawn(QProcess &process, const Placement &placement)
+{
+#ifdef Q_OS_LINUX
+    if (placement.cpus.isEmpty())
+        return;
+
+    // prepared here, between fork and exec nothing may allocate
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const auto cpu: placement.cpus)
+        CPU_SET(cpu, &cpus);
+
+    // preferred, not bound: a full node spills over instead of the JVM getting killed
+    const unsigned long nodes = placement.node >= 0 && placement.node < int(sizeof(unsigned long) * 8) ? 1UL << placement.node : 0;
+
+    process.setChildProcessModifier([cpus, nodes]() {
+        ::sched_setaffinity(0, sizeof(cpus), &cpus);
+
+        if (nodes != 0)
+            ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodes, sizeof(nodes) * 8);
+    });
+#else
+    Q_UNUSED(process);
+    Q_UNUSED(placement);
+#endif
+}
+
+bool CpuPlacement::apply(qint64 pid, const Placement &placement)
+{
+#ifdef Q_OS_LINUX
+    if (pid <= 0 || placement.cpus.isEmpty())
+        return false;
+
+    // the registry may be older than the pid, moving whoever has it now would be wrong
+    if (placement.startTime != 0 && startTimeOf(pid) != placement.startTime) {
+        qCWarning(lcPlacement, "not moving %lli, it isn't the instance that was placed", pid);
+        return false;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const auto cpu: placement.cpus)
+        CPU_SET(cpu, &cpus);
+
+    // affinity is per thread, and a JVM has plenty of them
+    bool ok = true;
+    const QDir tasks{QString("/proc/%1/task").arg(pid)};
+
+    for (const auto &task: tasks.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (::sched_setaffinity(task.toInt(), sizeof(cpus), &cpus) != 0)
+            ok = false;
+    }
+
+    if (!ok)
+        qCWarning(lcPlacement, "cannot move every thread of %lli", pid);
+
+    return ok;
+#else
+    Q_UNUSED(pid);
+    Q_UNUSED(placement);
+    return false;
+#endif
+}
+
+} // namespace randomly
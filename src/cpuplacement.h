@@ -0,0 +1,97 @@
+#ifndef CPUPLACEMENT_H
+#define CPUPLACEMENT_H
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+class QProcess;
+
+namespace randomly {
+
+// the cpus we may use, by NUMA node. Within a node, hyperthreads of the same core are next to each other
+struct CpuTopology
+{
+    struct Node
+    {
+        int id = 0;
+        QList<QList<int>> cores; // cpus of each physical core
+        int cpuCount() const;
+    };
+
+    QList<Node> nodes;
+
+    // sysfs on Linux, restricted to our own affinity (i.e. a cpuset). One node with every cpu elsewhere
+    static CpuTopology detect();
+};
+
+struct Placement
+{
+    int node = -1;
+    QList<int> cpus;
+    qint64 pid = 0; // of the instance, 0 until it runs
+    qint64 startTime = 0; // of that pid, so a reused one isn't mistaken for it. 0 if unknown
+};
+
+// spreads game instances over NUMA nodes and splits each node's cores between the instances on it, so several
+// servers on one host stop competing for the same cores and remote memory. Instances never move to another node
+// once they run, their memory would have to follow; only the cores of a node are split again when an instance
+// on it starts or stops.
+// Every launcher on the host shares one registry, cache/placements.cbor, so servers started by separate launcher
+// processes still split the cores between them. Entries of processes that died without telling us are dropped,
+// a pid counts as the same process only as long as its start time matches
+class CpuPlacement
+{
+public:
+    explicit CpuPlacement(const CpuTopology &topology = CpuTopology::detect());
+
+    // "cpu_placement" in the config, off by default
+    bool isEnabled() const;
+
+    // picks the node with the most cores per instance. Returns the placements of every instance on that node,
+    // the new one included, since they all change
+    QHash<QString, Placement> add(const QString &name);
+
+    // the instance runs now, so others can move it when its node is split again
+    void started(const QString &name, qint64 pid);
+
+    // returns the new placements of the instances that shared the node
+    QHash<QString, Placement> remove(const QString &name);
+
+    // splits every node again, i.e. after a launcher was killed along with its instances
+    QHash<QString, Placement> rebalance();
+
+    // applied between fork and exec: affinity and a preferred memory node for the whole process
+    static void applyAtSpawn(QProcess &process, const Placement &placement);
+
+    // affinity of every thread of a running process, ours or another launcher's. Its memory policy can't be
+    // changed from outside. Refused if pid isn't the process that was placed anymore
+    static bool apply(qint64 pid, const Placement &placement);
+
+private:
+    struct Entry
+    {
+        int node = -1;
+        qint64 pid = 0;
+        qint64 since = 0; // ms since epoch, launch order
+        qint64 startTime = 0;
+    };
+
+    // read-modify-write of the registry under its lock file
+    template<typename Function>
+    QHash<QString, Placement> locked(Function function);
+
+    void load();
+    void save() const;
+    void dropStale();
+    QString registryPath() const;
+
+    QHash<QString, Placement> splitNode(int node) const;
+
+    CpuTopology m_topology;
+    QHash<QString, Entry> m_entries; // as of the last locked read
+};
+
+} // namespace randomly
+
+#endif // CPUPLACEMENT_H
@@ -1,181 +1,419 @@
 #include "downloader.h"
 
 #include "config.h"
+#include "peercache.h"
+#include "tracelog.h"
+#include "transferdecoder.h"
+#include "writepipeline.h"
 
-#include <QDir>
-#include <QFile>
+#include <QEventLoop>
 #include <QLoggingCategory>
 #include <QNetworkReply>
 #include <QJsonObject>
 
-#include <archive.h>
-#include <archive_entry.h>
-
 namespace randomly {
 
 Q_LOGGING_CATEGORY(lcDownload, "randomly.MyLauncher.Download")
 
+constexpr auto tcDownload = "randomly.MyLauncher.Download";
+
 Downloader::Downloader(QObject *parent)
     : QObject{parent}
     , m_ctrl(new QNetworkAccessManager(this))
+    , m_shaper{new BandwidthShaper(this)}
+    , m_peers{new PeerCache(this)}
+    , m_writes{new WritePipeline(this)}
 {
+    // decoders wait for data most of the time, so there may be more of them than cores
+    m_decoderPool.setMaxThreadCount(16);
+
     connect(m_ctrl, &QNetworkAccessManager::finished, this, &Downloader::confirmDownload);
+    connect(m_shaper, &BandwidthShaper::tokensAvailable, this, &Downloader::resumeThrottled);
 }
 
-void Downloader::download(const DownloadInfo &info)
+bool Downloader::waitForPending()
 {
-    qCInfo(lcDownload) << "downloading" << info.url << "to" << info.path;
-    auto req = QNetworkRequest(info.url);
+    bool ok = true;
+
+    if (pendingDownloads() > 0) {
+        QEventLoop loop;
+        const auto quitIfDone = [this, &loop]() {
+            if (pendingDownloads() == 0)
+                loop.quit();
+        };
+
+        connect(this, &Downloader::downloadCompleted, &loop, quitIfDone);
+        connect(this, &Downloader::downloadFailed, &loop, [&ok, quitIfDone]() {
+            ok = false;
+            quitIfDone();
+        });
+        loop.exec();
+    }
 
-    req.setRawHeader("Cache-Control", "no-cache");
+    return ok;
+}
+
+void Downloader::download(const DownloadInfo &info, DownloadCallback callback)
+{
+    // somebody else already asked for this, so just wait for their transfer
+    if (auto pending = m_downloads.find(info.url); pending != m_downloads.end()) {
+        traceDebug(tcDownload, "joining in-flight download of %1", info.url);
+        pending->requesters.append({info, std::move(callback)});
+        return;
+    }
+
+    traceDebug(tcDownload, "downloading %1 to %2", info.url, info.path);
 
     if (info.size == 0)
         qCWarning(lcDownload) << "requesting 0 B file: " << info.url;
 
-    if (info.sha1 == "")
+    if (info.sha1 == "" && info.sha512 == "")
         qCWarning(lcDownload) << "requesting file without hash: " << info.url;
 
-    m_ctrl->get(req);
-    m_downloads.insert(info.url, info);
+    setActive(true);
+
+    auto &totals = m_totals[int(info.transferClass)];
+    ++totals.filesTotal;
+    totals.bytesTotal += info.size;
+
+    auto &pending = m_downloads[info.url];
+    pending.requesters.append({info, std::move(callback)});
+
+    // peers are asked by hash, and there'd be nothing to check their answer against anyway
+    pending.source = info.sha1.isEmpty() ? m_peers->peerCount() : 0;
+
+    startTransfer(info.url, pending);
+
+    m_shaper->setActive(true);
+}
+
+void Downloader::startTransfer(const QString &url, PendingDownload &pending)
+{
+    const auto &info = pending.requesters.first().info;
+
+    auto req = QNetworkRequest(isFromPeer(pending) ? m_peers->peerUrl(pending.source, info.sha1) : QUrl{info.url});
+
+    // whoever serves it, the transfer stays known by the url it was asked for
+    req.setAttribute(QNetworkRequest::User, url);
+
+    req.setRawHeader("Cache-Control", "no-cache");
+
+    // setting this ourselves stops Qt from inflating behind our back, we decode while receiving instead
+    req.setRawHeader("Accept-Encoding", "gzip");
+
+    if (isFromPeer(pending))
+        req.setTransferTimeout(m_peers->timeout());
+
+    auto reply = m_ctrl->get(req);
+    pending.reply = reply;
+
+    // while we don't read, qt stops reading the socket once this is full and tcp slows the sender down
+    reply->setReadBufferSize(m_shaper->readBufferSize(info.transferClass));
+    connect(reply, &QNetworkReply::readyRead, this, [this, reply]() { receiveData(reply); });
+}
+
+bool Downloader::retryFromNextSource(const QString &url, PendingDownload pending)
+{
+    if (!isFromPeer(pending))
+        return false;
+
+    const auto &info = pending.requesters.first().info;
+    traceDebug(tcDownload, "peer %1 cannot provide %2", m_peers->peerUrl(pending.source, info.sha1).authority(), info.url);
+
+    // whatever the peer sent is thrown away and doesn't count
+    m_totals[int(info.transferClass)].bytesDone -= pending.received;
+    pending.received = 0;
+    pending.body.clear();
+    pending.decoder.reset();
+    pending.reply = nullptr;
+    ++pending.source;
+
+    auto &retry = m_downloads[url];
+    retry = std::move(pending);
+    startTransfer(url, retry);
+
+    return true;
+}
+
+bool Downloader::isFromPeer(const PendingDownload &pending) const
+{
+    return pending.source < m_peers->peerCount();
 }
 
-void Downloader::downloadNative(DownloadInfo &info)
+void Downloader::announce(const DownloadInfo &info)
+{
+    m_peers->remember(info.sha1, info.path);
+}
+
+void Downloader::downloadNative(DownloadInfo &info, DownloadCallback callback)
 {
     info.native = true;
-    download(info);
+    download(info, std::move(callback));
+}
+
+QList<DownloadInfo> Downloader::queuedDownloads() const
+{
+    QList<DownloadInfo> queued;
+    queued.reserve(m_downloads.size());
+
+    for (const auto &pending: m_downloads)
+        queued.append(pending.requesters.first().info);
+
+    return queued;
+}
+
+void Downloader::receiveData(QNetworkReply *reply, bool remainder)
+{
+    const auto pending = m_downloads.find(reply->request().attribute(QNetworkRequest::User).toString());
+    if (pending == m_downloads.end())
+        return;
+
+    const auto &info = pending->requesters.first().info;
+
+    if (!pending->decoder) {
+        // plain transfers are collected until they're complete
+        if (const auto compression = compressionOf(info, reply, isFromPeer(*pending)); compression != DownloadInfo::Compression::None)
+            pending->decoder = std::make_shared<TransferDecoder>(compression, &m_decoderPool);
+    }
+
+    const auto available = reply->bytesAvailable();
+    if (available <= 0)
+        return;
+
+    // the rest of a finished reply has to be read anyway, it just counts against the next refills
+    qint64 length = available;
+    if (remainder)
+        m_shaper->account(info.transferClass, available);
+    else
+        length = m_shaper->grant(info.transferClass, available);
+
+    if (length == 0)
+        return; // paused until the next refill
+
+    const auto chunk = reply->read(length);
+    m_bytesTransferred += chunk.size();
+    if (isFromPeer(*pending))
+        m_bytesFromPeers += chunk.size();
+    m_totals[int(info.transferClass)].bytesDone += chunk.size();
+    pending->received += chunk.size();
+
+    if (pending->decoder)
+        pending->decoder->feed(chunk);
+    else
+        pending->body.append(chunk);
+}
+
+void Downloader::resumeThrottled()
+{
+    if (m_downloads.isEmpty()) {
+        m_shaper->setActive(false);
+        return;
+    }
+
+    QList<QNetworkReply *> throttled;
+    for (const auto &pending: std::as_const(m_downloads)) {
+        if (pending.reply && pending.reply->bytesAvailable() > 0)
+            throttled.append(pending.reply);
+    }
+
+    for (auto reply: std::as_const(throttled))
+        receiveData(reply);
 }
 
 void Downloader::confirmDownload(QNetworkReply *reply)
 {
-    const auto info = m_downloads[reply->url().toString()];
-    if (info.url == "")
-        return; // already downloaded/duplicate
+    reply->deleteLater();
+
+    // reply->url() is the final url after redirects, and may be a peer's, we need the one we asked for
+    const auto url = reply->request().attribute(QNetworkRequest::User).toString();
+    if (!m_downloads.contains(url))
+        return; // not one of ours
+
+    if (reply->error() != QNetworkReply::NoError) {
+        const auto pending = m_downloads.take(url);
+
+        // peers not having everything is normal
+        if (!isFromPeer(pending))
+            qCWarning(lcDownload, "failed to download %ls: %ls", qUtf16Printable(url), qUtf16Printable(reply->errorString()));
+
+        failDownload(url, pending, reply->errorString());
+        return;
+    }
+
+    // whatever is still buffered in the reply
+    receiveData(reply, true);
+
+    auto &pending = m_downloads[url];
+    pending.reply = nullptr;
+
+    // the transfer stays pending until it's decoded, so joiners still get to share it
+    if (const auto decoder = pending.decoder) {
+        decoder->finish().then(this, [this, url](const std::optional<QByteArray> &data) { completeDownload(url, data); });
+        return;
+    }
+
+    completeDownload(url, std::exchange(pending.body, {}));
+}
+
+void Downloader::completeDownload(const QString &url, const std::optional<QByteArray> &data)
+{
+    const auto &pending = m_downloads[url];
+    const auto info = pending.requesters.first().info;
 
-    qCInfo(lcDownload) << "recieved reply for" << info.url;
+    traceDebug(tcDownload, "recieved reply for %1 (%2 requesters)", info.url, pending.requesters.size());
 
-    if (info.size != reply->size() && info.size != 0) {
-        qInfo().noquote() << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute)
-                          << reply->size()
-                          << reply->header(QNetworkRequest::ContentLengthHeader)
-                          << reply->rawHeaderPairs();
-        qCCritical(lcDownload, "failed to download %ls: size doesn't match (actual: %lli expected: %lli)", qUtf16Printable(info.url), reply->size(), info.size);
+    if (!data) {
+        qCWarning(lcDownload, "failed to download %ls: cannot decompress", qUtf16Printable(info.url));
+        failDownload(url, m_downloads.take(url), "corrupt compressed data");
         return;
     }
 
-    const auto data = reply->readAll();
+    m_bytesDecoded += data->size();
+
+    if (info.size != data->size() && info.size != 0) {
+        qCCritical(lcDownload, "failed to download %ls: size doesn't match (actual: %lli expected: %lli)", qUtf16Printable(info.url), data->size(), info.size);
+        failDownload(url, m_downloads.take(url), "size mismatch");
+        return;
+    }
 
     // can't compare hashes if none is provided
     if (info.sha1 != "") {
         QCryptographicHash sha1(QCryptographicHash::Sha1);
-        sha1.addData(data);
+        sha1.addData(*data);
 
         const auto hashResult = sha1.result().toHex();
 
         if (hashResult != info.sha1.toLocal8Bit()) {
             qCWarning(lcDownload, "failed to download %ls: hash doesn't match", qUtf16Printable(info.url));
+            failDownload(url, m_downloads.take(url), "hash mismatch");
             return;
         }
     }
 
-    // create full path
-    QDir path = info.path;
-
-    // ok this might be stupid, but idk another way around QDir's cd and cdUp limitations
-    auto parent = path.filesystemAbsolutePath().parent_path();
-    QDir(parent).mkpath(".");
-
-    QFile output(info.path);
-
-    if (!output.open(QFile::WriteOnly)) {
-        qCWarning(lcDownload, "failed to open %ls: %ls", qUtf16Printable(info.path), qUtf16Printable(output.errorString()));
+    if (info.sha512 != "" && QCryptographicHash::hash(*data, QCryptographicHash::Sha512).toHex() != info.sha512.toLatin1()) {
+        qCWarning(lcDownload, "failed to download %ls: sha512 doesn't match", qUtf16Printable(info.url));
+        failDownload(url, m_downloads.take(url), "hash mismatch");
         return;
     }
 
-    m_downloads.remove(info.url);
+    // the transfer stays pending until its files are committed, so nobody exits before they're on disk and whoever
+    // asks for it meanwhile joins in instead of starting it over
+    // requesters usually want the same path, but nothing stops two of them from wanting different ones
+    QHash<QString, bool> executable;
+    for (const auto &requester: pending.requesters)
+        executable[requester.info.path] |= requester.info.executable;
 
-    output.write(data);
+    auto written = std::make_shared<QHash<QString, bool>>();
 
-    output.close();
+    for (auto it = executable.cbegin(); it != executable.cend(); ++it) {
+        m_writes->write({it.key(), *data, it.value(), [this, url, written, path = it.key(), files = executable.size()](bool success) {
+            written->insert(path, success);
 
-    if (info.native)
-        extractNative(info);
-
-    emit downloadCompleted(m_downloads.size());
+            if (written->size() == files)
+                finishDownload(url, *written);
+        }});
+    }
 }
 
-void Downloader::extractNative(const DownloadInfo &info)
+void Downloader::finishDownload(const QString &url, const QHash<QString, bool> &written)
 {
-    // qInfo() << "extracting" << info.path;
-    // extract(info.path.toUtf8().data());
+    const auto pending = m_downloads.take(url);
+    const auto &info = pending.requesters.first().info;
 
-    qInfo() << "extracting native" << info.path;
+    QList<PendingDownload::Requester> late;
 
-    archive_entry *entry;
-    archive *a = archive_read_new();
-    archive_read_support_format_all(a);
-    archive_read_support_filter_all(a);
+    for (const auto &requester: pending.requesters) {
+        const auto &target = requester.info;
 
-    int r = archive_read_open_filename(a, info.path.toUtf8().data(), 16384);
-    if (r != ARCHIVE_OK) {
-        qCInfo(lcDownload) << "unable to read archive" << info.path;
-        return;
+        // joined while the data was being written, to a path nobody else wanted. Rare enough to just fetch it again
+        if (!written.contains(target.path)) {
+            late.append(requester);
+            continue;
+        }
+
+        if (requester.callback)
+            requester.callback(target, written[target.path]);
     }
 
-    const auto targetDir = QDir(Config::instance()->getConfig("mcRoot").toString() + "/bin/" + Config::instance()->getTemp("version_name").toString() + "/");
+    // verified and committed, so peers may have it
+    for (auto it = written.cbegin(); it != written.cend(); ++it) {
+        if (it.value())
+            m_peers->remember(info.sha1, it.key());
+    }
 
-    while (true) {
-        r = archive_read_next_header(a, &entry);
+    // compressed transfers received fewer bytes than they're worth
+    auto &totals = m_totals[int(info.transferClass)];
+    ++totals.filesDone;
+    totals.bytesDone += info.size - pending.received;
 
-        if (r == ARCHIVE_EOF)
-            break;
-        if (r != ARCHIVE_OK)
-            qCWarning(lcDownload) << "archive_read_next_header() failed: " << archive_error_string(a);
+    for (const auto &requester: std::as_const(late))
+        download(requester.info, requester.callback);
 
-        auto dest = targetDir.absoluteFilePath(archive_entry_pathname(entry));
+    emit downloadCompleted(pendingDownloads());
 
-        if (dest.endsWith('/')) {// directory
-            targetDir.mkpath(dest);
-            continue;
-        }
+    if (pendingDownloads() == 0)
+        setActive(false);
+}
 
-        qCInfo(lcDownload) << "inflating" << dest;
+void Downloader::failDownload(const QString &url, const PendingDownload &pending, const QString &reason)
+{
+    // a peer not having it, or sending garbage, just means asking the next one
+    if (retryFromNextSource(url, pending))
+        return;
 
-        QFile f(dest);
-        if (!f.open(QFile::WriteOnly)) {
-            qCWarning(lcDownload) << "cannot open" << dest << ":" << f.errorString();
-            continue;
-        }
+    const auto &info = pending.requesters.first().info;
 
-        QDataStream d(&f);
+    // out of the totals, so a mirror retrying it doesn't count twice
+    auto &totals = m_totals[int(info.transferClass)];
+    --totals.filesTotal;
+    ++totals.filesFailed;
+    totals.bytesTotal -= info.size;
+    totals.bytesDone -= pending.received;
 
-        while(true) {
-            const char *buff;
-            size_t size;
-            off_t offset;
-            r = archive_read_data_block(a, (const void**)&buff, &size, &offset);
-            if (r == ARCHIVE_EOF)
-                break;
+    for (const auto &requester: pending.requesters) {
+        if (requester.callback)
+            requester.callback(requester.info, false);
+    }
 
-            d << QByteArray(buff, size);
-        }
+    emit downloadFailed(url, reason);
 
-#if 0
-        r = archive_write_header(ext, entry);
+    if (pendingDownloads() == 0)
+        setActive(false);
+}
 
-        if (r != ARCHIVE_OK)
-            cerr << "archive_write_header(): " << archive_error_string(ext) << endl;
+void Downloader::setActive(bool active)
+{
+    if (active == m_active)
+        return;
 
-        else {
-            copy_data(a, ext);
-            r = archive_write_finish_entry(ext);
+    // a new batch, the progress of the last one has been seen by now
+    if (active)
+        m_totals = {};
 
-            if (r != ARCHIVE_OK) {
-                cerr << "archive_write_finish_entry()" << archive_error_string(ext) << endl;
-                break;
-            }
-        }
-#endif
-    }
+    m_active = active;
+    emit activeChanged(active);
+}
+
+DownloadInfo::Compression Downloader::compressionOf(const DownloadInfo &info, QNetworkReply *reply, bool fromPeer)
+{
+    if (info.compression != DownloadInfo::Compression::None && !fromPeer)
+        return info.compression;
+
+    if (const auto encoding = reply->rawHeader("Content-Encoding"); encoding == "gzip" || encoding == "x-gzip")
+        return DownloadInfo::Compression::Gzip;
+
+    // peers send the file as it is on their disk
+    if (fromPeer)
+        return DownloadInfo::Compression::None;
+
+    // pre-compressed variants, unless we're actually asked to store the compressed file
+    const auto path = QUrl{info.url}.path();
+    if (path.endsWith(".xz") && !info.path.endsWith(".xz"))
+        return DownloadInfo::Compression::Xz;
+    if (path.endsWith(".lzma") && !info.path.endsWith(".lzma"))
+        return DownloadInfo::Compression::Lzma;
+
+    return DownloadInfo::Compression::None;
 }
 
 } // namespace randomly
@@ -1,18 +1,68 @@
 #ifndef DOWNLOADER_H
 #define DOWNLOADER_H
 
+#include "bandwidthshaper.h"
+
 #include <QNetworkAccessManager>
 #include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <array>
+#include <functional>
+#include <memory>
 
 namespace randomly {
 
 struct DownloadInfo
 {
+    enum class Compression { None, Gzip, Xz, Lzma };
+
     QString url;
     QString path;
-    qsizetype size;
+    qsizetype size; // size and hashes always describe the decoded file, as it ends up on disk
     QString sha1;
+    QString sha512; // optional, checked in addition to sha1 (modrinth provides both)
     bool native = false;
+    QStringList extractExcludes; // natives only, the version json's "extract": {"exclude": [...]}
+    bool executable = false;
+    // of the transfer, i.e. the .lzma variants of java runtime files. Content-Encoding and .xz/.lzma urls are detected anyway
+    Compression compression = Compression::None;
+    TransferClass transferClass = TransferClass::Libraries; // which bandwidth budget it counts against
+};
+
+// called once the file is on disk (success) or the transfer/verification failed
+using DownloadCallback = std::function<void(const DownloadInfo &info, bool success)>;
+
+class PeerCache;
+class TransferDecoder;
+class WritePipeline;
+
+// of everything queued since the downloader was last idle
+struct TransferTotals
+{
+    qint64 bytesDone = 0; // received so far, files that turned out broken don't count
+    qint64 bytesTotal = 0;
+    int filesDone = 0;
+    int filesTotal = 0;
+    int filesFailed = 0;
+};
+
+// everybody waiting for the same url shares one transfer
+struct PendingDownload
+{
+    struct Requester
+    {
+        DownloadInfo info;
+        DownloadCallback callback;
+    };
+
+    QList<Requester> requesters;
+    QNetworkReply *reply = nullptr;
+    int source = 0;                           // peers first, in order, upstream once they're exhausted
+    qint64 received = 0;                      // as transferred, so compressed if it is
+    QByteArray body;                          // what has been read so far, for plain transfers
+    std::shared_ptr<TransferDecoder> decoder; // only for compressed transfers
 };
 
 class Downloader : public QObject
@@ -21,21 +71,62 @@ class Downloader : public QObject
 public:
     explicit Downloader(QObject *parent = nullptr);
 
-    void download(const DownloadInfo &info);
-    void downloadNative(DownloadInfo &info);
+    void download(const DownloadInfo &info, DownloadCallback callback = {});
+    void downloadNative(DownloadInfo &info, DownloadCallback callback = {});
+
+    QList<DownloadInfo> queuedDownloads() const;
+    int pendingDownloads() const { return m_downloads.size(); } // verified ones too, until their files are written
+
+    // runs a nested event loop until nothing is pending anymore. False if a download failed meanwhile
+    bool waitForPending();
+
+    // transferred vs. written, to see what compression saves
+    qint64 bytesTransferred() const { return m_bytesTransferred; }
+    qint64 bytesDecoded() const { return m_bytesDecoded; }
+    qint64 bytesFromPeers() const { return m_bytesFromPeers; } // part of bytesTransferred
 
-    QList<DownloadInfo> queuedDownloads() { return m_downloads.values(); }
+    BandwidthShaper *shaper() const { return m_shaper; }
+    PeerCache *peers() const { return m_peers; }
+
+    // a file already on disk that matches info, so peers may get it from us
+    void announce(const DownloadInfo &info);
+
+    // plain counters, meant to be polled. Per chunk signals would flood whoever listens
+    TransferTotals totals(TransferClass transferClass) const { return m_totals[int(transferClass)]; }
+    bool isActive() const { return m_active; }
 
 signals:
     void downloadCompleted(int downloadsRemaining);
+    void downloadFailed(const QString &url, const QString &reason);
+    void activeChanged(bool active);
 
 private:
+    void startTransfer(const QString &url, PendingDownload &pending);
+    bool retryFromNextSource(const QString &url, PendingDownload pending);
+    bool isFromPeer(const PendingDownload &pending) const;
+    void receiveData(QNetworkReply *reply, bool remainder = false);
+    void resumeThrottled();
+    void setActive(bool active);
     void confirmDownload(QNetworkReply *reply);
-    void extractNative(const DownloadInfo &info);
+    void completeDownload(const QString &url, const std::optional<QByteArray> &data);
+    void finishDownload(const QString &url, const QHash<QString, bool> &written);
+    void failDownload(const QString &url, const PendingDownload &pending, const QString &reason);
+    static DownloadInfo::Compression compressionOf(const DownloadInfo &info, QNetworkReply *reply, bool fromPeer);
 
     QNetworkAccessManager *m_ctrl;
+    BandwidthShaper *m_shaper;
+    PeerCache *m_peers;
+    WritePipeline *m_writes;
+
+    QThreadPool m_decoderPool; // declared before m_downloads, the decoders need it until they're gone
+    QHash<QString, PendingDownload> m_downloads;
+
+    std::array<TransferTotals, TransferClassCount> m_totals;
+    bool m_active = false;
 
-    QHash<QString, DownloadInfo> m_downloads;
+    qint64 m_bytesTransferred = 0;
+    qint64 m_bytesDecoded = 0;
+    qint64 m_bytesFromPeers = 0;
 };
 
 } // namespace randomly
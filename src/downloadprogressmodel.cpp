@@ -0,0 +1,171 @@
+#include "downloadprogressmodel.h"
+
+#include "config.h"
+
+namespace randomly {
+
+namespace {
+
+constexpr int DefaultFps = 10;
+
+qint64 estimate(qint64 remaining, double rate)
+{
+    if (remaining <= 0)
+        return 0;
+
+    // stalled or not started yet
+    if (rate < 1)
+        return -1;
+
+    return qint64(remaining / rate);
+}
+
+bool operator==(const TransferTotals &lhs, const TransferTotals &rhs)
+{
+    return lhs.bytesDone == rhs.bytesDone && lhs.bytesTotal == rhs.bytesTotal
+        && lhs.filesDone == rhs.filesDone && lhs.filesTotal == rhs.filesTotal && lhs.filesFailed == rhs.filesFailed;
+}
+
+} // namespace
+
+bool CategoryProgress::operator==(const CategoryProgress &other) const
+{
+    return totals == other.totals && rate == other.rate && eta == other.eta;
+}
+
+DownloadProgressModel::DownloadProgressModel(Downloader *downloads, QObject *parent)
+    : QAbstractListModel{parent}
+    , m_downloads{downloads}
+{
+    const auto fps = Config::instance()->getConfig("progress_fps").toInt();
+    m_frameTimer.setInterval(1000 / (fps > 0 ? fps : DefaultFps));
+    connect(&m_frameTimer, &QTimer::timeout, this, &DownloadProgressModel::publish);
+
+    // nothing to poll while idle, but the final state still gets published
+    connect(m_downloads, &Downloader::activeChanged, this, [this](bool active) {
+        if (active)
+            m_frameTimer.start();
+        else
+            m_frameTimer.stop();
+
+        publish();
+
+        m_active = active;
+        emit activeChanged();
+    });
+}
+
+int DownloadProgressModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return TransferClassCount;
+}
+
+QVariant DownloadProgressModel::data(const QModelIndex &index, int role) const
+{
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid))
+        return {};
+
+    const auto &category = m_published[index.row()];
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case CategoryRole:
+        return transferClassName(TransferClass(index.row()));
+    case BytesDoneRole:
+        return category.totals.bytesDone;
+    case BytesTotalRole:
+        return category.totals.bytesTotal;
+    case FilesDoneRole:
+        return category.totals.filesDone;
+    case FilesTotalRole:
+        return category.totals.filesTotal;
+    case FilesFailedRole:
+        return category.totals.filesFailed;
+    case RateRole:
+        return category.rate;
+    case EtaRole:
+        return category.eta;
+    case ProgressRole:
+        return category.totals.bytesTotal > 0 ? double(category.totals.bytesDone) / category.totals.bytesTotal : 0.0;
+    }
+
+    return {};
+}
+
+QHash<int, QByteArray> DownloadProgressModel::roleNames() const
+{
+    return {
+        {CategoryRole, "category"},
+        {BytesDoneRole, "bytesDone"},
+        {BytesTotalRole, "bytesTotal"},
+        {FilesDoneRole, "filesDone"},
+        {FilesTotalRole, "filesTotal"},
+        {FilesFailedRole, "filesFailed"},
+        {RateRole, "rate"},
+        {EtaRole, "eta"},
+        {ProgressRole, "progress"},
+    };
+}
+
+double DownloadProgressModel::progress() const
+{
+    qint64 done = 0;
+    qint64 total = 0;
+
+    for (const auto &category: m_published) {
+        done += category.totals.bytesDone;
+        total += category.totals.bytesTotal;
+    }
+
+    return total > 0 ? double(done) / total : 0.0;
+}
+
+double DownloadProgressModel::rate() const
+{
+    double rate = 0;
+    for (const auto &category: m_published)
+        rate += category.rate;
+
+    return rate;
+}
+
+qint64 DownloadProgressModel::eta() const
+{
+    qint64 remaining = 0;
+    for (const auto &category: m_published)
+        remaining += category.totals.bytesTotal - category.totals.bytesDone;
+
+    return estimate(remaining, rate());
+}
+
+void DownloadProgressModel::publish()
+{
+    const auto shaper = m_downloads->shaper();
+    bool changed = false;
+
+    // only whatever changed since the last frame goes out, however many chunks came in meanwhile
+    for (int row = 0; row < TransferClassCount; ++row) {
+        const auto transferClass = TransferClass(row);
+
+        CategoryProgress current;
+        current.totals = m_downloads->totals(transferClass);
+        current.rate = m_downloads->isActive() ? shaper->throughput(transferClass) : 0;
+        current.eta = estimate(current.totals.bytesTotal - current.totals.bytesDone, current.rate);
+
+        if (current == m_published[row])
+            continue;
+
+        m_published[row] = current;
+        changed = true;
+
+        emit dataChanged(index(row), index(row));
+    }
+
+    if (changed)
+        emit progressChanged();
+}
+
+} // namespace randomly
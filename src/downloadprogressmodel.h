@@ -0,0 +1,73 @@
+#ifndef DOWNLOADPROGRESSMODEL_H
+#define DOWNLOADPROGRESSMODEL_H
+
+#include "bandwidthshaper.h"
+#include "downloader.h"
+
+#include <QAbstractListModel>
+#include <QTimer>
+
+namespace randomly {
+
+struct CategoryProgress
+{
+    TransferTotals totals;
+    double rate = 0; // bytes per second
+    qint64 eta = -1; // seconds, -1 while unknown
+
+    bool operator==(const CategoryProgress &other) const;
+};
+
+// one row per transfer class. The downloader's counters are polled at a fixed rate and only rows that
+// changed are published, so the UI sees at most `progress_fps` updates per second however much is going on
+class DownloadProgressModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ active NOTIFY activeChanged)
+    Q_PROPERTY(double progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(double rate READ rate NOTIFY progressChanged)
+    Q_PROPERTY(qint64 eta READ eta NOTIFY progressChanged)
+
+public:
+    enum Roles {
+        CategoryRole = Qt::UserRole + 1,
+        BytesDoneRole,
+        BytesTotalRole,
+        FilesDoneRole,
+        FilesTotalRole,
+        FilesFailedRole,
+        RateRole,
+        EtaRole,
+        ProgressRole,
+    };
+
+    explicit DownloadProgressModel(Downloader *downloads, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = {}) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    bool active() const { return m_active; }
+
+    // everything together
+    double progress() const;
+    double rate() const;
+    qint64 eta() const;
+
+signals:
+    void activeChanged();
+    void progressChanged();
+
+private:
+    void publish();
+
+    Downloader *m_downloads;
+    QTimer m_frameTimer;
+
+    std::array<CategoryProgress, TransferClassCount> m_published;
+    bool m_active = false;
+};
+
+} // namespace randomly
+
+#endif // DOWNLOADPROGRESSMODEL_H
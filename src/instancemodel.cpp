@@ -0,0 +1,250 @@
+#include "instancemodel.h"
+
+#include "config.h"
+#include "instancestore.h"
+#include "tracelog.h"
+
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QTimeZone>
+#include <QtConcurrent>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcInstances, "randomly.MyLauncher.Instances")
+
+constexpr auto tcInstances = "randomly.MyLauncher.Instances";
+
+bool sameInstances(const QList<InstanceInfo> &lhs, const QList<InstanceInfo> &rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (qsizetype i = 0; i < lhs.size(); ++i) {
+        if (lhs[i].id != rhs[i].id || lhs[i].jsonModified != rhs[i].jsonModified || lhs[i].jsonSize != rhs[i].jsonSize)
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+InstanceModel::InstanceModel(QObject *parent)
+    : QAbstractListModel{parent}
+{
+    connect(&m_scanner, &QFutureWatcher<QList<InstanceInfo>>::finished, this, &InstanceModel::applyScan);
+
+    // show the last known state right away, the rescan will correct it if needed
+    loadIndex();
+    rescan();
+}
+
+int InstanceModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return m_instances.size();
+}
+
+QVariant InstanceModel::data(const QModelIndex &index, int role) const
+{
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid))
+        return {};
+
+    const auto &instance = m_instances.at(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case IdRole:
+        return instance.id;
+    case TypeRole:
+        return instance.type;
+    case InheritsFromRole:
+        return instance.inheritsFrom;
+    case ReleaseTimeRole:
+        return instance.releaseTime;
+    }
+
+    return {};
+}
+
+QHash<int, QByteArray> InstanceModel::roleNames() const
+{
+    return {
+        {IdRole, "name"},
+        {TypeRole, "type"},
+        {InheritsFromRole, "inheritsFrom"},
+        {ReleaseTimeRole, "releaseTime"},
+    };
+}
+
+void InstanceModel::rescan()
+{
+    // the running scan may have listed the directory before whatever asked for this happened
+    if (m_scanner.isRunning()) {
+        m_rescanPending = true;
+        return;
+    }
+
+    QHash<QString, InstanceInfo> cached;
+    for (const auto &instance: std::as_const(m_instances))
+        cached.insert(instance.id, instance);
+
+    const auto versionsRoot = Config::instance()->getConfig("mcRoot").toString() + "/versions";
+
+    m_scanner.setFuture(QtConcurrent::run(&InstanceModel::scan, versionsRoot, cached));
+    emit scanningChanged();
+}
+
+bool InstanceModel::clone(const QString &templateId, const QString &id)
+{
+    const auto result = InstanceStore::clone(templateId, id);
+    rescan();
+
+    return result.ok;
+}
+
+QList<InstanceInfo> InstanceModel::scan(const QString &versionsRoot, const QHash<QString, InstanceInfo> &cached)
+{
+    QList<InstanceInfo> unchanged;
+    QList<InstanceInfo> outdated;
+
+    // listing and stat()ing is cheap, only the JSON parsing is worth spreading over all cores
+    const auto versionDirs = QDir{versionsRoot}.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+
+    for (const auto &dir: versionDirs) {
+        const QFileInfo json{dir.absoluteFilePath() + "/" + dir.fileName() + ".json"};
+        if (!json.exists())
+            continue;
+
+        InstanceInfo info;
+        info.id = dir.fileName();
+        info.jsonModified = json.lastModified().toMSecsSinceEpoch();
+        info.jsonSize = json.size();
+
+        const auto it = cached.constFind(info.id);
+        if (it != cached.cend() && it->jsonModified == info.jsonModified && it->jsonSize == info.jsonSize)
+            unchanged.append(*it);
+        else
+            outdated.append(info);
+    }
+
+    traceDebug(tcInstances, "%1 instances unchanged, %2 to parse", unchanged.size(), outdated.size());
+
+    auto instances = unchanged + QtConcurrent::blockingMapped<QList<InstanceInfo>>(outdated, [&versionsRoot](const InstanceInfo &info) {
+        return parseVersionJson(QString("%1/%2/%2.json").arg(versionsRoot, info.id), info);
+    });
+
+    std::sort(instances.begin(), instances.end(), [](const InstanceInfo &lhs, const InstanceInfo &rhs) {
+        if (lhs.releaseTime != rhs.releaseTime)
+            return lhs.releaseTime > rhs.releaseTime;
+
+        return lhs.id < rhs.id;
+    });
+
+    return instances;
+}
+
+InstanceInfo InstanceModel::parseVersionJson(const QString &path, InstanceInfo info)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly)) {
+        qCWarning(lcInstances, "cannot open %ls: %ls", qUtf16Printable(path), qUtf16Printable(file.errorString()));
+        return info;
+    }
+
+    const auto json = QJsonDocument::fromJson(file.readAll());
+
+    info.type = json["type"].toString();
+    info.inheritsFrom = json["inheritsFrom"].toString();
+    info.releaseTime = QDateTime::fromString(json["releaseTime"].toString(), Qt::ISODate);
+
+    return info;
+}
+
+QString InstanceModel::indexPath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/instances.cbor";
+}
+
+void InstanceModel::loadIndex()
+{
+    QFile file{indexPath()};
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    const auto entries = QCborValue::fromCbor(file.readAll()).toArray();
+    m_instances.reserve(entries.size());
+
+    for (const auto &value: entries) {
+        const auto map = value.toMap();
+
+        m_instances.append({
+            map.value(QStringLiteral("id")).toString(),
+            map.value(QStringLiteral("type")).toString(),
+            map.value(QStringLiteral("inheritsFrom")).toString(),
+            QDateTime::fromMSecsSinceEpoch(map.value(QStringLiteral("releaseTime")).toInteger(), QTimeZone::UTC),
+            map.value(QStringLiteral("jsonModified")).toInteger(),
+            map.value(QStringLiteral("jsonSize")).toInteger(),
+        });
+    }
+}
+
+void InstanceModel::saveIndex() const
+{
+    QCborArray entries;
+    for (const auto &instance: m_instances) {
+        entries.append(QCborMap{
+            {QStringLiteral("id"), instance.id},
+            {QStringLiteral("type"), instance.type},
+            {QStringLiteral("inheritsFrom"), instance.inheritsFrom},
+            {QStringLiteral("releaseTime"), instance.releaseTime.toMSecsSinceEpoch()},
+            {QStringLiteral("jsonModified"), instance.jsonModified},
+            {QStringLiteral("jsonSize"), instance.jsonSize},
+        });
+    }
+
+    QDir{}.mkpath(QFileInfo{indexPath()}.absolutePath());
+
+    QSaveFile file{indexPath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcInstances, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{entries}.toCbor());
+    file.commit();
+}
+
+void InstanceModel::applyScan()
+{
+    auto scanned = m_scanner.result();
+
+    if (!sameInstances(m_instances, scanned)) {
+        beginResetModel();
+        m_instances = std::move(scanned);
+        endResetModel();
+
+        saveIndex();
+    }
+
+    emit scanningChanged();
+
+    if (m_rescanPending) {
+        m_rescanPending = false;
+        rescan();
+    }
+}
+
+} // namespace randomly
@@ -0,0 +1,72 @@
+#ifndef INSTANCEMODEL_H
+#define INSTANCEMODEL_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QFutureWatcher>
+
+namespace randomly {
+
+struct InstanceInfo
+{
+    QString id;
+    QString type;
+    QString inheritsFrom;
+    QDateTime releaseTime;
+
+    // used to decide if the cached info is still valid
+    qint64 jsonModified = 0;
+    qint64 jsonSize = 0;
+};
+
+// everything installed under mcRoot/versions. Starts with whatever the on-disk index knows,
+// then rescans in the background and only parses the JSONs that changed since last time
+class InstanceModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(bool scanning READ scanning NOTIFY scanningChanged)
+
+public:
+    enum Roles {
+        IdRole = Qt::UserRole + 1,
+        TypeRole,
+        InheritsFromRole,
+        ReleaseTimeRole,
+    };
+
+    explicit InstanceModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = {}) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    bool scanning() const { return m_scanner.isRunning(); }
+
+    Q_INVOKABLE void rescan();
+
+    // see InstanceStore::clone, the new instance shows up with the next scan
+    Q_INVOKABLE bool clone(const QString &templateId, const QString &id);
+
+    const QList<InstanceInfo> &instances() const { return m_instances; }
+
+signals:
+    void scanningChanged();
+
+private:
+    static QList<InstanceInfo> scan(const QString &versionsRoot, const QHash<QString, InstanceInfo> &cached);
+    static InstanceInfo parseVersionJson(const QString &path, InstanceInfo info);
+
+    QString indexPath() const;
+    void loadIndex();
+    void saveIndex() const;
+
+    void applyScan();
+
+    QList<InstanceInfo> m_instances;
+    QFutureWatcher<QList<InstanceInfo>> m_scanner;
+    bool m_rescanPending = false; // requested while a scan was running
+};
+
+} // namespace randomly
+
+#endif // INSTANCEMODEL_H
@@ -0,0 +1,298 @@
+#include "instancestore.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#ifdef Q_OS_UNIX
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef Q_OS_MACOS
+#include <sys/clonefile.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcInstanceStore, "randomly.MyLauncher.Instances")
+
+constexpr auto tcInstanceStore = "randomly.MyLauncher.Instances";
+
+// replaced as a whole by whoever updates them, never modified in place
+const QStringList ImmutableDirectories{"mods", "resourcepacks", "shaderpacks", "libraries"};
+
+// belong to the template's own runs
+const QStringList SkippedDirectories{"logs", "crash-reports"};
+
+QString mcRoot()
+{
+    return Config::instance()->getConfig("mcRoot").toString();
+}
+
+QString versionDirectory(const QString &id)
+{
+    return QString("%1/versions/%2").arg(mcRoot(), id);
+}
+
+QString nativesDirectory(const QString &id)
+{
+    return QString("%1/bin/%2").arg(mcRoot(), id);
+}
+
+bool writeJson(const QString &path, const QJsonObject &object)
+{
+    QSaveFile file{path};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcInstanceStore, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(file.errorString()));
+        return false;
+    }
+
+    file.write(QJsonDocument{object}.toJson());
+    return file.commit();
+}
+
+QJsonObject readJson(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+// the link as written, so a relative one keeps pointing into the clone instead of into the template
+bool copySymLink(const QString &source, const QString &target)
+{
+#ifdef Q_OS_UNIX
+    const auto sourcePath = QFile::encodeName(source);
+
+    QByteArray linkTarget(PATH_MAX, Qt::Uninitialized);
+    const auto length = ::readlink(sourcePath.constData(), linkTarget.data(), linkTarget.size());
+    if (length < 0 || length == linkTarget.size())
+        return false;
+
+    linkTarget.truncate(length);
+    return ::symlink(linkTarget.constData(), QFile::encodeName(target).constData()) == 0;
+#else
+    return QFile::link(QFileInfo{source}.symLinkTarget(), target);
+#endif
+}
+
+} // namespace
+
+QString InstanceStore::gameDirectory(const QString &id)
+{
+    const QDir root{mcRoot()};
+
+    // i.e. "" to keep sharing mcRoot like before instances had their own directories
+    const auto launcherConfig = readJson(versionDirectory(id) + "/MyLauncher.json");
+    if (const auto custom = launcherConfig["gameDirectory"]; custom.isString())
+        return QDir::cleanPath(root.absoluteFilePath(custom.toString()));
+
+    return root.absoluteFilePath("instances/" + id);
+}
+
+CloneResult InstanceStore::clone(const QString &templateId, const QString &id)
+{
+    CloneResult result;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QDir templateVersion{versionDirectory(templateId)};
+    const QDir version{versionDirectory(id)};
+
+    auto versionJson = readJson(templateVersion.filePath(templateId + ".json"));
+    if (versionJson.isEmpty()) {
+        qCWarning(lcInstanceStore, "cannot clone %ls, it isn't installed", qUtf16Printable(templateId));
+        return result;
+    }
+
+    if (version.exists()) {
+        qCWarning(lcInstanceStore, "cannot clone to %ls, it already exists", qUtf16Printable(id));
+        return result;
+    }
+
+    version.mkpath(".");
+
+    const auto count = [&result](LinkResult link, const QString &path) {
+        switch (link) {
+        case LinkResult::Hardlinked:
+            ++result.hardlinked;
+            break;
+        case LinkResult::Reflinked:
+            ++result.reflinked;
+            break;
+        case LinkResult::Copied:
+            ++result.copied;
+            result.bytesCopied += QFileInfo{path}.size();
+            break;
+        case LinkResult::Failed:
+            return false;
+        }
+
+        return true;
+    };
+
+    bool ok = true;
+
+    // an independent copy, not one inheriting from the template, so the template can go away later
+    versionJson["id"] = id;
+    ok &= writeJson(version.filePath(id + ".json"), versionJson);
+
+    // the clone gets its own game directory, even if the template shares one
+    if (auto launcherConfig = readJson(templateVersion.filePath("MyLauncher.json")); !launcherConfig.isEmpty()) {
+        launcherConfig.remove("gameDirectory");
+        ok &= writeJson(version.filePath("MyLauncher.json"), launcherConfig);
+    }
+
+    // the client jar and whatever else is named after the version
+    for (const auto &file: templateVersion.entryInfoList(QDir::Files)) {
+        if (file.fileName() == templateId + ".json" || file.fileName() == "MyLauncher.json")
+            continue;
+
+        auto name = file.fileName();
+        if (name.startsWith(templateId + '.'))
+            name.replace(0, templateId.size(), id);
+
+        const auto target = version.filePath(name);
+        ok &= count(linkFile(file.filePath(), target, true), target);
+    }
+
+    // natives and the game directory, skipping what only makes sense for the template's own runs
+    const QList<QPair<QString, QString>> trees{
+        {nativesDirectory(templateId), nativesDirectory(id)},
+        {gameDirectory(templateId), gameDirectory(id)},
+    };
+
+    for (const auto &[sourceRoot, targetRoot]: trees) {
+        const QDir source{sourceRoot};
+        const QDir target{targetRoot};
+
+        if (!source.exists())
+            continue;
+
+        // instances sharing mcRoot can't be cloned that way, we'd copy every other instance as well
+        if (QDir::cleanPath(sourceRoot) == QDir::cleanPath(QDir{mcRoot()}.absolutePath())) {
+            qCWarning(lcInstanceStore, "%ls shares mcRoot as game directory, not copying it", qUtf16Printable(templateId));
+            continue;
+        }
+
+        target.mkpath(".");
+
+        QDirIterator it{sourceRoot, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDirIterator::Subdirectories};
+        while (it.hasNext()) {
+            const auto entry = it.nextFileInfo();
+            const auto relativePath = source.relativeFilePath(entry.filePath());
+            const auto topLevel = relativePath.section('/', 0, 0);
+
+            if (SkippedDirectories.contains(topLevel))
+                continue;
+
+            const auto targetPath = target.filePath(relativePath);
+
+            if (entry.isSymLink()) {
+                if (!copySymLink(entry.filePath(), targetPath)) {
+                    qCWarning(lcInstanceStore, "cannot recreate link %ls", qUtf16Printable(targetPath));
+                    ok = false;
+                }
+            } else if (entry.isDir()) {
+                target.mkpath(relativePath);
+            } else {
+                const auto immutable = isImmutable(relativePath) || sourceRoot == nativesDirectory(templateId);
+                ok &= count(linkFile(entry.filePath(), targetPath, immutable), targetPath);
+            }
+        }
+    }
+
+    result.ok = ok;
+
+    qCInfo(lcInstanceStore, "cloned %ls to %ls in %lli ms: %i hardlinked, %i reflinked, %i copied (%lli KiB)",
+           qUtf16Printable(templateId), qUtf16Printable(id), timer.elapsed(),
+           result.hardlinked, result.reflinked, result.copied, result.bytesCopied / 1024);
+
+    return result;
+}
+
+bool InstanceStore::isImmutable(const QString &relativePath)
+{
+    return ImmutableDirectories.contains(relativePath.section('/', 0, 0));
+}
+
+InstanceStore::LinkResult InstanceStore::linkFile(const QString &source, const QString &target, bool immutable)
+{
+    QDir{}.mkpath(QFileInfo{target}.absolutePath());
+
+#ifdef Q_OS_UNIX
+    if (immutable && ::link(QFile::encodeName(source).constData(), QFile::encodeName(target).constData()) == 0)
+        return LinkResult::Hardlinked;
+#else
+    Q_UNUSED(immutable);
+#endif
+
+    if (reflink(source, target))
+        return LinkResult::Reflinked;
+
+    // i.e. across filesystems, or one that can't share extents
+    traceDebug(tcInstanceStore, "copying %1", source);
+
+    if (!QFile::copy(source, target)) {
+        qCWarning(lcInstanceStore, "cannot copy %ls to %ls", qUtf16Printable(source), qUtf16Printable(target));
+        return LinkResult::Failed;
+    }
+
+    return LinkResult::Copied;
+}
+
+bool InstanceStore::reflink(const QString &source, const QString &target)
+{
+#if defined(Q_OS_LINUX)
+    const auto sourceFd = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    if (sourceFd < 0)
+        return false;
+
+    const auto mode = QFileInfo{source}.isExecutable() ? 0755 : 0644;
+    const auto targetFd = ::open(QFile::encodeName(target).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (targetFd < 0) {
+        ::close(sourceFd);
+        return false;
+    }
+
+    // btrfs, xfs, bcachefs... share the extents until either side writes
+    const bool cloned = ::ioctl(targetFd, FICLONE, sourceFd) == 0;
+
+    ::close(targetFd);
+    ::close(sourceFd);
+
+    if (!cloned)
+        QFile::remove(target); // so the copy fallback can create it
+
+    return cloned;
+#elif defined(Q_OS_MACOS)
+    return ::clonefile(QFile::encodeName(source).constData(), QFile::encodeName(target).constData(), 0) == 0;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(target);
+    return false;
+#endif
+}
+
+} // namespace randomly
@@ -0,0 +1,39 @@
+#ifndef INSTANCESTORE_H
+#define INSTANCESTORE_H
+
+#include <QString>
+
+namespace randomly {
+
+struct CloneResult
+{
+    bool ok = false;
+    int hardlinked = 0;
+    int reflinked = 0;
+    int copied = 0;          // the filesystem can't reflink, these really take up space
+    qint64 bytesCopied = 0;
+};
+
+// where instances live on disk: versions/<id> for the version json, instances/<id> as the game directory
+class InstanceStore
+{
+public:
+    // instances/<id>, unless the instance's MyLauncher.json says otherwise ("gameDirectory", relative to mcRoot)
+    static QString gameDirectory(const QString &id);
+
+    // creates `id` as a copy of `templateId` that shares as much as possible with it. Files that are only
+    // ever replaced, never modified (mods, resource packs, ...) are hardlinked, everything else is reflinked
+    // so the copies only diverge once written. Falls back to real copies where the filesystem can't do either
+    static CloneResult clone(const QString &templateId, const QString &id);
+
+private:
+    enum class LinkResult { Hardlinked, Reflinked, Copied, Failed };
+
+    static bool isImmutable(const QString &relativePath);
+    static LinkResult linkFile(const QString &source, const QString &target, bool immutable);
+    static bool reflink(const QString &source, const QString &target);
+};
+
+} // namespace randomly
+
+#endif // INSTANCESTORE_H
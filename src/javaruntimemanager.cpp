@@ -0,0 +1,377 @@
+#include "javaruntimemanager.h"
+
+#include "config.h"
+#include "downloader.h"
+#include "tracelog.h"
+
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QSaveFile>
+#include <QSysInfo>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcRuntime, "randomly.MyLauncher.JavaRuntime")
+
+constexpr auto tcRuntime = "randomly.MyLauncher.JavaRuntime";
+
+// every runtime of every platform, pointing to one manifest per runtime
+constexpr auto RuntimeIndexUrl = "https://launchermeta.mojang.com/v1/products/java-runtime/2ec0cc96c44e5a76b9c8b7c39df7210883d12871/all.json";
+constexpr qint64 RuntimeIndexMaxAge = 24 * 60 * 60 * 1000; // ms
+
+QString sha1Of(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    sha1.addData(&file);
+
+    return QString::fromLatin1(sha1.result().toHex());
+}
+
+} // namespace
+
+JavaRuntimeManager::JavaRuntimeManager(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads}
+    , m_ctrl{new QNetworkAccessManager(this)}
+{}
+
+std::optional<QString> JavaRuntimeManager::provision(const QString &component)
+{
+    const auto manifest = currentManifest(component);
+    if (!manifest)
+        return {};
+
+    installFiles(component, (*manifest)["files"].toObject());
+
+    return javaExecutable(component);
+}
+
+std::optional<QList<DownloadInfo>> JavaRuntimeManager::missingFiles(const QString &component)
+{
+    const auto manifest = currentManifest(component);
+    if (!manifest)
+        return {};
+
+    loadState(component);
+
+    const QDir root{runtimeDirectory(component)};
+    const auto files = (*manifest)["files"].toObject();
+
+    QList<DownloadInfo> missing;
+
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        const auto file = it->toObject();
+        if (file["type"].toString() != "file")
+            continue;
+
+        if (!isInstalled(component, it.key(), file["downloads"]["raw"].toObject()))
+            missing.append(fileDownload(root.absoluteFilePath(it.key()), file));
+    }
+
+    return missing;
+}
+
+std::optional<QJsonObject> JavaRuntimeManager::currentManifest(const QString &component)
+{
+    if (component.isEmpty())
+        return {};
+
+    const auto index = runtimeIndex(component);
+    const auto releases = index[platform()][component].toArray();
+    if (releases.isEmpty()) {
+        qCWarning(lcRuntime, "there is no %ls for %ls", qUtf16Printable(component), qUtf16Printable(platform()));
+        return {};
+    }
+
+    const auto release = releases.first().toObject();
+    const auto manifest = componentManifest(component, release["manifest"].toObject());
+    if (manifest)
+        qCInfo(lcRuntime, "%ls is at %ls", qUtf16Printable(component), qUtf16Printable(release["version"]["name"].toString()));
+
+    return manifest;
+}
+
+QString JavaRuntimeManager::javaExecutable(const QString &component) const
+{
+#if defined(Q_OS_WIN)
+    return runtimeDirectory(component) + "/bin/javaw.exe";
+#elif defined(Q_OS_MACOS)
+    return runtimeDirectory(component) + "/jre.bundle/Contents/Home/bin/java";
+#else
+    return runtimeDirectory(component) + "/bin/java";
+#endif
+}
+
+QString JavaRuntimeManager::platform()
+{
+    const auto arch = QSysInfo::currentCpuArchitecture();
+
+#if defined(Q_OS_WIN)
+    if (arch == "arm64")
+        return "windows-arm64";
+    return arch == "x86_64" ? "windows-x64" : "windows-x86";
+#elif defined(Q_OS_MACOS)
+    return arch == "arm64" ? "mac-os-arm64" : "mac-os";
+#else
+    return arch == "i386" ? "linux-i386" : "linux";
+#endif
+}
+
+QString JavaRuntimeManager::runtimeDirectory(const QString &component) const
+{
+    return QString("%1/runtime/%2").arg(Config::instance()->getConfig("mcRoot").toString(), component);
+}
+
+QString JavaRuntimeManager::cachePath(const QString &name) const
+{
+    return QString("%1/cache/runtime/%2").arg(Config::instance()->getConfig("mcRoot").toString(), name);
+}
+
+QJsonObject JavaRuntimeManager::runtimeIndex(const QString &component)
+{
+    const auto path = cachePath("all.json");
+
+    QFile cached{path};
+    if (cached.open(QFile::ReadOnly)) {
+        const auto index = QJsonDocument::fromJson(cached.readAll()).object();
+        const auto age = QFileInfo{path}.lastModified().msecsTo(QDateTime::currentDateTime());
+
+        // runtimes get updated a few times a year, no need to ask every launch
+        if (age < RuntimeIndexMaxAge && index[platform()].toObject().contains(component))
+            return index;
+    }
+
+    const auto data = fetch(RuntimeIndexUrl);
+    if (!data) {
+        // better an outdated runtime than none at all
+        cached.seek(0);
+        return QJsonDocument::fromJson(cached.readAll()).object();
+    }
+
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile output{path};
+    if (output.open(QFile::WriteOnly)) {
+        output.write(*data);
+        output.commit();
+    }
+
+    return QJsonDocument::fromJson(*data).object();
+}
+
+std::optional<QJsonObject> JavaRuntimeManager::componentManifest(const QString &component, const QJsonObject &manifest)
+{
+    const auto path = cachePath(component + ".json");
+
+    if (sha1Of(path) == manifest["sha1"].toString()) {
+        QFile cached{path};
+        cached.open(QFile::ReadOnly);
+        return QJsonDocument::fromJson(cached.readAll()).object();
+    }
+
+    const auto data = fetch(manifest["url"].toString());
+    if (!data)
+        return {};
+
+    if (QCryptographicHash::hash(*data, QCryptographicHash::Sha1).toHex() != manifest["sha1"].toString().toLatin1()) {
+        qCWarning(lcRuntime, "manifest of %ls doesn't match its hash", qUtf16Printable(component));
+        return {};
+    }
+
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile output{path};
+    if (output.open(QFile::WriteOnly)) {
+        output.write(*data);
+        output.commit();
+    }
+
+    return QJsonDocument::fromJson(*data).object();
+}
+
+std::optional<QByteArray> JavaRuntimeManager::fetch(const QString &url)
+{
+    traceDebug(tcRuntime, "fetching %1", url);
+
+    auto reply = m_ctrl->get(QNetworkRequest{QUrl{url}});
+
+    QEventLoop loop;
+    connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qCWarning(lcRuntime, "cannot fetch %ls: %ls", qUtf16Printable(url), qUtf16Printable(reply->errorString()));
+        return {};
+    }
+
+    return reply->readAll();
+}
+
+void JavaRuntimeManager::installFiles(const QString &component, const QJsonObject &files)
+{
+    const QDir root{runtimeDirectory(component)};
+
+    loadState(component);
+    auto &state = m_states[component];
+
+    // whatever the new release dropped would otherwise linger around forever
+    for (const auto &path: state.keys()) {
+        if (!files.contains(path.toString())) {
+            QFile::remove(root.absoluteFilePath(path.toString()));
+            state.remove(path);
+        }
+    }
+
+    QList<DownloadInfo> missing;
+
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        const auto &path = it.key();
+        const auto file = it->toObject();
+        const auto type = file["type"].toString();
+        const auto target = root.absoluteFilePath(path);
+
+        if (type == "directory") {
+            root.mkpath(path);
+            continue;
+        }
+
+        if (type == "link") {
+            // relative to the link itself, i.e. lib/libjli.so -> ../jre/lib/libjli.so
+            const auto linkTarget = QFileInfo{target}.dir().absoluteFilePath(file["target"].toString());
+            if (QFileInfo{target}.symLinkTarget() != QFileInfo{linkTarget}.absoluteFilePath()) {
+                QFile::remove(target);
+                QFile::link(linkTarget, target);
+            }
+            continue;
+        }
+
+        if (isInstalled(component, path, file["downloads"]["raw"].toObject()))
+            continue;
+
+        missing.append(fileDownload(target, file));
+    }
+
+    qCInfo(lcRuntime) << files.size() - missing.size() << "files of" << component << "up to date," << missing.size() << "to download";
+
+    if (missing.isEmpty()) {
+        saveState(component);
+        return;
+    }
+
+    m_pendingFiles[component] += missing.size();
+
+    for (const auto &info: std::as_const(missing)) {
+        const auto path = root.relativeFilePath(info.path);
+
+        m_downloads->download(info, [this, component, path](const DownloadInfo &info, bool success) {
+            if (success)
+                markInstalled(component, path, info.sha1);
+
+            // one write for the whole runtime instead of one per file
+            if (--m_pendingFiles[component] == 0)
+                saveState(component);
+        });
+    }
+}
+
+DownloadInfo JavaRuntimeManager::fileDownload(const QString &target, const QJsonObject &file)
+{
+    const auto raw = file["downloads"]["raw"].toObject();
+
+    DownloadInfo info;
+    info.path = target;
+    info.size = raw["size"].toInteger();
+    info.sha1 = raw["sha1"].toString();
+    info.executable = file["executable"].toBool();
+    info.transferClass = TransferClass::Runtimes;
+
+    // the decoded file still has to match the raw size and hash
+    if (const auto lzma = file["downloads"]["lzma"].toObject(); !lzma.isEmpty()) {
+        info.url = lzma["url"].toString();
+        info.compression = DownloadInfo::Compression::Lzma;
+    } else {
+        info.url = raw["url"].toString();
+    }
+
+    return info;
+}
+
+void JavaRuntimeManager::loadState(const QString &component)
+{
+    auto &state = m_states[component];
+    if (!state.isEmpty())
+        return;
+
+    QFile file{cachePath(component + ".cbor")};
+    if (file.open(QFile::ReadOnly))
+        state = QCborValue::fromCbor(file.readAll()).toMap();
+}
+
+bool JavaRuntimeManager::isInstalled(const QString &component, const QString &path, const QJsonObject &raw)
+{
+    const QFileInfo file{QDir{runtimeDirectory(component)}.absoluteFilePath(path)};
+    if (!file.exists() || file.size() != raw["size"].toInteger())
+        return false;
+
+    const auto sha1 = raw["sha1"].toString();
+
+    // untouched since we installed it, no need to hash a few hundred megabytes again
+    const auto recorded = m_states[component].value(path).toMap();
+    if (recorded.value(QStringLiteral("sha1")).toString() == sha1
+        && recorded.value(QStringLiteral("size")).toInteger() == file.size()
+        && recorded.value(QStringLiteral("mtime")).toInteger() == file.lastModified().toMSecsSinceEpoch())
+        return true;
+
+    // installed by an older launcher or the state got lost
+    if (sha1Of(file.absoluteFilePath()) != sha1)
+        return false;
+
+    markInstalled(component, path, sha1);
+    return true;
+}
+
+void JavaRuntimeManager::markInstalled(const QString &component, const QString &path, const QString &sha1)
+{
+    const QFileInfo file{QDir{runtimeDirectory(component)}.absoluteFilePath(path)};
+
+    m_states[component].insert(path, QCborMap{
+        {QStringLiteral("sha1"), sha1},
+        {QStringLiteral("size"), file.size()},
+        {QStringLiteral("mtime"), file.lastModified().toMSecsSinceEpoch()},
+    });
+}
+
+void JavaRuntimeManager::saveState(const QString &component)
+{
+    const auto path = cachePath(component + ".cbor");
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile file{path};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcRuntime, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{m_states.value(component)}.toCbor());
+    file.commit();
+}
+
+} // namespace randomly
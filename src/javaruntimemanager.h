@@ -0,0 +1,59 @@
+#ifndef JAVARUNTIMEMANAGER_H
+#define JAVARUNTIMEMANAGER_H
+
+#include <QCborMap>
+#include <QJsonObject>
+#include <QObject>
+
+class QNetworkAccessManager;
+
+namespace randomly {
+
+class Downloader;
+struct DownloadInfo;
+
+// provisions the java runtimes mojang publishes, i.e. java-runtime-gamma for 1.18+ or jre-legacy for 1.16.
+// files are tracked individually, so an update only transfers what actually changed
+class JavaRuntimeManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit JavaRuntimeManager(Downloader *downloads, QObject *parent = nullptr);
+
+    // blocks for the manifests only, the files themselves are queued on the downloader.
+    // returns the java executable, or nothing if there is no such runtime for this platform
+    std::optional<QString> provision(const QString &component);
+
+    // what provision would download, without changing anything. Blocks for the manifests
+    std::optional<QList<DownloadInfo>> missingFiles(const QString &component);
+
+    QString javaExecutable(const QString &component) const;
+
+    static QString platform();
+
+private:
+    QString runtimeDirectory(const QString &component) const;
+    QString cachePath(const QString &name) const;
+
+    std::optional<QJsonObject> currentManifest(const QString &component);
+    QJsonObject runtimeIndex(const QString &component);
+    std::optional<QJsonObject> componentManifest(const QString &component, const QJsonObject &manifest);
+    std::optional<QByteArray> fetch(const QString &url);
+
+    void installFiles(const QString &component, const QJsonObject &files);
+    static DownloadInfo fileDownload(const QString &target, const QJsonObject &file);
+    void loadState(const QString &component);
+    bool isInstalled(const QString &component, const QString &path, const QJsonObject &raw);
+    void markInstalled(const QString &component, const QString &path, const QString &sha1);
+    void saveState(const QString &component);
+
+    Downloader *m_downloads;
+    QNetworkAccessManager *m_ctrl;
+
+    QHash<QString, QCborMap> m_states; // component -> relative path -> what we installed
+    QHash<QString, int> m_pendingFiles;
+};
+
+} // namespace randomly
+
+#endif // JAVARUNTIMEMANAGER_H
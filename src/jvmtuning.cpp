@@ -0,0 +1,389 @@
+#include "jvmtuning.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcJvmTuning, "randomly.MyLauncher.JvmTuning")
+
+constexpr auto tcJvmTuning = "randomly.MyLauncher.JvmTuning";
+
+constexpr qint64 MiB = 1024 * 1024;
+constexpr qint64 GiB = 1024 * MiB;
+
+QByteArray readSysFile(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    return file.readAll().trimmed();
+}
+
+#ifdef Q_OS_LINUX
+// the cgroup v2 directory of this process, empty on v1-only systems
+QString cgroupV2Directory()
+{
+    const auto lines = readSysFile("/proc/self/cgroup").split('\n');
+
+    for (const auto &line: lines) {
+        if (line.startsWith("0::"))
+            return QDir::cleanPath("/sys/fs/cgroup/" + QString::fromUtf8(line.mid(3)));
+    }
+
+    return {};
+}
+
+// limits of parent groups apply as well, so walk up to the root and take the smallest one
+template <typename Reader>
+void forEachCgroupV2Level(Reader reader)
+{
+    const QString root = "/sys/fs/cgroup";
+
+    for (auto dir = cgroupV2Directory(); dir.startsWith(root); dir = dir.left(dir.lastIndexOf('/'))) {
+        reader(dir);
+
+        if (dir == root)
+            break;
+    }
+}
+
+qint64 cgroupMemoryLimit()
+{
+    auto limit = std::numeric_limits<qint64>::max();
+
+    forEachCgroupV2Level([&limit](const QString &dir) {
+        const auto value = readSysFile(dir + "/memory.max");
+        if (!value.isEmpty() && value != "max")
+            limit = std::min(limit, value.toLongLong());
+    });
+
+    // v1 reports a huge number instead of "max" when there is no limit
+    if (const auto v1 = readSysFile("/sys/fs/cgroup/memory/memory.limit_in_bytes"); !v1.isEmpty())
+        limit = std::min(limit, v1.toLongLong());
+
+    return limit;
+}
+
+// number of CPUs the quota is worth, 0 without a quota
+int cgroupCpuQuota()
+{
+    double cpus = 0;
+
+    forEachCgroupV2Level([&cpus](const QString &dir) {
+        // "max 100000" or "<quota> <period>"
+        const auto value = readSysFile(dir + "/cpu.max").split(' ');
+        if (value.size() == 2 && value[0] != "max") {
+            const auto quota = value[0].toDouble() / value[1].toDouble();
+            cpus = cpus == 0 ? quota : std::min(cpus, quota);
+        }
+    });
+
+    if (const auto quota = readSysFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us").toLongLong(); quota > 0) {
+        const auto period = readSysFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us").toDouble();
+        if (period > 0)
+            cpus = cpus == 0 ? quota / period : std::min(cpus, quota / period);
+    }
+
+    return cpus == 0 ? 0 : std::max(1, int(std::ceil(cpus)));
+}
+
+qint64 physicalMemory()
+{
+    // "MemTotal:       16318164 kB"
+    const auto lines = readSysFile("/proc/meminfo").split('\n');
+
+    for (const auto &line: lines) {
+        if (line.startsWith("MemTotal:"))
+            return line.mid(9).trimmed().split(' ').first().toLongLong() * 1024;
+    }
+
+    return 0;
+}
+#endif
+
+} // namespace
+
+QStringList JvmProfile::toArguments(int javaMajor) const
+{
+    QStringList arguments;
+
+    if (minHeap > 0)
+        arguments += QString("-Xms%1m").arg(minHeap / MiB);
+
+    if (maxHeap > 0)
+        arguments += QString("-Xmx%1m").arg(maxHeap / MiB);
+
+    switch (gc) {
+    case G1:
+        arguments += "-XX:+UseG1GC";
+        break;
+
+    case ZGC:
+        arguments += "-XX:+UseZGC";
+
+        // generational ZGC is opt-in on 21 and 22, the default afterwards
+        if (javaMajor == 21 || javaMajor == 22)
+            arguments += "-XX:+ZGenerational";
+        break;
+    }
+
+    if (parallelGcThreads > 0)
+        arguments += QString("-XX:ParallelGCThreads=%1").arg(parallelGcThreads);
+
+    if (concGcThreads > 0)
+        arguments += QString("-XX:ConcGCThreads=%1").arg(concGcThreads);
+
+    // 8 before 8u191 (i.e. Mojang's jre-legacy) refuses to start with it. We only know the major version, and
+    // an unknown one (0) may be just that
+    if (activeProcessorCount > 0 && javaMajor >= 10)
+        arguments += QString("-XX:ActiveProcessorCount=%1").arg(activeProcessorCount);
+
+#ifdef Q_OS_LINUX
+    if (largePages)
+        arguments += "-XX:+UseTransparentHugePages";
+#endif
+
+    return arguments + extraArguments;
+}
+
+HostResources JvmTuning::detectHost()
+{
+    HostResources host;
+    host.cpus = QThread::idealThreadCount();
+
+#ifdef Q_OS_LINUX
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+        host.cpus = CPU_COUNT(&affinity);
+
+    if (const auto quota = cgroupCpuQuota(); quota > 0)
+        host.cpus = std::min(host.cpus, quota);
+
+    host.memory = std::min(physicalMemory(), cgroupMemoryLimit());
+
+    // "always [madvise] never", anything but never lets the JVM madvise its heap
+    const auto thp = readSysFile("/sys/kernel/mm/transparent_hugepage/enabled");
+    host.transparentHugePages = !thp.isEmpty() && !thp.contains("[never]");
+#endif
+
+    traceInfo(tcJvmTuning, "host: %1 cpus, %2 MiB, thp %3", host.cpus, host.memory / MiB, host.transparentHugePages);
+
+    return host;
+}
+
+int JvmTuning::detectJavaMajor(const QString &javaExecutable)
+{
+    const QFileInfo executable{javaExecutable};
+    const auto modified = executable.lastModified().toMSecsSinceEpoch();
+
+    auto cfg = Config::instance();
+    const auto cacheKey = "java_major/" + QString::fromLatin1(QCryptographicHash::hash(executable.absoluteFilePath().toUtf8(), QCryptographicHash::Md5).toHex());
+
+    // "<mtime>:<major>"
+    if (const auto cached = cfg->getConfig(cacheKey).toString().split(':'); cached.size() == 2 && cached[0].toLongLong() == modified)
+        return cached[1].toInt();
+
+    QProcess java;
+    java.start(javaExecutable, {"-version"});
+
+    if (!java.waitForFinished(10'000)) {
+        qCWarning(lcJvmTuning, "cannot run %ls -version", qUtf16Printable(javaExecutable));
+        return 0;
+    }
+
+    // `openjdk version "17.0.8" 2023-07-18` or `java version "1.8.0_292"`, always on stderr
+    static const QRegularExpression versionPattern{R"(version "(\d+)(?:\.(\d+))?)"};
+    const auto match = versionPattern.match(QString::fromLocal8Bit(java.readAllStandardError()));
+    if (!match.hasMatch())
+        return 0;
+
+    auto major = match.captured(1).toInt();
+    if (major == 1)
+        major = match.captured(2).toInt();
+
+    cfg->setConfig(cacheKey, QString("%1:%2").arg(modified).arg(major));
+
+    return major;
+}
+
+JvmProfile JvmTuning::profileFor(JvmProfile::Role role, const HostResources &host, int javaMajor)
+{
+    JvmProfile profile;
+    profile.role = role;
+
+    const auto memory = host.memory > 0 ? host.memory : 8 * GiB; // no idea, assume something common
+
+    if (role == JvmProfile::Server) {
+        // several servers share a host, so each one gets a budget instead of the whole machine: "server_memory"
+        // (i.e. "6G"), a quarter of the host otherwise. A fifth of it (at least 512 MiB) is left for everything the
+        // JVM allocates off-heap. Servers allocate the whole heap up front, resizing it only costs pauses
+        const auto configured = Config::instance()->getConfig("server_memory").toString();
+        auto budget = configured.isEmpty() ? memory / 4 : parseSize(configured);
+        if (budget <= 0)
+            budget = memory / 4;
+
+        budget = std::clamp(budget, std::min(2 * GiB, memory), memory);
+
+        profile.maxHeap = std::max(512 * MiB, budget - std::max(512 * MiB, budget / 5));
+        profile.minHeap = profile.maxHeap;
+    } else {
+        // more than 8 GiB doesn't help the client, it just makes full collections longer
+        profile.maxHeap = std::clamp(memory / 4, std::min(2 * GiB, memory / 2), 8 * GiB);
+        profile.minHeap = std::min(profile.maxHeap, 512 * MiB);
+    }
+
+    if (javaMajor >= 21 && role == JvmProfile::Server && profile.maxHeap >= 8 * GiB)
+        profile.gc = JvmProfile::ZGC;
+    else if (javaMajor >= 17 && profile.maxHeap >= 16 * GiB)
+        profile.gc = JvmProfile::ZGC;
+
+    // same formula HotSpot uses, but based on what we may use instead of what the machine has
+    const auto cpus = std::max(1, host.cpus);
+    auto gcThreads = cpus <= 8 ? cpus : 8 + (cpus - 8) * 5 / 8;
+
+    // the client's render and server threads need the cores more than the collector
+    if (role == JvmProfile::Client)
+        gcThreads = std::clamp(cpus / 2, 1, gcThreads);
+
+    profile.parallelGcThreads = gcThreads;
+    profile.concGcThreads = std::max(1, (gcThreads + 3) / 4);
+
+    if (cpus < int(std::thread::hardware_concurrency()))
+        profile.activeProcessorCount = cpus;
+
+    profile.largePages = host.transparentHugePages && profile.maxHeap >= 4 * GiB;
+
+    // touches the whole heap at startup: no page faults later, but it's resident right away. Only on request
+    if (role == JvmProfile::Server && Config::instance()->getConfig("jvm_pretouch").toBool())
+        profile.extraArguments << "-XX:+AlwaysPreTouch";
+
+    if (profile.gc == JvmProfile::G1) {
+        if (role == JvmProfile::Server)
+            profile.extraArguments << "-XX:+ParallelRefProcEnabled" << "-XX:+DisableExplicitGC" << "-XX:MaxGCPauseMillis=200";
+        else
+            profile.extraArguments << "-XX:+ParallelRefProcEnabled" << "-XX:MaxGCPauseMillis=50";
+    }
+
+    return profile;
+}
+
+void JvmTuning::applyOverrides(JvmProfile &profile, const QJsonObject &overrides)
+{
+    if (overrides.contains("minHeap"))
+        profile.minHeap = parseSize(overrides["minHeap"].toVariant().toString());
+
+    if (overrides.contains("maxHeap"))
+        profile.maxHeap = parseSize(overrides["maxHeap"].toVariant().toString());
+
+    if (overrides.contains("gc"))
+        profile.gc = overrides["gc"].toString().compare("zgc", Qt::CaseInsensitive) == 0 ? JvmProfile::ZGC : JvmProfile::G1;
+
+    if (overrides.contains("parallelGcThreads"))
+        profile.parallelGcThreads = overrides["parallelGcThreads"].toInt();
+
+    if (overrides.contains("concGcThreads"))
+        profile.concGcThreads = overrides["concGcThreads"].toInt();
+
+    if (overrides.contains("activeProcessorCount"))
+        profile.activeProcessorCount = overrides["activeProcessorCount"].toInt();
+
+    if (overrides.contains("largePages"))
+        profile.largePages = overrides["largePages"].toBool();
+
+    const auto arguments = overrides["arguments"].toArray();
+    for (const auto &argument: arguments)
+        profile.extraArguments += argument.toString();
+
+    profile.minHeap = std::min(profile.minHeap, profile.maxHeap);
+}
+
+QStringList JvmTuning::scaleToCpus(const QStringList &arguments, int cpus)
+{
+    static const QRegularExpression threadFlag{R"(^-XX:(ParallelGCThreads|ConcGCThreads|ActiveProcessorCount)=(\d+)$)"};
+
+    if (cpus <= 0)
+        return arguments;
+
+    // what the counts were tuned for
+    int tunedFor = 0;
+    for (const auto &argument: arguments) {
+        if (const auto match = threadFlag.match(argument); match.hasMatch() && match.captured(1) == "ActiveProcessorCount")
+            tunedFor = match.captured(2).toInt();
+    }
+
+    if (tunedFor <= 0)
+        tunedFor = detectHost().cpus;
+
+    QStringList scaled;
+    scaled.reserve(arguments.size());
+
+    for (const auto &argument: arguments) {
+        const auto match = threadFlag.match(argument);
+        if (!match.hasMatch()) {
+            scaled.append(argument);
+            continue;
+        }
+
+        const auto flag = match.captured(1);
+        const auto count = flag == "ActiveProcessorCount" ? cpus : std::clamp(int(std::lround(match.captured(2).toDouble() * cpus / tunedFor)), 1, cpus);
+
+        scaled.append(QString("-XX:%1=%2").arg(flag).arg(count));
+    }
+
+    return scaled;
+}
+
+JvmProfile::Role JvmTuning::roleFromString(const QString &role)
+{
+    return role.compare("server", Qt::CaseInsensitive) == 0 ? JvmProfile::Server : JvmProfile::Client;
+}
+
+qint64 JvmTuning::parseSize(const QString &size)
+{
+    // same suffixes as -Xmx: 512m, 4G, ...
+    static const QRegularExpression sizePattern{R"(^\s*(\d+)\s*([kKmMgG]?)\s*$)"};
+
+    const auto match = sizePattern.match(size);
+    if (!match.hasMatch()) {
+        qCWarning(lcJvmTuning, "invalid size %ls", qUtf16Printable(size));
+        return 0;
+    }
+
+    const auto value = match.captured(1).toLongLong();
+
+    const auto suffix = match.captured(2).toLower();
+
+    if (suffix == "k")
+        return value * 1024;
+    if (suffix == "m")
+        return value * MiB;
+    if (suffix == "g")
+        return value * GiB;
+
+    return value;
+}
+
+} // namespace randomly
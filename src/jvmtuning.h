@@ -0,0 +1,67 @@
+#ifndef JVMTUNING_H
+#define JVMTUNING_H
+
+#include <QJsonObject>
+#include <QStringList>
+
+namespace randomly {
+
+// what the JVM is actually allowed to use, cgroup limits and CPU affinity included
+struct HostResources
+{
+    int cpus = 1;
+    qint64 memory = 0; // bytes
+    bool transparentHugePages = false;
+};
+
+struct JvmProfile
+{
+    enum Role {
+        Client,
+        Server,
+    };
+
+    enum GarbageCollector {
+        G1,
+        ZGC,
+    };
+
+    Role role = Client;
+    qint64 minHeap = 0; // bytes
+    qint64 maxHeap = 0;
+    GarbageCollector gc = G1;
+    int parallelGcThreads = 0;
+    int concGcThreads = 0;
+    int activeProcessorCount = 0; // 0: let the JVM figure it out
+    bool largePages = false;
+    QStringList extraArguments;
+
+    QStringList toArguments(int javaMajor) const;
+};
+
+class JvmTuning
+{
+public:
+    static HostResources detectHost();
+
+    // runs `java -version` once per executable, the result is cached in Config by mtime
+    static int detectJavaMajor(const QString &javaExecutable);
+
+    static JvmProfile profileFor(JvmProfile::Role role, const HostResources &host, int javaMajor);
+
+    // per instance overrides, i.e. the "jvm" object from versions/<id>/MyLauncher.json
+    static void applyOverrides(JvmProfile &profile, const QJsonObject &overrides);
+
+    static JvmProfile::Role roleFromString(const QString &role);
+
+    // the tuned thread counts were for everything the host has, this scales them to the cpus an instance got pinned to.
+    // Arguments without tuned thread counts are left alone, the JVM respects its affinity anyway
+    static QStringList scaleToCpus(const QStringList &arguments, int cpus);
+
+private:
+    static qint64 parseSize(const QString &size);
+};
+
+} // namespace randomly
+
+#endif // JVMTUNING_H
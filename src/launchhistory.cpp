@@ -0,0 +1,308 @@
+#include "launchhistory.h"
+
+#include "config.h"
+#include "downloader.h"
+#include "processsupervisor.h"
+#include "tracelog.h"
+
+#include <QCborMap>
+#include <QCborStreamReader>
+#include <QCborValue>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcHistory, "randomly.MyLauncher.History")
+
+constexpr auto tcHistory = "randomly.MyLauncher.History";
+
+// a few hundred bytes per launch, the older half goes once the file gets this big
+constexpr qint64 MaxHistorySize = 4 * 1024 * 1024;
+
+// launches vary a lot, fewer than this on either side says nothing
+constexpr int MinLaunches = 3;
+constexpr double RegressionThreshold = 0.1; // of the median
+
+struct Metric
+{
+    const char *name;
+    const char *unit;
+    double floor; // smaller changes are noise, whatever the percentage
+    double (*value)(const LaunchRecord &record); // negative if the launch has no value for it
+};
+
+const Metric Metrics[] = {
+    {"auth", "ms", 100, [](const LaunchRecord &r) { return double(r.auth); }},
+    {"resolve", "ms", 50, [](const LaunchRecord &r) { return double(r.resolve); }},
+    {"download", "ms", 250, [](const LaunchRecord &r) { return double(r.download); }},
+    {"spawn", "ms", 50, [](const LaunchRecord &r) { return double(r.spawn); }},
+    {"firstWindow", "ms", 250, [](const LaunchRecord &r) { return double(r.firstWindow); }},
+    {"total", "ms", 250, [](const LaunchRecord &r) {
+         return r.firstWindow < 0 ? -1.0 : double(r.auth + r.resolve + r.download + r.spawn + r.firstWindow);
+     }},
+    {"peakRss", "MiB", 64, [](const LaunchRecord &r) { return r.peakRss > 0 ? double(r.peakRss >> 20) : -1.0; }},
+    {"cacheHitRate", "%", -1, [](const LaunchRecord &r) { return r.filesTotal > 0 ? 100.0 * r.filesCached / r.filesTotal : -1.0; }},
+};
+
+QCborMap toCbor(const LaunchRecord &record)
+{
+    return {
+        {"time", record.time.toMSecsSinceEpoch()},
+        {"launcherVersion", record.launcherVersion},
+        {"version", record.version},
+        {"java", record.java},
+        {"auth", record.auth},
+        {"resolve", record.resolve},
+        {"download", record.download},
+        {"spawn", record.spawn},
+        {"firstWindow", record.firstWindow},
+        {"bytesDownloaded", record.bytesDownloaded},
+        {"bytesFromPeers", record.bytesFromPeers},
+        {"filesCached", record.filesCached},
+        {"filesTotal", record.filesTotal},
+        {"peakRss", record.peakRss},
+        {"exitCode", record.exitCode},
+    };
+}
+
+LaunchRecord fromCbor(const QCborMap &map)
+{
+    LaunchRecord record;
+    record.time = QDateTime::fromMSecsSinceEpoch(map.value("time").toInteger());
+    record.launcherVersion = map.value("launcherVersion").toString();
+    record.version = map.value("version").toString();
+    record.java = map.value("java").toString();
+    record.auth = map.value("auth").toInteger();
+    record.resolve = map.value("resolve").toInteger();
+    record.download = map.value("download").toInteger();
+    record.spawn = map.value("spawn").toInteger();
+    record.firstWindow = map.value("firstWindow").toInteger(-1);
+    record.bytesDownloaded = map.value("bytesDownloaded").toInteger();
+    record.bytesFromPeers = map.value("bytesFromPeers").toInteger();
+    record.filesCached = map.value("filesCached").toInteger();
+    record.filesTotal = map.value("filesTotal").toInteger();
+    record.peakRss = map.value("peakRss").toInteger();
+    record.exitCode = map.value("exitCode").toInteger();
+
+    return record;
+}
+
+// nearest rank, values have to be sorted
+double percentile(const QList<double> &values, double p)
+{
+    if (values.isEmpty())
+        return 0;
+
+    const auto rank = qsizetype(std::ceil(p * values.size())) - 1;
+    return values[std::clamp(rank, qsizetype(0), values.size() - 1)];
+}
+
+QList<double> sortedValues(const QList<LaunchRecord> &records, const Metric &metric)
+{
+    QList<double> values;
+    for (const auto &record: records) {
+        if (const auto value = metric.value(record); value >= 0)
+            values.append(value);
+    }
+
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+// how much of data is complete records. A crash while appending leaves a truncated one behind
+qint64 completeLength(const QByteArray &data)
+{
+    QCborStreamReader reader{data};
+    qint64 length = 0;
+
+    while (reader.isValid()) {
+        QCborValue::fromCbor(reader);
+        if (reader.lastError() != QCborError::NoError)
+            break;
+
+        length = reader.currentOffset();
+    }
+
+    return length;
+}
+
+} // namespace
+
+QString LaunchHistory::launcherVersion()
+{
+    return QStringLiteral(QT_STRINGIFY(LAUNCHER_VERSION));
+}
+
+QString LaunchHistory::javaIdentity(const QString &javaExecutable)
+{
+    const QFileInfo java{javaExecutable};
+    return QString("%1 %2").arg(java.canonicalFilePath(), java.lastModified().toUTC().toString(Qt::ISODate));
+}
+
+void LaunchHistory::append(const LaunchRecord &record)
+{
+    const auto path = historyPath();
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    // keeps the newer half, rarely enough that reading everything doesn't matter
+    if (QFileInfo{path}.size() > MaxHistorySize) {
+        const auto records = load();
+
+        QSaveFile trimmed{path};
+        if (trimmed.open(QFile::WriteOnly)) {
+            for (auto i = records.size() / 2; i < records.size(); ++i)
+                trimmed.write(QCborValue{toCbor(records[i])}.toCbor());
+
+            trimmed.commit();
+        }
+    }
+
+    // anything appended after a truncated record could never be read again
+    if (QFile existing{path}; existing.open(QFile::ReadOnly)) {
+        const auto data = existing.readAll();
+        existing.close();
+
+        if (const auto length = completeLength(data); length < data.size()) {
+            qCWarning(lcHistory, "dropping a truncated record from %ls", qUtf16Printable(path));
+            QFile::resize(path, length);
+        }
+    }
+
+    // each record is a complete CBOR item, so appending never has to rewrite what's there
+    QFile file{path};
+    if (!file.open(QFile::WriteOnly | QFile::Append)) {
+        qCWarning(lcHistory, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{toCbor(record)}.toCbor());
+
+    traceInfo(tcHistory, "recorded launch of %1: %2 ms to the first window", record.version, record.firstWindow);
+}
+
+void LaunchHistory::recordOnExit(GameInstance *game, const LaunchRecord &record)
+{
+    QObject::connect(game, &GameInstance::finished, game, [game, record](int exitCode) mutable {
+        const auto stats = game->stats();
+
+        record.firstWindow = stats.firstWindow;
+        record.peakRss = stats.peakRss;
+        record.exitCode = exitCode;
+
+        append(record);
+    });
+}
+
+LaunchMeter::LaunchMeter(const QString &version, const QStringList &launchFiles, const Downloader *downloads)
+    : m_downloads{downloads}
+    , m_bytesBefore{downloads->bytesTransferred()}
+    , m_fromPeersBefore{downloads->bytesFromPeers()}
+{
+    m_record.time = QDateTime::currentDateTime();
+    m_record.launcherVersion = LaunchHistory::launcherVersion();
+    m_record.version = version;
+
+    m_record.filesTotal = launchFiles.size();
+    for (const auto &file: launchFiles)
+        m_record.filesCached += QFileInfo::exists(file);
+
+    m_phase.start();
+}
+
+void LaunchMeter::authenticated()
+{
+    m_record.auth = m_phase.restart();
+}
+
+void LaunchMeter::resolved()
+{
+    m_record.resolve = m_phase.restart();
+}
+
+void LaunchMeter::downloaded(const QString &javaExecutable)
+{
+    m_record.download = m_phase.restart();
+    m_record.bytesDownloaded = m_downloads->bytesTransferred() - m_bytesBefore;
+    m_record.bytesFromPeers = m_downloads->bytesFromPeers() - m_fromPeersBefore;
+    m_record.java = LaunchHistory::javaIdentity(javaExecutable);
+}
+
+void LaunchMeter::recordOnExit(GameInstance *game)
+{
+    QObject::connect(game, &GameInstance::started, game, [game, record = m_record, phase = m_phase]() mutable {
+        record.spawn = phase.elapsed();
+        LaunchHistory::recordOnExit(game, record);
+    });
+}
+
+QList<LaunchRecord> LaunchHistory::load(const QStringList &versions)
+{
+    QFile file{historyPath()};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    QList<LaunchRecord> records;
+
+    // a crash while appending leaves a truncated last record, everything before it is fine
+    QCborStreamReader reader{file.readAll()};
+    while (reader.isValid()) {
+        const auto value = QCborValue::fromCbor(reader);
+        if (reader.lastError() != QCborError::NoError)
+            break;
+
+        auto record = fromCbor(value.toMap());
+        if (versions.isEmpty() || versions.contains(record.version))
+            records.append(std::move(record));
+    }
+
+    return records;
+}
+
+QList<MetricChange> LaunchHistory::compare(const QList<LaunchRecord> &before, const QList<LaunchRecord> &after)
+{
+    QList<MetricChange> changes;
+
+    for (const auto &metric: Metrics) {
+        const auto beforeValues = sortedValues(before, metric);
+        const auto afterValues = sortedValues(after, metric);
+
+        if (beforeValues.isEmpty() || afterValues.isEmpty())
+            continue;
+
+        MetricChange change;
+        change.metric = metric.name;
+        change.unit = metric.unit;
+        change.before = percentile(beforeValues, 0.5);
+        change.after = percentile(afterValues, 0.5);
+        change.beforeP90 = percentile(beforeValues, 0.9);
+        change.afterP90 = percentile(afterValues, 0.9);
+
+        // higher is worse for everything but the hit rate, which has no floor
+        if (beforeValues.size() >= MinLaunches && afterValues.size() >= MinLaunches) {
+            if (metric.floor >= 0)
+                change.regressed = change.after > change.before * (1 + RegressionThreshold) && change.after - change.before > metric.floor;
+            else
+                change.regressed = change.after < change.before * (1 - RegressionThreshold);
+        }
+
+        changes.append(change);
+    }
+
+    return changes;
+}
+
+QString LaunchHistory::historyPath()
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/launches.cbor";
+}
+
+} // namespace randomly
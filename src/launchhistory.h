@@ -0,0 +1,97 @@
+#ifndef LAUNCHHISTORY_H
+#define LAUNCHHISTORY_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QStringList>
+
+namespace randomly {
+
+class Downloader;
+class GameInstance;
+
+struct LaunchRecord
+{
+    QDateTime time;
+    QString launcherVersion;
+    QString version;
+    QString java; // executable and its mtime, so a java update shows up even if the path stays the same
+
+    // phases, ms
+    qint64 auth = 0;
+    qint64 resolve = 0;  // version json, command line, scheduling what's missing
+    qint64 download = 0; // waiting for what's missing
+    qint64 spawn = 0;    // until the process runs
+    qint64 firstWindow = -1; // from spawn until the game logged its window, -1 if it never did
+
+    qint64 bytesDownloaded = 0;
+    qint64 bytesFromPeers = 0;
+    int filesCached = 0; // launch files that were on disk already
+    int filesTotal = 0;
+
+    qint64 peakRss = 0;
+    int exitCode = 0;
+};
+
+struct MetricChange
+{
+    QString metric;
+    QString unit;
+    double before = 0; // medians
+    double after = 0;
+    double beforeP90 = 0;
+    double afterP90 = 0;
+    bool regressed = false;
+};
+
+// one record per launch, appended to cache/launches.cbor. Meant to answer whether a launcher update, a java update or
+// a modpack change made launches slower
+class LaunchHistory
+{
+public:
+    static QString launcherVersion();
+    static QString javaIdentity(const QString &javaExecutable);
+
+    static void append(const LaunchRecord &record);
+
+    // fills in what the game reports (time to first window, peak rss, exit code) and appends the record once it exits
+    static void recordOnExit(GameInstance *game, const LaunchRecord &record);
+
+    // oldest first. All versions if versions is empty
+    static QList<LaunchRecord> load(const QStringList &versions = {});
+
+    // medians and 90th percentiles of each metric. Only flags a regression with enough launches on both sides
+    static QList<MetricChange> compare(const QList<LaunchRecord> &before, const QList<LaunchRecord> &after);
+
+private:
+    static QString historyPath();
+};
+
+// measures a launch phase by phase, so GUI and headless launches record the same things
+class LaunchMeter
+{
+public:
+    // counts which launch files are on disk already and starts the clock
+    LaunchMeter(const QString &version, const QStringList &launchFiles, const Downloader *downloads);
+
+    // each ends a phase
+    void authenticated();
+    void resolved();
+    void downloaded(const QString &javaExecutable); // also takes what was transferred since the meter started
+
+    // the spawn phase ends once the game runs, the rest comes from the game itself. Launches that never
+    // started aren't recorded
+    void recordOnExit(GameInstance *game);
+
+private:
+    LaunchRecord m_record;
+    QElapsedTimer m_phase;
+
+    const Downloader *m_downloads;
+    qint64 m_bytesBefore = 0;
+    qint64 m_fromPeersBefore = 0;
+};
+
+} // namespace randomly
+
+#endif // LAUNCHHISTORY_H
@@ -0,0 +1,760 @@
+#include "loaderinstaller.h"
+
+#include "config.h"
+#include "downloader.h"
+#include "javaruntimemanager.h"
+#include "tracelog.h"
+#include "versioncatalogue.h"
+
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QThread>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <functional>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcLoader, "randomly.MyLauncher.Loader")
+
+constexpr auto tcLoader = "randomly.MyLauncher.Loader";
+
+constexpr auto FabricProfileUrl = "https://meta.fabricmc.net/v2/versions/loader/%1/%2/profile/json";
+constexpr auto QuiltProfileUrl = "https://meta.quiltmc.org/v3/versions/loader/%1/%2/profile/json";
+constexpr auto ForgeMaven = "https://maven.minecraftforge.net/";
+constexpr auto NeoForgeMaven = "https://maven.neoforged.net/releases/";
+
+QString sha1Of(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    sha1.addData(&file);
+
+    return QString::fromLatin1(sha1.result().toHex());
+}
+
+QByteArray readData(archive *jar)
+{
+    QByteArray data;
+
+    const void *buffer;
+    size_t size;
+    la_int64_t offset;
+
+    while (archive_read_data_block(jar, &buffer, &size, &offset) == ARCHIVE_OK)
+        data.append(static_cast<const char *>(buffer), size);
+
+    return data;
+}
+
+archive *openJar(const QString &path)
+{
+    // seekable: entries we don't want are skipped via the central directory instead of being read
+    archive *jar = archive_read_new();
+    archive_read_support_format_zip_seekable(jar);
+
+    if (archive_read_open_filename(jar, QFile::encodeName(path).constData(), 64 * 1024) != ARCHIVE_OK) {
+        qCWarning(lcLoader, "cannot open %ls: %s", qUtf16Printable(path), archive_error_string(jar));
+        archive_read_free(jar);
+        return nullptr;
+    }
+
+    return jar;
+}
+
+QString mainClassOf(const QString &jarPath)
+{
+    auto jar = openJar(jarPath);
+    if (!jar)
+        return {};
+
+    QString mainClass;
+
+    archive_entry *entry;
+    while (archive_read_next_header(jar, &entry) == ARCHIVE_OK) {
+        if (qstrcmp(archive_entry_pathname(entry), "META-INF/MANIFEST.MF") != 0)
+            continue;
+
+        static const QRegularExpression mainClassLine{"^Main-Class:\\s*(\\S+)", QRegularExpression::MultilineOption};
+        mainClass = mainClassLine.match(QString::fromUtf8(readData(jar))).captured(1);
+        break;
+    }
+
+    archive_read_free(jar);
+    return mainClass;
+}
+
+bool isSafeRelativePath(const QString &path)
+{
+    const auto cleaned = QDir::cleanPath(path);
+    return !cleaned.isEmpty() && !QDir::isAbsolutePath(cleaned) && !cleaned.startsWith("..");
+}
+
+} // namespace
+
+LoaderInstaller::LoaderInstaller(QObject *parent)
+    : LoaderInstaller{nullptr, parent}
+{}
+
+LoaderInstaller::LoaderInstaller(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads ? downloads : new Downloader(this)}
+    , m_ctrl{new QNetworkAccessManager(this)}
+{}
+
+std::optional<LoaderVersion> LoaderInstaller::parse(const QString &versionId)
+{
+    static const QRegularExpression fabricLike{"^(fabric|quilt)-loader-([^-]+)-(.+)$"};
+    static const QRegularExpression forge{"^(.+)-forge-(.+)$"};
+    static const QRegularExpression neoForge{"^neoforge-((\\d+)\\.(\\d+)\\..+)$"};
+
+    if (const auto match = fabricLike.match(versionId); match.hasMatch()) {
+        const auto kind = match.captured(1) == "fabric" ? LoaderVersion::Kind::Fabric : LoaderVersion::Kind::Quilt;
+        return LoaderVersion{kind, match.captured(3), match.captured(2)};
+    }
+
+    if (const auto match = forge.match(versionId); match.hasMatch())
+        return LoaderVersion{LoaderVersion::Kind::Forge, match.captured(1), match.captured(2)};
+
+    // 20.4.237 is for 1.20.4, 21.0.x for 1.21
+    if (const auto match = neoForge.match(versionId); match.hasMatch()) {
+        const auto minor = match.captured(3);
+        const auto minecraft = minor == "0" ? QString("1.%1").arg(match.captured(2)) : QString("1.%1.%2").arg(match.captured(2), minor);
+        return LoaderVersion{LoaderVersion::Kind::NeoForge, minecraft, match.captured(1)};
+    }
+
+    return {};
+}
+
+QString LoaderInstaller::mavenPath(const QString &coordinate)
+{
+    const auto at = coordinate.indexOf('@');
+    const auto extension = at < 0 ? QString("jar") : coordinate.mid(at + 1);
+    const auto parts = coordinate.left(at).split(':');
+
+    if (parts.size() < 3)
+        return {};
+
+    auto group = parts[0];
+    group.replace('.', '/');
+
+    const auto classifier = parts.size() > 3 ? "-" + parts[3] : QString();
+
+    return QString("%1/%2/%3/%2-%3%4.%5").arg(group, parts[1], parts[2], classifier, extension);
+}
+
+bool LoaderInstaller::install(const QString &versionId)
+{
+    const auto version = parse(versionId);
+    if (!version) {
+        qCWarning(lcLoader, "%ls is not a loader version", qUtf16Printable(versionId));
+        return false;
+    }
+
+    qCInfo(lcLoader, "installing %ls", qUtf16Printable(versionId));
+
+    switch (version->kind) {
+    case LoaderVersion::Kind::Fabric:
+    case LoaderVersion::Kind::Quilt:
+        return installFabricLike(*version);
+    case LoaderVersion::Kind::Forge:
+    case LoaderVersion::Kind::NeoForge:
+        return installForge(*version);
+    }
+
+    return false;
+}
+
+bool LoaderInstaller::installFabricLike(const LoaderVersion &version)
+{
+    const auto url = QString(version.kind == LoaderVersion::Kind::Fabric ? FabricProfileUrl : QuiltProfileUrl).arg(version.minecraft, version.loader);
+
+    const auto data = fetchAll({url}).first();
+    if (!data)
+        return false;
+
+    auto profile = QJsonDocument::fromJson(*data).object();
+    if (profile["id"].toString().isEmpty()) {
+        qCWarning(lcLoader, "no loader %ls for %ls", qUtf16Printable(version.loader), qUtf16Printable(version.minecraft));
+        return false;
+    }
+
+    // only coordinates and a repository, the hashes are in the .sha1 files next to the artifacts. All of them are
+    // requested at once, so they can be verified when the libraries are downloaded
+    auto libraries = profile["libraries"].toArray();
+
+    QStringList sidecars;
+    QList<qsizetype> unhashed;
+
+    for (qsizetype i = 0; i < libraries.size(); ++i) {
+        const auto library = libraries[i].toObject();
+        if (library.contains("downloads") || !library["sha1"].toString().isEmpty())
+            continue;
+
+        auto repository = library["url"].toString();
+        if (!repository.endsWith('/'))
+            repository += '/';
+
+        sidecars.append(repository + mavenPath(library["name"].toString()) + ".sha1");
+        unhashed.append(i);
+    }
+
+    const auto hashes = fetchAll(sidecars);
+
+    for (qsizetype i = 0; i < hashes.size(); ++i) {
+        if (!hashes[i])
+            continue;
+
+        auto library = libraries[unhashed[i]].toObject();
+        library["sha1"] = QString::fromLatin1(hashes[i]->trimmed().left(40));
+        libraries[unhashed[i]] = library;
+    }
+
+    profile["libraries"] = libraries;
+
+    return writeVersionJson(profile);
+}
+
+bool LoaderInstaller::installForge(const LoaderVersion &version)
+{
+    const auto mcRoot = Config::instance()->getConfig("mcRoot").toString();
+    const bool neoForge = version.kind == LoaderVersion::Kind::NeoForge;
+
+    const auto coordinate = neoForge ? QString("net.neoforged:neoforge:%1:installer").arg(version.loader)
+                                     : QString("net.minecraftforge:forge:%1-%2:installer").arg(version.minecraft, version.loader);
+
+    DownloadInfo installer;
+    installer.path = libraryPath(coordinate);
+    installer.url = (neoForge ? NeoForgeMaven : ForgeMaven) + mavenPath(coordinate);
+
+    if (!QFile::exists(installer.path)) {
+        if (const auto sha1 = fetchAll({installer.url + ".sha1"}).first())
+            installer.sha1 = QString::fromLatin1(sha1->trimmed().left(40));
+
+        if (!downloadAll({installer}))
+            return false;
+    }
+
+    const auto dataDirectory = QString("%1/cache/loaders/%2").arg(mcRoot, QFileInfo{installer.path}.completeBaseName());
+
+    QByteArray profileData;
+    QByteArray versionData;
+    if (!extractInstaller(installer.path, dataDirectory, profileData, versionData))
+        return false;
+
+    const auto profile = QJsonDocument::fromJson(profileData).object();
+    const auto versionJson = QJsonDocument::fromJson(versionData).object();
+
+    if (!profile.contains("processors") || versionJson.isEmpty()) {
+        qCWarning(lcLoader, "%ls has an install profile from before 1.13, which isn't supported", qUtf16Printable(installer.path));
+        return false;
+    }
+
+    // the processors patch the vanilla client jar, so that comes first
+    const auto minecraft = profile["minecraft"].toString(version.minecraft);
+
+    VersionCatalogue catalogue;
+    if (!catalogue.ensureVersionJson(minecraft, m_downloads))
+        return false;
+
+    QFile vanillaFile{QString("%1/versions/%2/%2.json").arg(mcRoot, minecraft)};
+    vanillaFile.open(QFile::ReadOnly);
+    const auto vanilla = QJsonDocument::fromJson(vanillaFile.readAll()).object();
+
+    const auto minecraftJar = QString("%1/versions/%2/%2.jar").arg(mcRoot, minecraft);
+
+    DownloadInfo client;
+    client.path = minecraftJar;
+    client.url = vanilla["downloads"]["client"]["url"].toString();
+    client.sha1 = vanilla["downloads"]["client"]["sha1"].toString();
+    client.size = vanilla["downloads"]["client"]["size"].toInteger();
+
+    QList<DownloadInfo> files{client};
+    QSet<QString> readOnly{minecraftJar, installer.path};
+
+    // the profile's libraries are the processors' classpath, the version's are needed to play. Those without url
+    // either came with the installer or are made by a processor
+    for (const auto &libraries: {profile["libraries"].toArray(), versionJson["libraries"].toArray()}) {
+        for (const auto &value: libraries) {
+            const auto artifact = value.toObject()["downloads"].toObject()["artifact"].toObject();
+            if (artifact["url"].toString().isEmpty())
+                continue;
+
+            DownloadInfo info;
+            info.path = QString("%1/libraries/%2").arg(mcRoot, artifact["path"].toString());
+            info.url = artifact["url"].toString();
+            info.sha1 = artifact["sha1"].toString();
+            info.size = artifact["size"].toInteger();
+
+            files.append(info);
+            readOnly.insert(info.path);
+        }
+    }
+
+    // all in parallel, maven resolution is done by the profile already
+    if (!downloadAll(files))
+        return false;
+
+    // the processors run on the runtime the game uses
+    JavaRuntimeManager runtimes{m_downloads};
+    const auto javaExecutable = runtimes.provision(vanilla["javaVersion"]["component"].toString()).value_or("/usr/bin/java");
+
+    if (!m_downloads->waitForPending()) {
+        qCWarning(lcLoader, "cannot install %ls for %ls, the runtime failed to download", qUtf16Printable(version.loader), qUtf16Printable(version.minecraft));
+        return false;
+    }
+
+    QHash<QString, QString> variables{
+        {"SIDE", "client"},
+        {"MINECRAFT_JAR", minecraftJar},
+        {"MINECRAFT_VERSION", minecraft},
+        {"ROOT", mcRoot},
+        {"INSTALLER", installer.path},
+        {"LIBRARY_DIR", mcRoot + "/libraries"},
+    };
+
+    const auto data = profile["data"].toObject();
+    for (auto it = data.begin(); it != data.end(); ++it) {
+        const auto value = it->toObject()["client"].toString();
+
+        // [maven coordinate], 'literal' or /path/inside/the/installer
+        if (value.startsWith('[') && value.endsWith(']')) {
+            variables.insert(it.key(), libraryPath(value.mid(1, value.size() - 2)));
+        } else if (value.startsWith('\'') && value.endsWith('\'')) {
+            variables.insert(it.key(), value.mid(1, value.size() - 2));
+        } else if (value.startsWith('/')) {
+            variables.insert(it.key(), dataDirectory + value);
+            readOnly.insert(dataDirectory + value);
+        } else {
+            variables.insert(it.key(), value);
+        }
+    }
+
+    loadCache();
+
+    auto processors = planProcessors(profile, variables, readOnly);
+    if (!runProcessors(processors, javaExecutable))
+        return false;
+
+    // only now, a version json without its processed jars would just crash on launch
+    return writeVersionJson(versionJson);
+}
+
+QList<LoaderInstaller::Processor> LoaderInstaller::planProcessors(const QJsonObject &profile, const QHash<QString, QString> &variables, const QSet<QString> &readOnly)
+{
+    const auto resolve = [this, &variables](const QString &arg) {
+        if (arg.startsWith('{') && arg.endsWith('}'))
+            return variables.value(arg.mid(1, arg.size() - 2), arg);
+        if (arg.startsWith('[') && arg.endsWith(']'))
+            return libraryPath(arg.mid(1, arg.size() - 2));
+        if (arg.startsWith('\'') && arg.endsWith('\''))
+            return arg.mid(1, arg.size() - 2);
+
+        return arg;
+    };
+
+    const auto isFile = [](const QString &value) { return QDir::isAbsolutePath(value) && !QFileInfo{value}.isDir(); };
+
+    QList<Processor> processors;
+
+    for (const auto &value: profile["processors"].toArray()) {
+        const auto json = value.toObject();
+
+        // server only steps
+        if (json.contains("sides") && !json["sides"].toVariant().toStringList().contains("client"))
+            continue;
+
+        Processor processor;
+        processor.jar = libraryPath(json["jar"].toString());
+
+        for (const auto &entry: json["classpath"].toArray())
+            processor.classpath.append(libraryPath(entry.toString()));
+
+        for (const auto &arg: json["args"].toArray()) {
+            const auto resolved = resolve(arg.toString());
+            processor.args.append(resolved);
+
+            if (isFile(resolved))
+                (readOnly.contains(resolved) ? processor.readOnly : processor.touched).insert(resolved);
+        }
+
+        const auto outputs = json["outputs"].toObject();
+        for (auto it = outputs.begin(); it != outputs.end(); ++it) {
+            const auto path = resolve(it.key());
+            processor.outputs.insert(path, resolve(it->toString()));
+            processor.touched.insert(path);
+        }
+
+        // whatever shares files with an earlier step has to wait for it, the rest may run alongside
+        for (qsizetype i = 0; i < processors.size(); ++i) {
+            if (processors[i].touched.intersects(processor.touched))
+                processor.dependencies.append(i);
+        }
+
+        processors.append(processor);
+    }
+
+    return processors;
+}
+
+bool LoaderInstaller::runProcessors(QList<Processor> &processors, const QString &javaExecutable)
+{
+    // every one of them is a JVM of its own
+    const auto maxRunning = std::max(1, QThread::idealThreadCount() / 2);
+
+    int running = 0;
+    bool failed = false;
+
+    QEventLoop loop;
+    std::function<void()> startReady;
+
+    startReady = [&]() {
+        for (qsizetype i = 0; i < processors.size() && running < maxRunning && !failed; ++i) {
+            auto &processor = processors[i];
+            if (processor.state != ProcessorState::Waiting)
+                continue;
+
+            bool ready = true;
+            for (const auto dependency: std::as_const(processor.dependencies))
+                ready &= processors[dependency].state == ProcessorState::Done;
+
+            if (!ready)
+                continue;
+
+            processor.key = processorKey(processor, processors);
+
+            if (isCached(processor)) {
+                traceInfo(tcLoader, "%1 is up to date", processor.jar);
+                processor.state = ProcessorState::Done;
+                continue;
+            }
+
+            const auto mainClass = mainClassOf(processor.jar);
+            if (mainClass.isEmpty()) {
+                qCWarning(lcLoader, "%ls has no main class", qUtf16Printable(processor.jar));
+                failed = true;
+                break;
+            }
+
+            qCInfo(lcLoader, "running %ls", qUtf16Printable(QFileInfo{processor.jar}.fileName()));
+
+            auto process = new QProcess(this);
+            process->setProcessChannelMode(QProcess::MergedChannels);
+            process->setProgram(javaExecutable);
+            process->setArguments(QStringList{"-cp", (QStringList{processor.jar} + processor.classpath).join(QDir::listSeparator()), mainClass} + processor.args);
+
+            connect(process, &QProcess::finished, this, [&, process, i](int exitCode, QProcess::ExitStatus status) {
+                --running;
+                process->deleteLater();
+
+                auto &processor = processors[i];
+                bool ok = status == QProcess::NormalExit && exitCode == 0;
+
+                for (auto it = processor.outputs.cbegin(); ok && it != processor.outputs.cend(); ++it) {
+                    if (sha1Of(it.key()) != it.value()) {
+                        qCWarning(lcLoader, "%ls doesn't match its hash", qUtf16Printable(it.key()));
+                        ok = false;
+                    }
+                }
+
+                if (ok) {
+                    processor.state = ProcessorState::Done;
+                    remember(processor);
+                } else {
+                    qCWarning(lcLoader, "%ls failed:\n%s", qUtf16Printable(processor.jar), process->readAll().right(4096).constData());
+                    failed = true;
+                }
+
+                startReady();
+            });
+
+            connect(process, &QProcess::errorOccurred, this, [&, process](QProcess::ProcessError error) {
+                if (error != QProcess::FailedToStart)
+                    return;
+
+                qCWarning(lcLoader, "cannot start %ls", qUtf16Printable(javaExecutable));
+                --running;
+                failed = true;
+                process->deleteLater();
+                startReady();
+            });
+
+            processor.state = ProcessorState::Running;
+            ++running;
+            process->start();
+        }
+
+        if (running == 0)
+            loop.quit();
+    };
+
+    startReady();
+
+    if (running > 0)
+        loop.exec();
+
+    saveCache();
+
+    for (const auto &processor: std::as_const(processors)) {
+        if (processor.state != ProcessorState::Done)
+            return false;
+    }
+
+    return true;
+}
+
+QString LoaderInstaller::processorKey(const Processor &processor, const QList<Processor> &processors)
+{
+    // what goes in: the step itself, the files nobody writes and, through their keys, whatever earlier steps made
+    QCryptographicHash key(QCryptographicHash::Sha1);
+    key.addData(processor.jar.toUtf8());
+    key.addData(processor.classpath.join('\n').toUtf8());
+    key.addData(processor.args.join('\n').toUtf8());
+
+    auto inputs = processor.readOnly.values();
+    inputs.sort();
+
+    for (const auto &input: std::as_const(inputs)) {
+        key.addData(input.toUtf8());
+        key.addData(hashOf(input).toLatin1());
+    }
+
+    for (const auto dependency: processor.dependencies)
+        key.addData(processors[dependency].key.toLatin1());
+
+    return QString::fromLatin1(key.result().toHex());
+}
+
+bool LoaderInstaller::isCached(const Processor &processor)
+{
+    // the profile says what has to come out, if that's all there the step is done
+    if (!processor.outputs.isEmpty()) {
+        bool complete = true;
+        for (auto it = processor.outputs.cbegin(); complete && it != processor.outputs.cend(); ++it)
+            complete = sha1Of(it.key()) == it.value();
+
+        if (complete)
+            return true;
+    }
+
+    const auto recorded = m_processorCache.value(processor.key).toMap();
+    if (recorded.isEmpty())
+        return false;
+
+    for (auto it = recorded.cbegin(); it != recorded.cend(); ++it) {
+        if (sha1Of(it.key().toString()) != it.value().toString())
+            return false;
+    }
+
+    return true;
+}
+
+void LoaderInstaller::remember(const Processor &processor)
+{
+    QCborMap touched;
+    for (const auto &path: processor.touched) {
+        if (QFileInfo::exists(path))
+            touched.insert(path, sha1Of(path));
+    }
+
+    m_processorCache.insert(processor.key, touched);
+    saveCache();
+}
+
+QList<std::optional<QByteArray>> LoaderInstaller::fetchAll(const QStringList &urls)
+{
+    QList<std::optional<QByteArray>> results(urls.size());
+    if (urls.isEmpty())
+        return results;
+
+    auto remaining = urls.size();
+    QEventLoop loop;
+
+    for (qsizetype i = 0; i < urls.size(); ++i) {
+        traceDebug(tcLoader, "fetching %1", urls[i]);
+
+        auto reply = m_ctrl->get(QNetworkRequest{QUrl{urls[i]}});
+        connect(reply, &QNetworkReply::finished, &loop, [&, reply, i]() {
+            reply->deleteLater();
+
+            if (reply->error() == QNetworkReply::NoError)
+                results[i] = reply->readAll();
+            else
+                qCWarning(lcLoader, "cannot fetch %ls: %ls", qUtf16Printable(urls[i]), qUtf16Printable(reply->errorString()));
+
+            if (--remaining == 0)
+                loop.quit();
+        });
+    }
+
+    loop.exec();
+    return results;
+}
+
+bool LoaderInstaller::downloadAll(const QList<DownloadInfo> &files)
+{
+    int remaining = 0;
+    bool ok = true;
+    bool waiting = false;
+
+    QEventLoop loop;
+
+    for (const auto &info: files) {
+        if (QFile::exists(info.path))
+            continue;
+
+        ++remaining;
+        m_downloads->download(info, [&](const DownloadInfo &, bool success) {
+            ok &= success;
+
+            if (--remaining == 0 && waiting)
+                loop.quit();
+        });
+    }
+
+    if (remaining > 0) {
+        waiting = true;
+        loop.exec();
+    }
+
+    return ok;
+}
+
+bool LoaderInstaller::writeVersionJson(const QJsonObject &version)
+{
+    const auto id = version["id"].toString();
+    const auto path = QString("%1/versions/%2/%2.json").arg(Config::instance()->getConfig("mcRoot").toString(), id);
+
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile output{path};
+    if (!output.open(QFile::WriteOnly)) {
+        qCWarning(lcLoader, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(output.errorString()));
+        return false;
+    }
+
+    output.write(QJsonDocument{version}.toJson());
+    if (!output.commit())
+        return false;
+
+    qCInfo(lcLoader, "installed %ls", qUtf16Printable(id));
+    return true;
+}
+
+bool LoaderInstaller::extractInstaller(const QString &installerPath, const QString &dataDirectory, QByteArray &profile, QByteArray &version)
+{
+    auto jar = openJar(installerPath);
+    if (!jar)
+        return false;
+
+    const QDir libraries{Config::instance()->getConfig("mcRoot").toString() + "/libraries"};
+
+    archive_entry *entry;
+    int r;
+    while ((r = archive_read_next_header(jar, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) {
+        const auto name = QString::fromUtf8(archive_entry_pathname(entry));
+
+        if (archive_entry_filetype(entry) != AE_IFREG || !isSafeRelativePath(name))
+            continue;
+
+        QString target;
+
+        if (name == "install_profile.json") {
+            profile = readData(jar);
+        } else if (name == "version.json") {
+            version = readData(jar);
+        } else if (name.startsWith("data/")) {
+            // referenced as /data/... by the profile
+            target = dataDirectory + "/" + name;
+        } else if (name.startsWith("maven/")) {
+            // the loader's own jars, they have no download url
+            target = libraries.absoluteFilePath(name.mid(6));
+            if (QFile::exists(target))
+                continue;
+        }
+
+        if (target.isEmpty())
+            continue;
+
+        QDir{}.mkpath(QFileInfo{target}.absolutePath());
+
+        QSaveFile output{target};
+        if (!output.open(QFile::WriteOnly)) {
+            qCWarning(lcLoader, "cannot write %ls: %ls", qUtf16Printable(target), qUtf16Printable(output.errorString()));
+            continue;
+        }
+
+        output.write(readData(jar));
+        output.commit();
+    }
+
+    const bool ok = r == ARCHIVE_EOF && !profile.isEmpty();
+    if (!ok)
+        qCWarning(lcLoader, "cannot read the install profile of %ls", qUtf16Printable(installerPath));
+
+    archive_read_free(jar);
+    return ok;
+}
+
+QString LoaderInstaller::libraryPath(const QString &coordinate) const
+{
+    return QString("%1/libraries/%2").arg(Config::instance()->getConfig("mcRoot").toString(), mavenPath(coordinate));
+}
+
+QString LoaderInstaller::hashOf(const QString &path)
+{
+    if (const auto cached = m_hashes.value(path); !cached.isEmpty())
+        return cached;
+
+    const auto sha1 = sha1Of(path);
+    m_hashes.insert(path, sha1);
+
+    return sha1;
+}
+
+void LoaderInstaller::loadCache()
+{
+    QFile file{cachePath()};
+    if (file.open(QFile::ReadOnly))
+        m_processorCache = QCborValue::fromCbor(file.readAll()).toMap();
+}
+
+void LoaderInstaller::saveCache()
+{
+    QDir{}.mkpath(QFileInfo{cachePath()}.absolutePath());
+
+    QSaveFile file{cachePath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcLoader, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{m_processorCache}.toCbor());
+    file.commit();
+}
+
+QString LoaderInstaller::cachePath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/processors.cbor";
+}
+
+} // namespace randomly
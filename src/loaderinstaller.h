@@ -0,0 +1,94 @@
+#ifndef LOADERINSTALLER_H
+#define LOADERINSTALLER_H
+
+#include <QCborMap>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QSet>
+
+#include <optional>
+
+class QNetworkAccessManager;
+
+namespace randomly {
+
+class Downloader;
+struct DownloadInfo;
+
+struct LoaderVersion
+{
+    enum class Kind { Fabric, Quilt, Forge, NeoForge };
+
+    Kind kind;
+    QString minecraft;
+    QString loader;
+};
+
+// installs mod loader versions the way their own installers would, so a version like
+// fabric-loader-0.15.11-1.18.2 works without anything else having set it up before.
+// Fabric and Quilt only need their profile json. Forge and NeoForge also run the processors of their install
+// profile, in parallel where they don't share files, and remember their outputs so they never run twice
+class LoaderInstaller : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoaderInstaller(QObject *parent = nullptr);
+    explicit LoaderInstaller(Downloader *downloads, QObject *parent = nullptr); // a downloader of its own if null
+
+    // "fabric-loader-0.15.11-1.18.2", "quilt-loader-0.26.0-1.20.1", "1.20.1-forge-47.2.0" or "neoforge-20.4.237"
+    static std::optional<LoaderVersion> parse(const QString &versionId);
+
+    // "group:artifact:version[:classifier][@extension]" -> group/as/path/artifact/version/artifact-version[-classifier].extension
+    static QString mavenPath(const QString &coordinate);
+
+    // writes versions/<id>/<id>.json. Blocks until the loader is completely installed
+    bool install(const QString &versionId);
+
+private:
+    enum class ProcessorState { Waiting, Running, Done };
+
+    struct Processor
+    {
+        QString jar;
+        QStringList classpath;
+        QStringList args;
+        QHash<QString, QString> outputs; // path -> sha1, as declared by the profile
+        QSet<QString> touched;           // files it may write, or read after another processor wrote them
+        QSet<QString> readOnly;          // files nobody writes: libraries, the game jar, installer data
+        QList<int> dependencies;         // earlier processors touching the same files
+        QString key;
+        ProcessorState state = ProcessorState::Waiting;
+    };
+
+    bool installFabricLike(const LoaderVersion &version);
+    bool installForge(const LoaderVersion &version);
+
+    QList<Processor> planProcessors(const QJsonObject &profile, const QHash<QString, QString> &variables, const QSet<QString> &readOnly);
+    bool runProcessors(QList<Processor> &processors, const QString &javaExecutable);
+    QString processorKey(const Processor &processor, const QList<Processor> &processors);
+    bool isCached(const Processor &processor);
+    void remember(const Processor &processor);
+
+    QList<std::optional<QByteArray>> fetchAll(const QStringList &urls);
+    bool downloadAll(const QList<DownloadInfo> &files);
+    bool writeVersionJson(const QJsonObject &version);
+    bool extractInstaller(const QString &installerPath, const QString &dataDirectory, QByteArray &profile, QByteArray &version);
+
+    QString libraryPath(const QString &coordinate) const;
+    QString hashOf(const QString &path);
+
+    void loadCache();
+    void saveCache();
+    QString cachePath() const;
+
+    Downloader *m_downloads;
+    QNetworkAccessManager *m_ctrl;
+
+    QHash<QString, QString> m_hashes; // of read-only inputs, they don't change during an install
+    QCborMap m_processorCache;        // key -> {path: sha1} of what it touched
+};
+
+} // namespace randomly
+
+#endif // LOADERINSTALLER_H
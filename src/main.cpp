@@ -1,11 +1,22 @@
 #include "minecraftcommandlineprovider.h"
 
 #include "auth.h"
+#include "commandlineinterface.h"
+#include "config.h"
+#include "downloadprogressmodel.h"
+#include "instancemodel.h"
+#include "launchhistory.h"
+#include "pagecacheprefetcher.h"
+#include "processsupervisor.h"
+#include "tracelog.h"
+#include "versioncatalogue.h"
 
 #include <QGuiApplication>
 #include <QLoggingCategory>
-#include <QProcess>
 #include <QQmlApplicationEngine>
+#include <QTimer>
+
+#include <memory>
 
 namespace randomly {
 
@@ -15,37 +26,128 @@ public:
     using QGuiApplication::QGuiApplication;
 
     int run();
+
+private:
+    void launch(const QString &versionName);
+
+    MinecraftCommandLineProvider m_provider;
+
+    // polls the downloader at a fixed frame rate, whatever the number of files
+    DownloadProgressModel m_downloads{m_provider.downloader()};
+
+    // shows the cached index immediately and rescans in the background
+    InstanceModel m_instances;
+
+    // the game runs next to the UI, its output goes to mcRoot/logs/launcher/<version>.log
+    ProcessSupervisor m_supervisor;
+
+    // last, so it goes before everything its QML refers to
+    QQmlApplicationEngine m_qml;
 };
 
 int Application::run()
 {
-    QQmlApplicationEngine qml;
     // QLoggingCategory::setFilterRules("randomly.MyLauncher.*=false");
     QLoggingCategory::setFilterRules("randomly.MyLauncher.Config*=false");
 
+    // the window comes first, so the downloads of the launch below are on screen while they happen
+    m_qml.setInitialProperties({
+        {"instances", QVariant::fromValue(&m_instances)},
+        {"downloads", QVariant::fromValue(&m_downloads)},
+    });
+
+    m_qml.loadFromModule("MyLauncherGui", "Main");
+
+    if (m_qml.rootObjects().isEmpty())
+        return EXIT_FAILURE;
+
+    QTimer::singleShot(0, this, [this]() { launch("fabric-loader-0.15.11-1.18.2"); });
+
+    return exec();
+}
+
+void Application::launch(const QString &versionName)
+{
+    // only goes to the network if the version (or what it inherits from) is missing or outdated
+    VersionCatalogue catalogue;
+    if (!catalogue.ensureVersionJson(versionName, m_provider.downloader())) {
+        qCritical("unknown version %ls", qUtf16Printable(versionName));
+        return;
+    }
+
+    const auto files = m_provider.launchFiles(versionName);
+    LaunchMeter meter{versionName, files, m_provider.downloader()};
+
+    // the disk reads the JVM's working set while authentication waits for the network
+    PageCachePrefetcher::prefetch(files);
+
     Auth a;
     a.obtainMinecraftToken();
+    meter.authenticated();
 
-    MinecraftCommandLineProvider p;
+    const auto commandLine = m_provider.getCommandLine(versionName);
+    if (!commandLine) {
+        qCritical("cannot build a command line for %ls", qUtf16Printable(versionName));
+        return;
+    }
 
-    auto cmdLine = p.getCommandLine("fabric-loader-0.15.11-1.18.2").value();
-    // auto cmdLine = p.getCommandLine("myver").value();
-    qInfo() << "\n\n" << cmdLine.second << "\n\n";
+    auto cmdLine = *commandLine;
+    meter.resolved();
 
-    QProcess mc;
-    qInfo() << QProcess::execute(cmdLine.first, cmdLine.second);
+    // the runtime and libraries may only be queued yet, java has to exist before it's spawned. That wait happens in
+    // the event loop, the window keeps showing the progress meanwhile
+    auto *downloader = m_provider.downloader();
+    auto spawn = [this, versionName, cmdLine, meter](bool downloadsOk) mutable {
+        if (!downloadsOk) {
+            qCritical("cannot launch %ls, downloads failed", qUtf16Printable(versionName));
+            return;
+        }
 
-    qml.loadFromModule("MyLauncher", "Main");
+        meter.downloaded(cmdLine.first);
+        // auto cmdLine = p.getCommandLine("myver").value();
+        qInfo() << "\n\n" << cmdLine.second << "\n\n";
 
-    if (qml.rootObjects().isEmpty())
-        return EXIT_FAILURE;
+        auto game = m_supervisor.launch(versionName, cmdLine.first, cmdLine.second);
+        meter.recordOnExit(game);
+    };
 
-    return exec();
+    if (downloader->pendingDownloads() == 0) {
+        spawn(true);
+        return;
+    }
+
+    // goes away with its connections once the downloads are through
+    auto *waiting = new QObject{this};
+    auto downloadsOk = std::make_shared<bool>(true);
+    const auto spawnIfDone = [downloader, waiting, downloadsOk, spawn]() mutable {
+        if (downloader->pendingDownloads() > 0)
+            return;
+
+        waiting->deleteLater();
+        QObject::disconnect(downloader, nullptr, waiting, nullptr);
+        spawn(*downloadsOk);
+    };
+
+    connect(downloader, &Downloader::downloadCompleted, waiting, spawnIfDone);
+    connect(downloader, &Downloader::downloadFailed, waiting, [downloadsOk, spawnIfDone]() mutable {
+        *downloadsOk = false;
+        spawnIfDone();
+    });
 }
 
 } // namespace randomly
 
 int main(int argc, char *argv[])
 {
+    // the trace buffer is written to disk if we crash, `kill -USR1` dumps it to stderr. Headless servers need that
+    // the most, so it's installed before we know which application we are
+    randomly::trace::TraceLog::instance().installSignalHandlers(randomly::Config::instance()->getConfig("mcRoot").toString() + "/MyLauncher-crash.log");
+
+    // headless hosts don't get a QGuiApplication (or anything QML) at all
+    if (randomly::CommandLineInterface::isRequested(argc, argv)) {
+        QCoreApplication app{argc, argv};
+        return randomly::CommandLineInterface{}.run(app.arguments());
+    }
+
     return randomly::Application{argc, argv}.run();
 }
@@ -1,62 +1,231 @@
 #include "minecraftcommandlineprovider.h"
 
+#include "assetstage.h"
 #include "config.h"
 #include "downloader.h"
-
+#include "instancestore.h"
+#include "javaruntimemanager.h"
+#include "jvmtuning.h"
+#include "loaderinstaller.h"
+#include "nativescache.h"
+#include "tracelog.h"
+
+#include <QCryptographicHash>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QLoggingCategory>
+#include <QSet>
 #include <optional>
 
 namespace randomly {
 
 Q_LOGGING_CATEGORY(lcCommandLineProvider, "randomly.MyLauncher.CmdLineProvider");
 
+constexpr auto tcCommandLineProvider = "randomly.MyLauncher.CmdLineProvider";
+
 MinecraftCommandLineProvider::MinecraftCommandLineProvider(QObject *parent)
     : QObject{parent}
     , m_downloads{new Downloader(this)}
+    , m_runtimes{new JavaRuntimeManager(m_downloads, this)}
+    , m_assets{new AssetStage(m_downloads, this)}
+{}
+
+MinecraftCommandLineProvider::MinecraftCommandLineProvider(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads}
+    , m_runtimes{new JavaRuntimeManager(m_downloads, this)}
+    , m_assets{new AssetStage(m_downloads, this)}
 {}
 
 std::optional<QPair<QString, QStringList>> MinecraftCommandLineProvider::getCommandLine(QString versionName)
 {
-    auto cfg = Config::instance();
-    auto mcRoot = QDir{cfg->getConfig("mcRoot").toString()};
+    // every json of the inheritance chain has to be there, a command line without the parent's main class or
+    // libraries would only fail once java runs
+    QSet<QString> visited;
+
+    for (auto current = versionName; !current.isEmpty();) {
+        const auto config = loadJsonFromVersion(current);
+        if (!config.isObject() || visited.contains(current)) {
+            qCWarning(lcCommandLineProvider, "cannot load %ls or what it inherits from", qUtf16Printable(versionName));
+            return {};
+        }
 
-    mcRoot.cd("versions");
-    mcRoot.cd(versionName);
+        visited.insert(current);
 
-    QFile launcherConfig{mcRoot.filePath("MyLauncher.json")};
+        current = config["inheritsFrom"].toString();
+    }
 
     // also get the instance info from .minecraft/launcher_profiles.json. pass using an argument of type QJsonDOcument/Object?
+    const auto launcherConfig = loadLauncherConfig(versionName);
+
+    const auto [javaExecutable, javaMajor] = resolveJava(versionName, launcherConfig);
+
+    return QPair<QString, QStringList>{javaExecutable, readArguments(versionName, javaExecutable, javaMajor, launcherConfig["jvm"].toObject())};
+}
+
+void MinecraftCommandLineProvider::prefetch(const QString versionName)
+{
+    resolveJava(versionName, loadLauncherConfig(versionName));
+
+    const auto versionConfig = prepareVersion(versionName);
+    downloadLibraries(versionConfig);
+    stageAssets(versionConfig);
+}
+
+QStringList MinecraftCommandLineProvider::launchFiles(const QString versionName)
+{
+    QStringList files;
+
+    // the runtime comes first, the class data archive and libjvm are the largest cold reads of all
+    auto javaExecutable = loadLauncherConfig(versionName)["javaExecutable"].toString();
+    if (javaExecutable.isEmpty()) {
+        const auto component = getCombinedVersionConfig(versionName)["javaVersion"]["component"].toString();
+        javaExecutable = component.isEmpty() ? "/usr/bin/java" : m_runtimes->javaExecutable(component);
+    }
+
+    // bin/java -> the java home
+    const QDir javaHome{QFileInfo{QFileInfo{javaExecutable}.canonicalFilePath()}.dir().filePath("..")};
+    files << javaHome.filePath("lib/modules") << javaHome.filePath("lib/server/libjvm.so") << javaHome.filePath("lib/server/classes.jsa");
+
+    // libraries and the client jar, in classpath order. The native jars only matter for extraction
+    const auto versionConfig = prepareVersion(versionName);
+    for (const auto &info: requiredFiles(versionConfig)) {
+        if (!info.native)
+            files << info.path;
+    }
+
+    const QDir natives{Config::instance()->getTemp("natives_directory").toString()};
+    for (const auto &native: natives.entryInfoList(QDir::Files))
+        files << native.filePath();
 
-    if (!launcherConfig.exists()) {} // skip launcher options or set some default values (maybe get them from Config? idk
+    return files;
+}
+
+QPair<QString, int> MinecraftCommandLineProvider::resolveJava(const QString versionName, const QJsonObject &launcherConfig)
+{
     // i.e. screen, wrappers (like primusrun), different java executable...
+    if (const auto javaExecutable = launcherConfig["javaExecutable"].toString(); !javaExecutable.isEmpty())
+        return {javaExecutable, 0};
 
-    return QPair<QString, QStringList>{"/usr/bin/java", readArguments(versionName)};
+    // the runtime mojang picked for this version, its files may still be downloading, so we can't ask it for its version
+    const auto javaVersion = getCombinedVersionConfig(versionName)["javaVersion"];
+    if (const auto managed = m_runtimes->provision(javaVersion["component"].toString()))
+        return {*managed, javaVersion["majorVersion"].toInt()};
+
+    return {"/usr/bin/java", 0};
 }
 
-QStringList MinecraftCommandLineProvider::readArguments(const QString versionName)
+QStringList MinecraftCommandLineProvider::verify(const QString versionName)
+{
+    QStringList broken;
+
+    const auto files = requiredFiles(prepareVersion(versionName));
+    for (const auto &info: files) {
+        // extracted for another version already, the archive itself isn't needed
+        if (info.native && NativesCache::isComplete(nativesKey(info)))
+            continue;
+
+        QFile file{info.path};
+
+        if (!file.open(QFile::ReadOnly)) {
+            broken.append(info.path);
+            continue;
+        }
+
+        // can't compare hashes if none is provided
+        if (info.sha1.isEmpty())
+            continue;
+
+        QCryptographicHash sha1(QCryptographicHash::Sha1);
+        sha1.addData(&file);
+
+        if (sha1.result().toHex() != info.sha1.toLatin1())
+            broken.append(info.path);
+    }
+
+    return broken;
+}
+
+QList<DownloadInfo> MinecraftCommandLineProvider::missingFiles(const QString versionName)
+{
+    QList<DownloadInfo> missing;
+    QSet<QString> seen;
+
+    for (const auto &info: requiredFiles(prepareVersion(versionName))) {
+        // some libraries have more than one entry
+        if (seen.contains(info.path))
+            continue;
+
+        seen.insert(info.path);
+
+        // extracted for another version already, the archive itself isn't needed
+        if (info.native && NativesCache::isComplete(nativesKey(info)))
+            continue;
+
+        if (!QFile::exists(info.path))
+            missing.append(info);
+    }
+
+    return missing;
+}
+
+QJsonDocument MinecraftCommandLineProvider::prepareVersion(const QString versionName)
 {
     auto cfg = Config::instance();
     auto mcRoot = QDir{cfg->getConfig("mcRoot").toString()};
 
-    QStringList arguments{};
-
     auto mergedConfig = getCombinedVersionConfig(versionName);
 
     // store information we might need later as temporary configs
     cfg->setTemp("version_name", mergedConfig["id"]);
-    cfg->setTemp("game_directory", mcRoot.absolutePath());
+    // every instance has its own saves, options and mods
+    const auto gameDirectory = InstanceStore::gameDirectory(versionName);
+    QDir{}.mkpath(gameDirectory);
+
+    cfg->setTemp("game_directory", gameDirectory);
     cfg->setTemp("assets_dir", mcRoot.absoluteFilePath("assets"));
+    cfg->setTemp("assets_root", mcRoot.absoluteFilePath("assets"));
     cfg->setTemp("assets_index_name", mergedConfig["assetIndex"]["id"]);
     cfg->setTemp("version_type", mergedConfig["type"]);
 
-    // cfg->setTemp("natives_directory", mcRoot.absoluteFilePath("bin/" + cfg->getTemp("version_name").toString()));
-    // if (const auto nativesDir = QDir(cfg->getTemp("natives_directory").toString()); !nativesDir.exists())
-    //     nativesDir.mkpath(".");
+    // only the legacy minecraftArguments ask for these. Twitch properties are long gone, the session is the pre-yggdrasil
+    // form of the token, set by Auth before the command line gets built
+    cfg->setTemp("user_properties", "{}");
+    cfg->setTemp("auth_session", QString{"token:%1:%2"}.arg(cfg->getTemp("auth_access_token").toString(), cfg->getTemp("auth_uuid").toString()));
+
+    // only links into cache/natives, see NativesCache
+    cfg->setTemp("natives_directory", mcRoot.absoluteFilePath("bin/" + mergedConfig["id"].toString()));
+
+    return mergedConfig;
+}
+
+QJsonObject MinecraftCommandLineProvider::loadLauncherConfig(const QString versionName)
+{
+    auto cfg = Config::instance();
+    auto mcRoot = QDir{cfg->getConfig("mcRoot").toString()};
+
+    mcRoot.cd("versions");
+    mcRoot.cd(versionName);
+
+    QFile launcherConfig{mcRoot.filePath("MyLauncher.json")};
+
+    if (!launcherConfig.open(QFile::ReadOnly))
+        return {}; // no launcher options, everything stays at its default
+
+    return QJsonDocument::fromJson(launcherConfig.readAll()).object();
+}
+
+QStringList MinecraftCommandLineProvider::readArguments(const QString versionName, const QString javaExecutable, int javaMajor, const QJsonObject jvmOverrides)
+{
+    auto cfg = Config::instance();
+
+    QStringList arguments{};
+
+    auto mergedConfig = prepareVersion(versionName);
 
     cfg->setTemp("classpath", collectClassPath(mergedConfig));
 
@@ -74,8 +243,25 @@ QStringList MinecraftCommandLineProvider::readArguments(const QString versionNam
 
     // schedule downloads while parsing the arguments
     downloadLibraries(mergedConfig);
+    stageAssets(mergedConfig);
 
     // the argument order is: jvm, logging, mainClass, game
+    // the tuned arguments go first, so anything the version json sets explicitly still wins
+    arguments += tuneJvm(javaExecutable, javaMajor, jvmOverrides);
+
+    // versions before 1.13 only have a single string of game arguments and leave the jvm ones to the launcher
+    if (const auto legacyArguments = mergedConfig["minecraftArguments"].toString(); !mergedConfig["arguments"].isObject() && !legacyArguments.isEmpty()) {
+        arguments += parseOption("-Djava.library.path=${natives_directory}");
+        arguments += "-cp";
+        arguments += parseOption("${classpath}");
+        arguments += mergedConfig["mainClass"].toString();
+
+        for (const auto &arg: legacyArguments.split(' ', Qt::SkipEmptyParts))
+            arguments += parseOption(arg);
+
+        return arguments;
+    }
+
     arguments += parseArgumentArray(mergedConfig["arguments"]["jvm"].toArray());
     arguments += mergedConfig["mainClass"].toString();
     arguments += parseArgumentArray(mergedConfig["arguments"]["game"].toArray());
@@ -83,6 +269,35 @@ QStringList MinecraftCommandLineProvider::readArguments(const QString versionNam
     return arguments;
 }
 
+void MinecraftCommandLineProvider::stageAssets(const QJsonDocument &versionConfig)
+{
+    auto cfg = Config::instance();
+
+    // old versions get their assets through ${game_assets}, a tree of their real names
+    const auto assetsDirectory = m_assets->prepare(versionConfig["assetIndex"].toObject(), cfg->getTemp("game_directory").toString());
+    cfg->setTemp("game_assets", assetsDirectory);
+}
+
+QStringList MinecraftCommandLineProvider::tuneJvm(const QString &javaExecutable, int javaMajor, const QJsonObject &overrides)
+{
+    // "tuning": false keeps only the explicitly listed arguments
+    if (!overrides["tuning"].toBool(true))
+        return overrides["arguments"].toVariant().toStringList();
+
+    const auto defaultRole = Config::instance()->getConfig("jvm_profile").toString();
+    const auto role = JvmTuning::roleFromString(overrides["profile"].toString(defaultRole));
+    if (javaMajor == 0)
+        javaMajor = JvmTuning::detectJavaMajor(javaExecutable);
+
+    auto profile = JvmTuning::profileFor(role, JvmTuning::detectHost(), javaMajor);
+    JvmTuning::applyOverrides(profile, overrides);
+
+    const auto arguments = profile.toArguments(javaMajor);
+    qCInfo(lcCommandLineProvider) << "jvm tuning:" << arguments;
+
+    return arguments;
+}
+
 QJsonDocument MinecraftCommandLineProvider::loadJsonFromVersion(const QString versionName)
 {
     auto cfg = Config::instance();
@@ -106,8 +321,14 @@ QJsonDocument MinecraftCommandLineProvider::getCombinedVersionConfig(const QStri
     auto config = loadJsonFromVersion(rootVersion);
 
     auto newDoc = QJsonDocument{};
+    QSet<QString> visited{rootVersion};
 
     for(auto inherited = config["inheritsFrom"]; inherited != QJsonValue::Undefined; inherited = newDoc["inheritsFrom"]) {
+        // a cycle, getCommandLine refuses those
+        if (visited.contains(inherited.toString()))
+            break;
+
+        visited.insert(inherited.toString());
         newDoc = loadJsonFromVersion(inherited.toString());
         qCInfo(lcCommandLineProvider) << "inheriting" << inherited.toString();
 
@@ -218,14 +439,14 @@ QString MinecraftCommandLineProvider::parseOption(const QString opt)
             parsed += slice;
     }
 
-    qCInfo(lcCommandLineProvider) << opt << "->" << parsed;
+    traceDebug(tcCommandLineProvider, "%1 -> %2", opt, parsed);
 
     return parsed;
 }
 
 std::optional<QStringList> MinecraftCommandLineProvider::handleConditionalArgument(QJsonObject arg)
 {
-    qCInfo(lcCommandLineProvider) << "conditional arg:" << arg;
+    traceDebug(tcCommandLineProvider, "conditional arg with %1 rules", arg["rules"].toArray().size());
 
     if (!checkRules (arg["rules"].toArray()))
         return {};
@@ -332,10 +553,8 @@ QString MinecraftCommandLineProvider::collectClassPath(const QJsonDocument &vers
 
 QString MinecraftCommandLineProvider::generateRelativePathFromName(const QString libraryName)
 {
-    auto slices = libraryName.split(":");
-    slices[0].replace('.', '/');
-
-    return QString("%1/%2/%3/%2-%3.jar").arg(slices[0], slices[1], slices[2]);
+    // classifiers and extensions too, loaders use both
+    return LoaderInstaller::mavenPath(libraryName);
 }
 
 std::optional<QString> MinecraftCommandLineProvider::getArtifactPath(const QJsonObject library)
@@ -355,9 +574,9 @@ std::optional<QString> MinecraftCommandLineProvider::getArtifactPath(const QJson
         return generateRelativePathFromName(libraryName);
 }
 
-void MinecraftCommandLineProvider::downloadLibraries(const QJsonDocument &versionConfig)
+QList<DownloadInfo> MinecraftCommandLineProvider::requiredFiles(const QJsonDocument &versionConfig)
 {
-    qCInfo(lcCommandLineProvider) << "downloading libraries...";
+    QList<DownloadInfo> files;
 
     // previously used to avoid duplicates
     // QSet<QString> librarySet;
@@ -391,27 +610,102 @@ void MinecraftCommandLineProvider::downloadLibraries(const QJsonDocument &versio
         else
             artifact = library;
 
-        if (!QFile(absolutePath).exists()) { // QDir gives false negatives
-            DownloadInfo info;
-            info.path = absolutePath;
-            info.url = artifact["url"].toString();
-            if (info.url.endsWith('/'))
-                info.url += getArtifactPath(library).value();
+        DownloadInfo info;
+        info.path = absolutePath;
+        info.url = artifact["url"].toString();
+        if (info.url.endsWith('/'))
+            info.url += getArtifactPath(library).value();
 
-            info.sha1 = artifact["sha1"].toString();
-            info.size = artifact["size"].toInteger();
+        info.sha1 = artifact["sha1"].toString();
+        info.size = artifact["size"].toInteger();
 
-            m_downloads->download(info);
-        }
+        files.append(info);
 
         if (download != QJsonValue::Undefined)
             if (auto classifiers = download["classifiers"]; classifiers != QJsonValue::Undefined)
                 if (classifiers.toObject().contains("natives-" + cfg->getConfig("os_name").toString()))
-                    prepareNativesDownload(classifiers.toObject());
+                    files.append(prepareNativesDownload(classifiers.toObject(), library["extract"]["exclude"].toVariant().toStringList()));
+    }
+
+    // the client jar lives next to the version json of the version we're launching, even if it's inherited
+    if (const auto client = versionConfig["downloads"]["client"]; client.isObject()) {
+        const auto versionName = cfg->getTemp("version_name").toString();
+
+        DownloadInfo info;
+        info.path = QString("%1/versions/%2/%2.jar").arg(cfg->getConfig("mcRoot").toString(), versionName);
+        info.url = client["url"].toString();
+        info.sha1 = client["sha1"].toString();
+        info.size = client["size"].toInteger();
+
+        files.append(info);
+    }
+
+    return files;
+}
+
+void MinecraftCommandLineProvider::downloadLibraries(const QJsonDocument &versionConfig)
+{
+    qCInfo(lcCommandLineProvider) << "downloading libraries...";
+
+    auto files = requiredFiles(versionConfig);
+
+    // captured now, the temp belongs to whichever version was prepared last once a download finishes
+    const auto nativesDirectory = Config::instance()->getTemp("natives_directory").toString();
+
+    for (auto &info: files) {
+        if (info.native) {
+            stageNatives(info, nativesDirectory);
+            continue;
+        }
+
+        // QDir gives false negatives
+        if (QFile(info.path).exists()) {
+            m_downloads->announce(info);
+            continue;
+        }
+
+        m_downloads->download(info);
     }
 }
 
-void MinecraftCommandLineProvider::prepareNativesDownload(QJsonObject classifiers)
+void MinecraftCommandLineProvider::stageNatives(DownloadInfo &info, const QString &nativesDirectory)
+{
+    const auto key = nativesKey(info);
+
+    // another version already extracted it, linking is all that's left. If that fails the entry lost files,
+    // it's extracted again like it never existed
+    if (NativesCache::isComplete(key) && NativesCache::link(key, nativesDirectory))
+        return;
+
+    const auto extract = [key, nativesDirectory](const DownloadInfo &info, bool success) {
+        if (!success)
+            return;
+
+        // versions sharing the transfer all end up here, only the first one extracts
+        if (NativesCache::isComplete(key) && NativesCache::link(key, nativesDirectory))
+            return;
+
+        if (!NativesCache::extract(info.path, key, info.extractExcludes) || !NativesCache::link(key, nativesDirectory))
+            qCWarning(lcCommandLineProvider, "cannot stage natives from %ls", qUtf16Printable(info.path));
+    };
+
+    if (QFile(info.path).exists()) {
+        extract(info, true);
+        return;
+    }
+
+    qCInfo(lcCommandLineProvider).noquote() << "downloading natives" << info.path;
+    m_downloads->downloadNative(info, extract);
+}
+
+QString MinecraftCommandLineProvider::nativesKey(const DownloadInfo &info)
+{
+    // without a hash the archive's path has to do, it contains the library's version
+    const auto archiveHash = info.sha1.isEmpty() ? QString::fromLatin1(QCryptographicHash::hash(info.path.toUtf8(), QCryptographicHash::Sha1).toHex()) : info.sha1;
+    return NativesCache::key(archiveHash, info.extractExcludes);
+}
+
+DownloadInfo MinecraftCommandLineProvider::prepareNativesDownload(QJsonObject classifiers, const QStringList &excludes)
 {
     const auto natives = classifiers["natives-" + Config::instance()->getConfig("os_name").toString()].toObject();
 
@@ -421,15 +715,13 @@ void MinecraftCommandLineProvider::prepareNativesDownload(QJsonObject classifier
     DownloadInfo download;
 
     download.path = libraryRoot.absoluteFilePath(natives["path"].toString());
-    if (QFile::exists(download.path)) // archive already exists, so we'll assume it is also extracted
-        return;
-
     download.sha1 = natives["sha1"].toString();
     download.size = natives["size"].toInt();
     download.url  = natives["url"].toString();
+    download.native = true;
+    download.extractExcludes = excludes;
 
-    qCInfo(lcCommandLineProvider).noquote() << "downloading natives" << download.path;
-    m_downloads->downloadNative(download);
+    return download;
 }
 
 } // namespace randomly
@@ -2,11 +2,15 @@
 #define MINECRAFTCOMMANDLINEPROVIDER_H
 
 #include <QFile>
+#include <QJsonObject>
 #include <QObject>
 
 namespace randomly {
 
+class AssetStage;
 class Downloader;
+class JavaRuntimeManager;
+struct DownloadInfo;
 
 class MinecraftCommandLineProvider : public QObject
 {
@@ -14,12 +18,37 @@ class MinecraftCommandLineProvider : public QObject
 public:
     explicit MinecraftCommandLineProvider(QObject *parent = nullptr);
 
+    // providers sharing a downloader also share in-flight transfers, i.e. libraries several versions use
+    explicit MinecraftCommandLineProvider(Downloader *downloads, QObject *parent = nullptr);
+
+    // nullopt if the json of versionName, or of anything it inherits from, can't be loaded
     std::optional<QPair<QString, QStringList>> getCommandLine(QString versionName);
 
+    // schedules all downloads versionName needs without building a command line
+    void prefetch(const QString versionName);
+
+    // files versionName needs that are missing or don't match their hash
+    QStringList verify(const QString versionName);
+
+    // what the JVM reads first when launching versionName: the java runtime, the classpath in order and the
+    // natives. Doesn't touch the network, so it can be prefetched while authentication is still running
+    QStringList launchFiles(const QString versionName);
+
+    // libraries, natives and the client jar versionName needs that aren't on disk yet. Doesn't schedule anything
+    QList<DownloadInfo> missingFiles(const QString versionName);
+
+    // the version json with everything it inherits merged in
+    QJsonDocument getCombinedVersionConfig(const QString rootVersion);
+
+    Downloader *downloader() const { return m_downloads; }
+
 private:
-    QStringList readArguments(const QString versionName);
+    QJsonObject loadLauncherConfig(const QString versionName);
+    QPair<QString, int> resolveJava(const QString versionName, const QJsonObject &launcherConfig);
+    QStringList readArguments(const QString versionName, const QString javaExecutable, int javaMajor, const QJsonObject jvmOverrides);
+    QStringList tuneJvm(const QString &javaExecutable, int javaMajor, const QJsonObject &overrides);
+    QJsonDocument prepareVersion(const QString versionName);
     QJsonDocument loadJsonFromVersion(const QString versionName);
-    QJsonDocument getCombinedVersionConfig(const QString rootVersion);
     void tryRecursivelyMergingObjects(QJsonObject &lhs, const QJsonObject &rhs);
 
     QStringList parseArgumentArray(QJsonArray arguments);
@@ -35,10 +64,16 @@ private:
     QString generateRelativePathFromName(const QString libraryName);
     std::optional<QString> getArtifactPath(const QJsonObject library);
 
+    QList<DownloadInfo> requiredFiles(const QJsonDocument &versionConfig);
     void downloadLibraries(const QJsonDocument &versionConfig);
-    void prepareNativesDownload(QJsonObject classifiers);
+    void stageAssets(const QJsonDocument &versionConfig);
+    void stageNatives(DownloadInfo &info, const QString &nativesDirectory);
+    QString nativesKey(const DownloadInfo &info);
+    DownloadInfo prepareNativesDownload(QJsonObject classifiers, const QStringList &excludes);
 
     Downloader *m_downloads;
+    JavaRuntimeManager *m_runtimes;
+    AssetStage *m_assets;
 };
 
 } // namespace randomly
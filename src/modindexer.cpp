@@ -0,0 +1,429 @@
+#include "modindexer.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QtConcurrent>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcMods, "randomly.MyLauncher.Mods")
+
+constexpr auto tcMods = "randomly.MyLauncher.Mods";
+
+// bump whenever ModInfo or the parsers change, older indexes are thrown away
+constexpr int IndexFormat = 3;
+
+// nothing a mod jar can provide
+const QStringList PlatformIds{"minecraft", "java", "fabricloader", "quilt_loader", "forge", "neoforge"};
+
+QCborMap toCbor(const ModInfo &mod)
+{
+    return {
+        {"size", mod.size},
+        {"modified", mod.modified},
+        {"loader", mod.loader},
+        {"id", mod.id},
+        {"version", mod.version},
+        {"name", mod.name},
+        {"provides", QCborArray::fromStringList(mod.provides)},
+        {"depends", QCborArray::fromStringList(mod.depends)},
+    };
+}
+
+QStringList toStringList(const QCborValue &value)
+{
+    QStringList list;
+    for (const auto &entry: value.toArray())
+        list.append(entry.toString());
+
+    return list;
+}
+
+ModInfo fromCbor(const QString &file, const QCborMap &map)
+{
+    ModInfo mod;
+    mod.file = file;
+    mod.size = map.value("size").toInteger();
+    mod.modified = map.value("modified").toInteger();
+    mod.loader = map.value("loader").toString();
+    mod.id = map.value("id").toString();
+    mod.version = map.value("version").toString();
+    mod.name = map.value("name").toString();
+    mod.provides = toStringList(map.value("provides"));
+    mod.depends = toStringList(map.value("depends"));
+
+    return mod;
+}
+
+// `modId="examplemod" #mandatory`, like every line of the Forge MDK template. A # inside a string is no comment
+QString stripComment(const QString &line)
+{
+    QChar quote;
+
+    for (qsizetype i = 0; i < line.size(); ++i) {
+        const auto c = line[i];
+
+        if (!quote.isNull()) {
+            if (c == '\\' && quote == '"')
+                ++i; // escaped, only basic strings have escapes
+            else if (c == quote)
+                quote = {};
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '#') {
+            return line.left(i).trimmed();
+        }
+    }
+
+    return line.trimmed();
+}
+
+QString unquote(const QString &rawValue)
+{
+    const auto value = stripComment(rawValue);
+
+    if (value.size() >= 2 && (value.startsWith('"') || value.startsWith('\'')) && value.endsWith(value.front()))
+        return value.mid(1, value.size() - 2);
+
+    return value;
+}
+
+// the wanted entries of an opened archive, by name. Jars nested under META-INF/jars/ come along, fabric
+// only knows which of them are mods once fabric.mod.json is parsed
+QHash<QString, QByteArray> readEntries(archive *a, const QStringList &wanted)
+{
+    QHash<QString, QByteArray> entries;
+
+    archive_entry *entry;
+    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        const auto name = QString::fromUtf8(archive_entry_pathname(entry));
+        if (!wanted.contains(name) && !(name.startsWith("META-INF/jars/") && name.endsWith(".jar"))) {
+            archive_read_data_skip(a);
+            continue;
+        }
+
+        QByteArray data;
+        char buffer[16384];
+        la_ssize_t bytes;
+        while ((bytes = archive_read_data(a, buffer, sizeof(buffer))) > 0)
+            data.append(buffer, bytes);
+
+        entries.insert(name, data);
+    }
+
+    return entries;
+}
+
+} // namespace
+
+QList<ModInfo> ModIndexer::scan(const QString &modsDirectory)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QCborMap index;
+    if (QFile file{indexPath(modsDirectory)}; file.open(QFile::ReadOnly)) {
+        const auto stored = QCborValue::fromCbor(file.readAll()).toMap();
+        if (stored.value("format").toInteger() == IndexFormat)
+            index = stored.value("mods").toMap();
+    }
+
+    const QDir dir{modsDirectory};
+
+    QList<ModInfo> mods;
+    QStringList changed;
+
+    for (const auto &jar: dir.entryInfoList({"*.jar"}, QDir::Files, QDir::Name)) {
+        const auto cached = index.value(jar.fileName()).toMap();
+
+        if (!cached.isEmpty() && cached.value("size").toInteger() == jar.size()
+            && cached.value("modified").toInteger() == jar.lastModified().toMSecsSinceEpoch()) {
+            mods.append(fromCbor(jar.fileName(), cached));
+            continue;
+        }
+
+        changed.append(jar.absoluteFilePath());
+    }
+
+    // opening a jar is mostly waiting for the disk, so every core gets its share
+    const auto rescanned = QtConcurrent::blockingMapped<QList<ModInfo>>(changed, &ModIndexer::read);
+    mods.append(rescanned);
+
+    std::sort(mods.begin(), mods.end(), [](const ModInfo &lhs, const ModInfo &rhs) { return lhs.file < rhs.file; });
+
+    // removed jars disappear from the index too
+    if (!rescanned.isEmpty() || index.size() != mods.size()) {
+        QCborMap updated;
+        for (const auto &mod: std::as_const(mods))
+            updated.insert(mod.file, toCbor(mod));
+
+        QDir{}.mkpath(QFileInfo{indexPath(modsDirectory)}.absolutePath());
+
+        QSaveFile file{indexPath(modsDirectory)};
+        if (file.open(QFile::WriteOnly)) {
+            file.write(QCborValue{QCborMap{{"format", IndexFormat}, {"mods", updated}}}.toCbor());
+            file.commit();
+        } else {
+            qCWarning(lcMods, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        }
+    }
+
+    qCInfo(lcMods, "indexed %lli mods in %ls, %lli rescanned in %lli ms",
+           mods.size(), qUtf16Printable(modsDirectory), rescanned.size(), timer.elapsed());
+
+    return mods;
+}
+
+QHash<QString, QStringList> ModIndexer::duplicates(const QList<ModInfo> &mods)
+{
+    QHash<QString, QStringList> providers;
+    for (const auto &mod: mods) {
+        if (!mod.id.isEmpty())
+            providers[mod.id].append(mod.file);
+
+        for (const auto &id: mod.provides)
+            providers[id].append(mod.file);
+    }
+
+    for (auto it = providers.begin(); it != providers.end();) {
+        if (it->size() < 2)
+            it = providers.erase(it);
+        else
+            ++it;
+    }
+
+    return providers;
+}
+
+QHash<QString, QStringList> ModIndexer::missingDependencies(const QList<ModInfo> &mods)
+{
+    QSet<QString> provided{PlatformIds.begin(), PlatformIds.end()};
+    for (const auto &mod: mods) {
+        provided.insert(mod.id);
+        for (const auto &id: mod.provides)
+            provided.insert(id);
+    }
+
+    QHash<QString, QStringList> missing;
+    for (const auto &mod: mods) {
+        for (const auto &id: mod.depends) {
+            if (!provided.contains(id))
+                missing[id].append(mod.file);
+        }
+    }
+
+    return missing;
+}
+
+ModInfo ModIndexer::read(const QString &path)
+{
+    const QFileInfo jar{path};
+
+    ModInfo mod;
+    mod.file = jar.fileName();
+    mod.size = jar.size();
+    mod.modified = jar.lastModified().toMSecsSinceEpoch();
+
+    archive *a = archive_read_new();
+
+    // seekable: entries come from the central directory, so skipping one doesn't inflate it
+    archive_read_support_format_zip_seekable(a);
+
+    if (archive_read_open_filename(a, QFile::encodeName(path).constData(), 65536) != ARCHIVE_OK) {
+        qCWarning(lcMods, "cannot read %ls: %s", qUtf16Printable(path), archive_error_string(a));
+        archive_read_free(a);
+        return mod;
+    }
+
+    const auto entries = readEntries(a, {"fabric.mod.json", "quilt.mod.json", "META-INF/mods.toml", "META-INF/neoforge.mods.toml", "META-INF/MANIFEST.MF"});
+    archive_read_free(a);
+
+    traceDebug(tcMods, "read %1: %2", path, entries.keys().join(", "));
+
+    // a jar may carry metadata for several loaders, the native one of the loader wins
+    if (entries.contains("quilt.mod.json")) {
+        parseQuilt(mod, entries["quilt.mod.json"]);
+    } else if (entries.contains("fabric.mod.json")) {
+        parseFabric(mod, entries["fabric.mod.json"], entries);
+    } else if (entries.contains("META-INF/neoforge.mods.toml")) {
+        parseModsToml(mod, entries["META-INF/neoforge.mods.toml"], entries.value("META-INF/MANIFEST.MF"));
+        mod.loader = "neoforge";
+    } else if (entries.contains("META-INF/mods.toml")) {
+        parseModsToml(mod, entries["META-INF/mods.toml"], entries.value("META-INF/MANIFEST.MF"));
+        mod.loader = "forge";
+    }
+
+    return mod;
+}
+
+void ModIndexer::parseFabric(ModInfo &mod, const QByteArray &data, const QHash<QString, QByteArray> &entries)
+{
+    const auto json = QJsonDocument::fromJson(data).object();
+
+    mod.loader = "fabric";
+    mod.id = json["id"].toString();
+    mod.version = json["version"].toString();
+    mod.name = json["name"].toString(mod.id);
+    mod.provides = json["provides"].toVariant().toStringList();
+    mod.depends = json["depends"].toObject().keys();
+
+    // i.e. fabric-api is a jar of jars, each module (fabric-api-base, ...) has an id of its own others depend on
+    for (const auto &nested: json["jars"].toArray()) {
+        const auto file = nested.toObject()["file"].toString();
+        if (entries.contains(file))
+            mod.provides.append(readNested(entries[file]));
+    }
+}
+
+QStringList ModIndexer::readNested(const QByteArray &jar)
+{
+    archive *a = archive_read_new();
+    archive_read_support_format_zip(a);
+
+    if (archive_read_open_memory(a, jar.constData(), jar.size()) != ARCHIVE_OK) {
+        archive_read_free(a);
+        return {};
+    }
+
+    const auto entries = readEntries(a, {"fabric.mod.json"});
+    archive_read_free(a);
+
+    if (!entries.contains("fabric.mod.json"))
+        return {};
+
+    // nested jars nest jars too, each level is smaller than the one containing it
+    ModInfo nested;
+    parseFabric(nested, entries["fabric.mod.json"], entries);
+
+    if (!nested.id.isEmpty())
+        nested.provides.prepend(nested.id);
+
+    return nested.provides;
+}
+
+void ModIndexer::parseQuilt(ModInfo &mod, const QByteArray &data)
+{
+    const auto loader = QJsonDocument::fromJson(data).object()["quilt_loader"].toObject();
+
+    mod.loader = "quilt";
+    mod.id = loader["id"].toString();
+    mod.version = loader["version"].toString();
+    mod.name = loader["metadata"]["name"].toString(mod.id);
+
+    // either plain ids or objects, which may be optional
+    for (const auto &provide: loader["provides"].toArray())
+        mod.provides.append(provide.isObject() ? provide.toObject()["id"].toString() : provide.toString());
+
+    for (const auto &depend: loader["depends"].toArray()) {
+        if (depend.isObject() && depend.toObject()["optional"].toBool())
+            continue;
+
+        mod.depends.append(depend.isObject() ? depend.toObject()["id"].toString() : depend.toString());
+    }
+}
+
+void ModIndexer::parseModsToml(ModInfo &mod, const QByteArray &data, const QByteArray &manifest)
+{
+    // only the few keys we need: [[mods]] modId/version/displayName and [[dependencies.<id>]] modId/mandatory/type.
+    // Everything else, multi-line strings included, is skipped
+    enum class Section { Other, Mod, Dependency } section = Section::Other;
+
+    QString dependency;
+    bool required = false;
+    bool inMultiline = false;
+
+    const auto finishDependency = [&]() {
+        if (section == Section::Dependency && required && !dependency.isEmpty())
+            mod.depends.append(dependency);
+
+        dependency.clear();
+        required = false;
+    };
+
+    for (const auto &rawLine: QString::fromUtf8(data).split('\n')) {
+        if (rawLine.count("\"\"\"") % 2 == 1 || rawLine.count("'''") % 2 == 1)
+            inMultiline = !inMultiline;
+
+        const auto line = stripComment(rawLine);
+        if (inMultiline || line.isEmpty())
+            continue;
+
+        if (line.startsWith('[')) {
+            finishDependency();
+
+            if (line == "[[mods]]")
+                section = Section::Mod;
+            else if (line.startsWith("[[dependencies."))
+                section = Section::Dependency;
+            else
+                section = Section::Other;
+
+            continue;
+        }
+
+        const auto key = line.section('=', 0, 0).trimmed();
+        const auto value = unquote(line.section('=', 1, -1));
+
+        if (section == Section::Mod) {
+            // later [[mods]] entries of the same jar are just more ids it provides
+            if (key == "modId") {
+                if (mod.id.isEmpty())
+                    mod.id = value;
+                else
+                    mod.provides.append(value);
+            } else if (key == "version" && mod.version.isEmpty()) {
+                mod.version = value;
+            } else if (key == "displayName" && mod.name.isEmpty()) {
+                mod.name = value;
+            }
+        } else if (section == Section::Dependency) {
+            if (key == "modId")
+                dependency = value;
+            else if ((key == "mandatory" && value == "true") || (key == "type" && value == "required"))
+                required = true;
+        }
+    }
+
+    finishDependency();
+
+    // filled in by the build from the jar's manifest
+    if (mod.version == "${file.jarVersion}") {
+        static const QRegularExpression implementationVersion{"^Implementation-Version:\\s*(\\S+)", QRegularExpression::MultilineOption};
+        mod.version = implementationVersion.match(QString::fromUtf8(manifest)).captured(1);
+    }
+
+    if (mod.name.isEmpty())
+        mod.name = mod.id;
+}
+
+QString ModIndexer::indexPath(const QString &modsDirectory)
+{
+    const auto directory = QFileInfo{modsDirectory}.canonicalFilePath().toUtf8();
+    const auto key = QCryptographicHash::hash(directory, QCryptographicHash::Sha1).toHex().left(16);
+
+    return QString("%1/cache/mods/%2.cbor").arg(Config::instance()->getConfig("mcRoot").toString(), QString::fromLatin1(key));
+}
+
+} // namespace randomly
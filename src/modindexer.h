@@ -0,0 +1,49 @@
+#ifndef MODINDEXER_H
+#define MODINDEXER_H
+
+#include <QHash>
+#include <QStringList>
+
+namespace randomly {
+
+struct ModInfo
+{
+    QString file; // relative to the mods directory
+    qint64 size = 0;
+    qint64 modified = 0; // ms since epoch
+
+    QString loader; // fabric, quilt, forge or neoforge. Empty for jars without metadata we know
+    QString id;
+    QString version;
+    QString name;
+    QStringList provides; // further ids the jar satisfies dependencies on
+    QStringList depends;  // required ids only
+};
+
+// reads the metadata of every jar in a mods directory. Only the metadata entries are inflated, the rest of a
+// jar is skipped using its central directory. The result is kept in cache/mods, keyed by size and mtime,
+// so a rescan only opens jars that changed
+class ModIndexer
+{
+public:
+    static QList<ModInfo> scan(const QString &modsDirectory);
+
+    // ids provided by more than one jar -> those jars
+    static QHash<QString, QStringList> duplicates(const QList<ModInfo> &mods);
+
+    // required ids no jar provides -> the jars requiring them. The game, java and the loaders don't count
+    static QHash<QString, QStringList> missingDependencies(const QList<ModInfo> &mods);
+
+private:
+    static ModInfo read(const QString &path);
+    static void parseFabric(ModInfo &mod, const QByteArray &data, const QHash<QString, QByteArray> &entries);
+    static QStringList readNested(const QByteArray &jar); // the ids a jar inside a fabric mod provides
+    static void parseQuilt(ModInfo &mod, const QByteArray &data);
+    static void parseModsToml(ModInfo &mod, const QByteArray &data, const QByteArray &manifest);
+
+    static QString indexPath(const QString &modsDirectory);
+};
+
+} // namespace randomly
+
+#endif // MODINDEXER_H
@@ -0,0 +1,379 @@
+#include "modrinthpackinstaller.h"
+
+#include "config.h"
+#include "downloader.h"
+#include "instancestore.h"
+#include "tracelog.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcModrinth, "randomly.MyLauncher.Modrinth")
+
+constexpr auto tcModrinth = "randomly.MyLauncher.Modrinth";
+
+constexpr auto IndexName = "modrinth.index.json";
+constexpr auto Overrides = "overrides/";
+constexpr auto ClientOverrides = "client-overrides/"; // take precedence over the normal ones
+
+bool matchesSha1(const QString &path, const QString &expected)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    sha1.addData(&file);
+
+    return sha1.result().toHex() == expected.toLatin1();
+}
+
+} // namespace
+
+ModrinthPackInstaller::ModrinthPackInstaller(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads}
+{}
+
+bool ModrinthPackInstaller::install(const QString &packPath)
+{
+    QByteArray indexData;
+    if (!readIndex(packPath, indexData))
+        return false;
+
+    const auto index = QJsonDocument::fromJson(indexData).object();
+
+    if (index["game"].toString() != "minecraft" || index["formatVersion"].toInt() != 1) {
+        qCWarning(lcModrinth, "%ls is not a supported modpack", qUtf16Printable(packPath));
+        return false;
+    }
+
+    // names the instance, so it has to come before anything is put into its game directory
+    if (!writeVersionJson(index))
+        return false;
+
+    qCInfo(lcModrinth, "installing %ls as %ls", qUtf16Printable(index["name"].toString()), qUtf16Printable(m_versionId));
+
+    if (!extractOverrides(packPath))
+        return false;
+
+    scheduleFiles(index["files"].toArray());
+    return true;
+}
+
+archive *ModrinthPackInstaller::openPack(const QString &packPath)
+{
+    // seekable: entries we don't want are skipped via the central directory instead of being read
+    archive *pack = archive_read_new();
+    archive_read_support_format_zip_seekable(pack);
+
+    if (archive_read_open_filename(pack, QFile::encodeName(packPath).constData(), 64 * 1024) != ARCHIVE_OK) {
+        qCWarning(lcModrinth, "cannot open %ls: %s", qUtf16Printable(packPath), archive_error_string(pack));
+        archive_read_free(pack);
+        return nullptr;
+    }
+
+    return pack;
+}
+
+bool ModrinthPackInstaller::readIndex(const QString &packPath, QByteArray &index)
+{
+    auto pack = openPack(packPath);
+    if (!pack)
+        return false;
+
+    archive_entry *entry;
+    int r;
+    while ((r = archive_read_next_header(pack, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) {
+        if (QString::fromUtf8(archive_entry_pathname(entry)) != IndexName)
+            continue;
+
+        const void *buffer;
+        size_t size;
+        la_int64_t offset;
+
+        while (archive_read_data_block(pack, &buffer, &size, &offset) == ARCHIVE_OK)
+            index.append(static_cast<const char *>(buffer), size);
+
+        break;
+    }
+
+    archive_read_free(pack);
+
+    if (index.isEmpty()) {
+        qCWarning(lcModrinth, "%ls has no %s", qUtf16Printable(packPath), IndexName);
+        return false;
+    }
+
+    return true;
+}
+
+bool ModrinthPackInstaller::extractOverrides(const QString &packPath)
+{
+    auto pack = openPack(packPath);
+    if (!pack)
+        return false;
+
+    const auto gameDir = QDir{InstanceStore::gameDirectory(m_versionId)};
+    QSet<QString> clientOverrides;
+
+    // the overrides go straight to disk, everything else is skipped without ever being decompressed
+    archive_entry *entry;
+    int r;
+    while ((r = archive_read_next_header(pack, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) {
+        const auto name = QString::fromUtf8(archive_entry_pathname(entry));
+
+        const bool isClientOverride = name.startsWith(ClientOverrides);
+        if (!isClientOverride && !name.startsWith(Overrides))
+            continue;
+
+        const auto relativePath = name.mid(isClientOverride ? qstrlen(ClientOverrides) : qstrlen(Overrides));
+        if (relativePath.isEmpty())
+            continue;
+
+        if (!isSafeRelativePath(relativePath)) {
+            qCWarning(lcModrinth, "skipping override with unsafe path %ls", qUtf16Printable(name));
+            continue;
+        }
+
+        if (archive_entry_filetype(entry) == AE_IFDIR) {
+            gameDir.mkpath(relativePath);
+            continue;
+        }
+
+        // a link could point anywhere, i.e. out of the game directory for the next entry written through it.
+        // Packs have no reason to ship one, so they are left out instead of becoming a file holding the target
+        if (archive_entry_filetype(entry) != AE_IFREG) {
+            qCWarning(lcModrinth, "skipping override %ls, it isn't a regular file", qUtf16Printable(name));
+            continue;
+        }
+
+        // client-overrides may have been written already if they came first in the zip
+        if (isClientOverride)
+            clientOverrides.insert(relativePath);
+        else if (clientOverrides.contains(relativePath))
+            continue;
+
+        // an instance missing some of its configs would only fail once the game runs
+        if (!extractEntry(pack, gameDir.absoluteFilePath(relativePath))) {
+            archive_read_free(pack);
+            return false;
+        }
+    }
+
+    const bool ok = r == ARCHIVE_EOF;
+    if (!ok)
+        qCWarning(lcModrinth, "error while reading %ls: %s", qUtf16Printable(packPath), archive_error_string(pack));
+
+    archive_read_free(pack);
+    return ok;
+}
+
+bool ModrinthPackInstaller::extractEntry(archive *pack, const QString &target)
+{
+    QDir{}.mkpath(QFileInfo{target}.absolutePath());
+
+    // renamed into place: a clone shares mods and resourcepacks with its template through hardlinks, writing into
+    // the existing file would change the template and every other clone too
+    QSaveFile output{target};
+    if (!output.open(QFile::WriteOnly)) {
+        qCWarning(lcModrinth, "cannot open %ls: %ls", qUtf16Printable(target), qUtf16Printable(output.errorString()));
+        return false;
+    }
+
+    traceDebug(tcModrinth, "extracting override %1", target);
+
+    const void *buffer;
+    size_t size;
+    la_int64_t offset;
+
+    int r;
+    while ((r = archive_read_data_block(pack, &buffer, &size, &offset)) == ARCHIVE_OK) {
+        if (output.write(static_cast<const char *>(buffer), size) != qint64(size))
+            break;
+    }
+
+    if (r != ARCHIVE_EOF) {
+        qCWarning(lcModrinth, "cannot extract %ls: %ls", qUtf16Printable(target),
+                  qUtf16Printable(r == ARCHIVE_OK ? output.errorString() : QString::fromUtf8(archive_error_string(pack))));
+        output.cancelWriting();
+        return false;
+    }
+
+    if (!output.commit()) {
+        qCWarning(lcModrinth, "cannot extract %ls: %ls", qUtf16Printable(target), qUtf16Printable(output.errorString()));
+        return false;
+    }
+
+    return true;
+}
+
+void ModrinthPackInstaller::scheduleFiles(const QJsonArray &files)
+{
+    const auto gameDir = QDir{InstanceStore::gameDirectory(m_versionId)};
+
+    QList<QPair<DownloadInfo, QStringList>> missing;
+
+    m_filesTotal = 0;
+    m_filesDone = 0;
+    m_filesFailed = 0;
+
+    for (const auto &value: files) {
+        const auto file = value.toObject();
+
+        if (file["env"]["client"].toString() == "unsupported")
+            continue; // server-only mod
+
+        const auto path = file["path"].toString();
+        if (!isSafeRelativePath(path)) {
+            qCWarning(lcModrinth, "skipping file with unsafe path %ls", qUtf16Printable(path));
+            continue;
+        }
+
+        ++m_filesTotal;
+
+        DownloadInfo info;
+        info.path = gameDir.absoluteFilePath(path);
+        info.size = file["fileSize"].toInteger();
+        info.sha1 = file["hashes"]["sha1"].toString();
+        info.sha512 = file["hashes"]["sha512"].toString();
+        info.transferClass = TransferClass::Modpacks;
+
+        // left over from installing an earlier version of the pack
+        if (QFileInfo{info.path}.size() == info.size && matchesSha1(info.path, info.sha1)) {
+            ++m_filesDone;
+            continue;
+        }
+
+        missing.append({info, file["downloads"].toVariant().toStringList()});
+    }
+
+    qCInfo(lcModrinth) << m_filesDone << "files up to date," << missing.size() << "to download";
+    emit progress(m_filesDone, m_filesTotal);
+
+    // everything is queued at once, the transfers run in parallel
+    for (const auto &[info, mirrors]: std::as_const(missing))
+        downloadFile(info, mirrors);
+
+    checkFinished();
+}
+
+void ModrinthPackInstaller::downloadFile(DownloadInfo info, QStringList mirrors)
+{
+    if (mirrors.isEmpty()) {
+        qCWarning(lcModrinth, "no working download for %ls", qUtf16Printable(info.path));
+        ++m_filesFailed;
+        checkFinished();
+        return;
+    }
+
+    info.url = mirrors.takeFirst();
+
+    m_downloads->download(info, [this, mirrors](const DownloadInfo &info, bool success) {
+        if (!success) {
+            downloadFile(info, mirrors); // try the next mirror
+            return;
+        }
+
+        ++m_filesDone;
+        emit progress(m_filesDone, m_filesTotal);
+        checkFinished();
+    });
+}
+
+void ModrinthPackInstaller::checkFinished()
+{
+    if (m_filesDone + m_filesFailed == m_filesTotal)
+        emit finished(m_filesFailed == 0, m_versionId);
+}
+
+QString ModrinthPackInstaller::versionIdOf(const QString &packPath)
+{
+    QByteArray index;
+    if (!readIndex(packPath, index))
+        return {};
+
+    return versionIdFor(QJsonDocument::fromJson(index).object());
+}
+
+QString ModrinthPackInstaller::versionIdFor(const QJsonObject &index)
+{
+    static const QRegularExpression invalidCharacters{"[^A-Za-z0-9._-]+"};
+
+    auto id = QString("%1-%2").arg(index["name"].toString(), index["versionId"].toString());
+    return id.replace(invalidCharacters, "-");
+}
+
+bool ModrinthPackInstaller::writeVersionJson(const QJsonObject &index)
+{
+    m_versionId = versionIdFor(index);
+
+    // everything else (libraries, arguments, main class, ...) comes from the loader/vanilla version
+    const QJsonObject version{
+        {"id", m_versionId},
+        {"inheritsFrom", inheritedVersion(index["dependencies"].toObject())},
+        {"type", "modpack"},
+        {"time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+        {"releaseTime", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+    };
+
+    const auto path = QString("%1/versions/%2/%2.json").arg(Config::instance()->getConfig("mcRoot").toString(), m_versionId);
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile output{path};
+    if (!output.open(QFile::WriteOnly)) {
+        qCWarning(lcModrinth, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(output.errorString()));
+        return false;
+    }
+
+    output.write(QJsonDocument{version}.toJson());
+    return output.commit();
+}
+
+QString ModrinthPackInstaller::inheritedVersion(const QJsonObject &dependencies)
+{
+    const auto minecraft = dependencies["minecraft"].toString();
+
+    // named the way the respective installers name their versions
+    if (dependencies.contains("fabric-loader"))
+        return QString("fabric-loader-%1-%2").arg(dependencies["fabric-loader"].toString(), minecraft);
+
+    if (dependencies.contains("quilt-loader"))
+        return QString("quilt-loader-%1-%2").arg(dependencies["quilt-loader"].toString(), minecraft);
+
+    if (dependencies.contains("forge"))
+        return QString("%1-forge-%2").arg(minecraft, dependencies["forge"].toString());
+
+    if (dependencies.contains("neoforge"))
+        return QString("neoforge-%1").arg(dependencies["neoforge"].toString());
+
+    return minecraft;
+}
+
+bool ModrinthPackInstaller::isSafeRelativePath(const QString &path)
+{
+    // the format forbids leaving the game directory, but we don't trust random zips
+    if (path.isEmpty() || QDir::isAbsolutePath(path) || path.contains('\\') || path.contains(':'))
+        return false;
+
+    const auto clean = QDir::cleanPath(path);
+    return clean != ".." && !clean.startsWith("../");
+}
+
+} // namespace randomly
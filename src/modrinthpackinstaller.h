@@ -0,0 +1,59 @@
+#ifndef MODRINTHPACKINSTALLER_H
+#define MODRINTHPACKINSTALLER_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QObject>
+
+struct archive;
+
+namespace randomly {
+
+class Downloader;
+struct DownloadInfo;
+
+// installs a Modrinth modpack (.mrpack): all files are downloaded in parallel, the overrides are
+// streamed out of the zip, and a version json inheriting from the pack's loader is generated
+class ModrinthPackInstaller : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModrinthPackInstaller(Downloader *downloads, QObject *parent = nullptr);
+
+    // returns false if the pack can't be read. Downloads continue in the background, see finished()
+    bool install(const QString &packPath);
+
+    QString versionId() const { return m_versionId; }
+
+    // what install() would name the instance, without touching anything. Empty if the pack can't be read
+    static QString versionIdOf(const QString &packPath);
+
+signals:
+    void progress(int filesDone, int filesTotal);
+    void finished(bool success, const QString &versionId);
+
+private:
+    static archive *openPack(const QString &packPath);
+    static bool readIndex(const QString &packPath, QByteArray &index);
+    bool extractOverrides(const QString &packPath);
+    bool extractEntry(archive *pack, const QString &target);
+    void scheduleFiles(const QJsonArray &files);
+    void downloadFile(DownloadInfo info, QStringList mirrors);
+    void checkFinished();
+    bool writeVersionJson(const QJsonObject &index);
+
+    static QString versionIdFor(const QJsonObject &index);
+    static QString inheritedVersion(const QJsonObject &dependencies);
+    static bool isSafeRelativePath(const QString &path);
+
+    Downloader *m_downloads;
+
+    QString m_versionId;
+    int m_filesTotal = 0;
+    int m_filesDone = 0;
+    int m_filesFailed = 0;
+};
+
+} // namespace randomly
+
+#endif // MODRINTHPACKINSTALLER_H
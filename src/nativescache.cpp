@@ -0,0 +1,215 @@
+#include "nativescache.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCborArray>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcNatives, "randomly.MyLauncher.Natives")
+
+constexpr auto tcNatives = "randomly.MyLauncher.Natives";
+
+bool isExcluded(const QString &name, const QStringList &excludes)
+{
+    for (const auto &exclude: excludes) {
+        if (name.startsWith(exclude))
+            return true;
+    }
+
+    return false;
+}
+
+} // namespace
+
+QString NativesCache::key(const QString &archiveSha1, const QStringList &excludes)
+{
+    if (excludes.isEmpty())
+        return archiveSha1;
+
+    auto sorted = excludes;
+    sorted.sort();
+
+    const auto excludeHash = QCryptographicHash::hash(sorted.join('\n').toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QString("%1-%2").arg(archiveSha1, QString::fromLatin1(excludeHash.left(8)));
+}
+
+bool NativesCache::isComplete(const QString &key)
+{
+    return QFileInfo::exists(markerPath(key));
+}
+
+bool NativesCache::extract(const QString &archivePath, const QString &key, const QStringList &excludes)
+{
+    traceInfo(tcNatives, "extracting native %1", archivePath);
+
+    QFile::remove(markerPath(key));
+
+    // extracted next to the entry and only moved in place once complete
+    const QDir partial{entryDirectory(key) + ".partial"};
+    partial.removeRecursively();
+    partial.mkpath(".");
+
+    archive *a = archive_read_new();
+    archive_read_support_format_all(a);
+    archive_read_support_filter_all(a);
+
+    if (archive_read_open_filename(a, QFile::encodeName(archivePath).constData(), 16384) != ARCHIVE_OK) {
+        qCWarning(lcNatives, "unable to read archive %ls: %s", qUtf16Printable(archivePath), archive_error_string(a));
+        archive_read_free(a);
+        return false;
+    }
+
+    QCborArray files;
+    bool ok = true;
+
+    archive_entry *entry;
+    while (ok) {
+        const auto r = archive_read_next_header(a, &entry);
+        if (r == ARCHIVE_EOF)
+            break;
+
+        if (r < ARCHIVE_WARN) {
+            qCWarning(lcNatives, "cannot read %ls: %s", qUtf16Printable(archivePath), archive_error_string(a));
+            ok = false;
+            break;
+        }
+
+        const auto name = QString::fromUtf8(archive_entry_pathname(entry));
+        const auto relativePath = QDir::cleanPath(name);
+
+        if (archive_entry_filetype(entry) != AE_IFREG || isExcluded(name, excludes))
+            continue;
+
+        if (QDir::isAbsolutePath(relativePath) || relativePath.startsWith(".."))
+            continue;
+
+        const auto dest = partial.absoluteFilePath(relativePath);
+        partial.mkpath(QFileInfo{dest}.absolutePath());
+
+        traceDebug(tcNatives, "inflating %1", dest);
+
+        QFile output{dest};
+        if (!output.open(QFile::WriteOnly)) {
+            qCWarning(lcNatives, "cannot open %ls: %ls", qUtf16Printable(dest), qUtf16Printable(output.errorString()));
+            ok = false;
+            break;
+        }
+
+        while (true) {
+            const void *buffer;
+            size_t size;
+            la_int64_t offset;
+
+            const auto block = archive_read_data_block(a, &buffer, &size, &offset);
+            if (block == ARCHIVE_EOF)
+                break;
+
+            if (block < ARCHIVE_WARN || output.write(static_cast<const char *>(buffer), size) != qint64(size)) {
+                qCWarning(lcNatives, "cannot extract %ls from %ls", qUtf16Printable(name), qUtf16Printable(archivePath));
+                ok = false;
+                break;
+            }
+        }
+
+        files.append(relativePath);
+    }
+
+    archive_read_free(a);
+
+    if (!ok) {
+        partial.removeRecursively();
+        return false;
+    }
+
+    QDir{entryDirectory(key)}.removeRecursively();
+    if (!QDir{}.rename(partial.absolutePath(), entryDirectory(key))) {
+        qCWarning(lcNatives, "cannot move natives to %ls", qUtf16Printable(entryDirectory(key)));
+        return false;
+    }
+
+    // the marker lists what was extracted, it's written last so its existence means the entry is whole
+    QSaveFile marker{markerPath(key)};
+    if (!marker.open(QFile::WriteOnly)) {
+        qCWarning(lcNatives, "cannot write %ls: %ls", qUtf16Printable(marker.fileName()), qUtf16Printable(marker.errorString()));
+        return false;
+    }
+
+    marker.write(QCborValue{files}.toCbor());
+    return marker.commit();
+}
+
+bool NativesCache::link(const QString &key, const QString &nativesDirectory)
+{
+    const QDir source{entryDirectory(key)};
+    const QDir target{nativesDirectory};
+
+    bool ok = true;
+
+    for (const auto &relativePath: entryFiles(key)) {
+        const auto from = source.absoluteFilePath(relativePath);
+        const auto to = target.absoluteFilePath(relativePath);
+
+        // already linked by an earlier launch
+        if (QFileInfo{to}.size() == QFileInfo{from}.size())
+            continue;
+
+        QFile::remove(to);
+        target.mkpath(QFileInfo{to}.absolutePath());
+
+#ifdef Q_OS_UNIX
+        if (::link(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0)
+            continue;
+#endif
+
+        // i.e. bin/ is on another filesystem than cache/
+        if (!QFile::copy(from, to)) {
+            qCWarning(lcNatives, "cannot link %ls", qUtf16Printable(to));
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+QString NativesCache::entryDirectory(const QString &key)
+{
+    return QString("%1/cache/natives/%2").arg(Config::instance()->getConfig("mcRoot").toString(), key);
+}
+
+QString NativesCache::markerPath(const QString &key)
+{
+    return entryDirectory(key) + ".cbor";
+}
+
+QStringList NativesCache::entryFiles(const QString &key)
+{
+    QFile marker{markerPath(key)};
+    if (!marker.open(QFile::ReadOnly))
+        return {};
+
+    QStringList files;
+    for (const auto &file: QCborValue::fromCbor(marker.readAll()).toArray())
+        files.append(file.toString());
+
+    return files;
+}
+
+} // namespace randomly
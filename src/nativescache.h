@@ -0,0 +1,32 @@
+#ifndef NATIVESCACHE_H
+#define NATIVESCACHE_H
+
+#include <QStringList>
+
+namespace randomly {
+
+// native archives extracted once to cache/natives/<key>, shared by every version using the same archive.
+// A version's natives directory only holds links into it
+class NativesCache
+{
+public:
+    // the archive's sha1, plus whatever the version excludes from extraction, since that changes the result
+    static QString key(const QString &archiveSha1, const QStringList &excludes);
+
+    // only true once an extraction ran to the end, an interrupted one is redone
+    static bool isComplete(const QString &key);
+
+    static bool extract(const QString &archivePath, const QString &key, const QStringList &excludes);
+
+    // links everything extracted for `key` into nativesDirectory
+    static bool link(const QString &key, const QString &nativesDirectory);
+
+private:
+    static QString entryDirectory(const QString &key);
+    static QString markerPath(const QString &key);
+    static QStringList entryFiles(const QString &key);
+};
+
+} // namespace randomly
+
+#endif // NATIVESCACHE_H
@@ -0,0 +1,155 @@
+#include "pagecacheprefetcher.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QtConcurrent>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcPrefetch, "randomly.MyLauncher.Prefetch")
+
+constexpr auto tcPrefetch = "randomly.MyLauncher.Prefetch";
+
+constexpr qint64 MiB = 1024 * 1024;
+constexpr int DefaultMemoryShare = 50; // percent
+
+qint64 availableMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile meminfo{"/proc/meminfo"};
+    if (!meminfo.open(QFile::ReadOnly))
+        return 0;
+
+    // "MemAvailable:    8123456 kB", what can be used without swapping, page cache that can be dropped included
+    for (const auto &line: meminfo.readAll().split('\n')) {
+        if (line.startsWith("MemAvailable:"))
+            return line.mid(13).trimmed().split(' ').first().toLongLong() * 1024;
+    }
+#endif
+
+    return 0;
+}
+
+} // namespace
+
+QFuture<PrefetchResult> PageCachePrefetcher::prefetch(const QStringList &files)
+{
+    // mmap + touching every page is slower, but some network filesystems ignore readahead hints
+    const auto touch = Config::instance()->getConfig("prefetch_mode").toString() == "touch";
+
+    return QtConcurrent::run(&PageCachePrefetcher::run, files, budget(), touch);
+}
+
+qint64 PageCachePrefetcher::budget()
+{
+    auto cfg = Config::instance();
+
+    auto share = cfg->getConfig("prefetch_memory_share").toInt();
+    if (share <= 0)
+        share = DefaultMemoryShare;
+
+    auto budget = availableMemory() * std::min(share, 100) / 100;
+
+    if (const auto cap = cfg->getConfig("prefetch_budget").toLongLong(); cap > 0)
+        budget = budget > 0 ? std::min(budget, cap * MiB) : cap * MiB;
+
+    return budget;
+}
+
+PrefetchResult PageCachePrefetcher::run(const QStringList &files, qint64 budget, bool touch)
+{
+    PrefetchResult result;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (const auto &path: files) {
+        const QFileInfo file{path};
+        const auto size = file.size();
+
+        // the rest would only push out what we just read
+        if (result.bytes + size > budget) {
+            ++result.skipped;
+            continue;
+        }
+
+        if (!prefetchFile(file.canonicalFilePath(), size, touch)) {
+            ++result.skipped;
+            continue;
+        }
+
+        ++result.files;
+        result.bytes += size;
+    }
+
+    result.elapsed = timer.elapsed();
+
+    qCInfo(lcPrefetch, "prefetched %i files (%lli MiB) in %lli ms, skipped %i",
+           result.files, result.bytes / MiB, result.elapsed, result.skipped);
+
+    return result;
+}
+
+bool PageCachePrefetcher::prefetchFile(const QString &path, qint64 size, bool touch)
+{
+#ifdef Q_OS_LINUX
+    const auto fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (size == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    traceDebug(tcPrefetch, "prefetching %1 (%2 B)", path, size);
+
+    bool ok = true;
+
+    if (touch) {
+        auto mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED) {
+            ::madvise(mapping, size, MADV_WILLNEED);
+
+            // one byte per page is enough to fault it in
+            const auto pageSize = ::sysconf(_SC_PAGESIZE);
+            volatile char sink = 0;
+            for (qint64 offset = 0; offset < size; offset += pageSize)
+                sink = sink + static_cast<const char *>(mapping)[offset];
+
+            ::munmap(mapping, size);
+        } else {
+            ok = false;
+        }
+    } else {
+        // the JVM reads the jars front to back, tell the kernel before it has to guess
+        ::posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+        // may block until the pages are in, so the worker paces itself with the disk
+        ok = ::readahead(fd, 0, size) == 0;
+    }
+
+    ::close(fd);
+    return ok;
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(size);
+    Q_UNUSED(touch);
+    return false;
+#endif
+}
+
+} // namespace randomly
@@ -0,0 +1,36 @@
+#ifndef PAGECACHEPREFETCHER_H
+#define PAGECACHEPREFETCHER_H
+
+#include <QFuture>
+#include <QStringList>
+
+namespace randomly {
+
+struct PrefetchResult
+{
+    int files = 0;
+    qint64 bytes = 0;
+    int skipped = 0;   // over budget or unreadable
+    qint64 elapsed = 0; // ms
+};
+
+// warms the page cache with the files the JVM reads first (classpath, natives, the runtime itself),
+// so the disk does its work while we're still waiting for authentication
+class PageCachePrefetcher
+{
+public:
+    // in order, on a worker thread, until the memory budget is used up
+    static QFuture<PrefetchResult> prefetch(const QStringList &files);
+
+    // share of the currently available memory (`prefetch_memory_share` percent, 50 by default),
+    // capped by `prefetch_budget` MiB if set
+    static qint64 budget();
+
+private:
+    static PrefetchResult run(const QStringList &files, qint64 budget, bool touch);
+    static bool prefetchFile(const QString &path, qint64 size, bool touch);
+};
+
+} // namespace randomly
+
+#endif // PAGECACHEPREFETCHER_H
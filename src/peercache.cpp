@@ -0,0 +1,229 @@
+#include "peercache.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCborMap>
+#include <QCborValue>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QTcpSocket>
+
+#include <memory>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcPeers, "randomly.MyLauncher.Peers")
+
+constexpr auto tcPeers = "randomly.MyLauncher.Peers";
+
+constexpr int DefaultTimeout = 2000; // ms
+constexpr qint64 MaxRequestSize = 16 * 1024;
+constexpr qint64 SendBufferSize = 256 * 1024;
+constexpr qint64 ChunkSize = 64 * 1024;
+
+} // namespace
+
+PeerCache::PeerCache(QObject *parent)
+    : QObject{parent}
+{
+    auto cfg = Config::instance();
+
+    m_peers = cfg->getConfig("peers").toStringList();
+    m_timeout = cfg->getConfig("peer_timeout").toInt();
+    if (m_timeout <= 0)
+        m_timeout = DefaultTimeout;
+
+    load();
+
+    // a prefetch remembers thousands of files, they're written out together
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(5000);
+    connect(&m_saveTimer, &QTimer::timeout, this, &PeerCache::save);
+
+    const auto port = cfg->getConfig("peer_port").toInt();
+    if (port <= 0)
+        return;
+
+    connect(&m_server, &QTcpServer::newConnection, this, &PeerCache::accept);
+
+    if (!m_server.listen(QHostAddress::Any, quint16(port))) {
+        qCWarning(lcPeers, "cannot serve on port %i: %ls", port, qUtf16Printable(m_server.errorString()));
+        return;
+    }
+
+    qCInfo(lcPeers, "serving %lli files on port %i", m_artifacts.size(), port);
+}
+
+PeerCache::~PeerCache()
+{
+    if (m_saveTimer.isActive())
+        save();
+
+    for (const auto &connection: std::as_const(m_connections))
+        delete connection.file;
+}
+
+QUrl PeerCache::peerUrl(int peer, const QString &sha1) const
+{
+    return QUrl{QString("http://%1/sha1/%2").arg(m_peers.at(peer), sha1)};
+}
+
+void PeerCache::remember(const QString &sha1, const QString &path)
+{
+    if (sha1.isEmpty() || m_artifacts.value(sha1) == path)
+        return;
+
+    m_artifacts.insert(sha1, path);
+    m_saveTimer.start();
+}
+
+void PeerCache::accept()
+{
+    while (auto socket = m_server.nextPendingConnection()) {
+        m_connections.insert(socket, {});
+
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            auto &connection = m_connections[socket];
+            connection.request += socket->readAll();
+
+            if (connection.request.size() > MaxRequestSize) {
+                socket->abort();
+                return;
+            }
+
+            handleRequests(socket);
+        });
+
+        connect(socket, &QTcpSocket::bytesWritten, this, [this, socket]() { sendFile(socket); });
+
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            delete m_connections.take(socket).file;
+            socket->deleteLater();
+        });
+    }
+}
+
+void PeerCache::handleRequests(QTcpSocket *socket)
+{
+    auto &connection = m_connections[socket];
+
+    // one at a time, a request coming in while a file is still being sent waits for it
+    while (!connection.file) {
+        const auto end = connection.request.indexOf("\r\n\r\n");
+        if (end < 0)
+            return;
+
+        const auto header = connection.request.left(end);
+        connection.request.remove(0, end + 4);
+
+        // "GET /sha1/<hash> HTTP/1.1", the other headers don't matter
+        const auto requestLine = header.left(header.indexOf("\r\n")).split(' ');
+        const auto method = requestLine.value(0);
+        const auto target = QString::fromLatin1(requestLine.value(1));
+
+        if (method != "GET" && method != "HEAD") {
+            socket->write("HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n");
+            continue;
+        }
+
+        const auto path = target.startsWith("/sha1/") ? lookup(target.mid(6)) : QString();
+
+        auto file = std::make_unique<QFile>(path);
+        if (path.isEmpty() || !file->open(QFile::ReadOnly)) {
+            traceDebug(tcPeers, "%1 not found", target);
+            socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            continue;
+        }
+
+        traceDebug(tcPeers, "serving %1 to %2", path, socket->peerAddress().toString());
+
+        socket->write(QString("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %1\r\n\r\n")
+                          .arg(file->size())
+                          .toLatin1());
+
+        if (method == "GET") {
+            connection.file = file.release();
+            sendFile(socket);
+        }
+    }
+}
+
+void PeerCache::sendFile(QTcpSocket *socket)
+{
+    auto &connection = m_connections[socket];
+    if (!connection.file)
+        return;
+
+    // refilled from bytesWritten, so a large file never sits in memory as a whole
+    while (socket->bytesToWrite() < SendBufferSize && !connection.file->atEnd())
+        socket->write(connection.file->read(ChunkSize));
+
+    if (!connection.file->atEnd())
+        return;
+
+    delete connection.file;
+    connection.file = nullptr;
+
+    // keep-alive, the next request may already be waiting
+    handleRequests(socket);
+}
+
+QString PeerCache::lookup(const QString &sha1) const
+{
+    static const QRegularExpression hexSha1{"^[0-9a-f]{40}$"};
+    if (!hexSha1.match(sha1).hasMatch())
+        return {};
+
+    if (const auto path = m_artifacts.value(sha1); !path.isEmpty() && QFileInfo::exists(path))
+        return path;
+
+    // asset objects are stored by their hash anyway
+    const auto object = QString("%1/assets/objects/%2/%3").arg(Config::instance()->getConfig("mcRoot").toString(), sha1.left(2), sha1);
+    if (QFileInfo::exists(object))
+        return object;
+
+    return {};
+}
+
+void PeerCache::load()
+{
+    QFile file{storePath()};
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    const auto artifacts = QCborValue::fromCbor(file.readAll()).toMap();
+    for (auto it = artifacts.cbegin(); it != artifacts.cend(); ++it)
+        m_artifacts.insert(it.key().toString(), it.value().toString());
+}
+
+void PeerCache::save()
+{
+    QCborMap artifacts;
+    for (auto it = m_artifacts.cbegin(); it != m_artifacts.cend(); ++it)
+        artifacts.insert(it.key(), it.value());
+
+    QDir{}.mkpath(QFileInfo{storePath()}.absolutePath());
+
+    QSaveFile file{storePath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcPeers, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{artifacts}.toCbor());
+    file.commit();
+}
+
+QString PeerCache::storePath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/artifacts.cbor";
+}
+
+} // namespace randomly
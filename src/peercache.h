@@ -0,0 +1,64 @@
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <QHash>
+#include <QObject>
+#include <QTcpServer>
+#include <QTimer>
+#include <QUrl>
+
+class QFile;
+class QTcpSocket;
+
+namespace randomly {
+
+// launchers on the same network share what they downloaded. Each one can serve the files it verified as
+// GET /sha1/<hash> (`peer_port`), and asks the launchers listed in `peers` ("host:port") before going upstream.
+// Whatever a peer sends is checked against the hash like any other download, so peers don't need to be trusted
+class PeerCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PeerCache(QObject *parent = nullptr);
+    ~PeerCache();
+
+    int peerCount() const { return m_peers.size(); }
+    QUrl peerUrl(int peer, const QString &sha1) const;
+
+    // ms, a dead peer must not hold up a download for long
+    int timeout() const { return m_timeout; }
+
+    // a file on disk that has this hash, so it may be served. Wrong claims only cost the asking peer a retry
+    void remember(const QString &sha1, const QString &path);
+
+    quint16 port() const { return m_server.serverPort(); }
+
+private:
+    struct Connection
+    {
+        QByteArray request;
+        QFile *file = nullptr; // being sent
+    };
+
+    void accept();
+    void handleRequests(QTcpSocket *socket);
+    void sendFile(QTcpSocket *socket);
+    QString lookup(const QString &sha1) const;
+
+    void load();
+    void save();
+    QString storePath() const;
+
+    QStringList m_peers;
+    int m_timeout;
+
+    QTcpServer m_server;
+    QHash<QTcpSocket *, Connection> m_connections;
+
+    QHash<QString, QString> m_artifacts; // sha1 -> path
+    QTimer m_saveTimer;
+};
+
+} // namespace randomly
+
+#endif // PEERCACHE_H
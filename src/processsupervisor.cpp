@@ -0,0 +1,374 @@
+#include "processsupervisor.h"
+
+#include "config.h"
+#include "instancestore.h"
+#include "jvmtuning.h"
+#include "tracelog.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcSupervisor, "randomly.MyLauncher.Supervisor")
+
+constexpr auto tcSupervisor = "randomly.MyLauncher.Supervisor";
+
+constexpr qsizetype OutputBufferSize = 256 * 1024;
+constexpr qsizetype ReadChunkSize = 64 * 1024;
+constexpr qint64 LogFileSize = 16 * 1024 * 1024;
+constexpr int LogFilesKept = 5;
+constexpr int StopTimeout = 30'000; // ms
+
+// logged right after the window is created: "Backend library: LWJGL version 3.3.1" since 1.13, "LWJGL Version: 2.9.4"
+// before that
+bool isWindowLine(QByteArrayView output)
+{
+    return output.contains("Backend library: LWJGL") || output.contains("LWJGL Version:");
+}
+
+// next to its launcher log, so any launcher on the host can tell an instance runs
+QString pidPath(const QString &name)
+{
+    return QString("%1/logs/launcher/%2.pid").arg(Config::instance()->getConfig("mcRoot").toString(), name);
+}
+
+} // namespace
+
+LogRingBuffer::LogRingBuffer(qsizetype capacity)
+    : m_buffer(capacity, Qt::Uninitialized)
+{}
+
+void LogRingBuffer::append(const char *data, qsizetype length)
+{
+    const auto capacity = m_buffer.size();
+    auto buffer = m_buffer.data();
+
+    // only the tail fits anyway
+    if (length >= capacity) {
+        std::memcpy(buffer, data + length - capacity, capacity);
+        m_start = 0;
+        m_size = capacity;
+        return;
+    }
+
+    const auto end = (m_start + m_size) % capacity;
+    const auto first = std::min(length, capacity - end);
+
+    std::memcpy(buffer + end, data, first);
+    std::memcpy(buffer, data + first, length - first);
+
+    m_size += length;
+    if (m_size > capacity) {
+        m_start = (m_start + m_size - capacity) % capacity;
+        m_size = capacity;
+    }
+}
+
+QByteArray LogRingBuffer::contents() const
+{
+    const auto capacity = m_buffer.size();
+
+    if (m_start + m_size <= capacity)
+        return m_buffer.mid(m_start, m_size);
+
+    return m_buffer.mid(m_start) + m_buffer.left(m_start + m_size - capacity);
+}
+
+RotatingLogFile::RotatingLogFile(const QString &path, qint64 maxSize, int keep)
+    : m_file{path}
+    , m_maxSize{maxSize}
+    , m_keep{keep}
+{
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    // every launch starts with a fresh file, the previous one becomes .1
+    rotate();
+}
+
+void RotatingLogFile::write(const char *data, qsizetype length)
+{
+    if (m_file.size() + length > m_maxSize)
+        rotate();
+
+    m_file.write(data, length);
+}
+
+void RotatingLogFile::rotate()
+{
+    m_file.close();
+
+    const auto path = m_file.fileName();
+
+    QFile::remove(QString("%1.%2").arg(path).arg(m_keep));
+    for (int i = m_keep - 1; i > 0; --i)
+        QFile::rename(QString("%1.%2").arg(path).arg(i), QString("%1.%2").arg(path).arg(i + 1));
+
+    QFile::rename(path, path + ".1");
+
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate))
+        qCWarning(lcSupervisor, "cannot open %ls: %ls", qUtf16Printable(path), qUtf16Printable(m_file.errorString()));
+}
+
+GameInstance::GameInstance(const QString &name, const QString &logPath, QObject *parent)
+    : QObject{parent}
+    , m_name{name}
+    , m_output{OutputBufferSize}
+    , m_log{logPath, LogFileSize, LogFilesKept}
+    , m_chunk(ReadChunkSize, Qt::Uninitialized)
+{
+    // the game writes both to the same log anyway
+    m_process.setProcessChannelMode(QProcess::MergedChannels);
+
+    connect(&m_process, &QProcess::readyRead, this, &GameInstance::readOutput);
+    connect(&m_process, &QProcess::started, this, [this]() {
+        m_uptime.start();
+        m_stats.pid = m_process.processId();
+        m_sampler.start();
+
+        emit started();
+    });
+    connect(&m_process, &QProcess::finished, this, [this](int exitCode, QProcess::ExitStatus exitStatus) {
+        m_sampler.stop();
+        readOutput();
+
+        qCInfo(lcSupervisor, "%ls exited with %i after %lli s", qUtf16Printable(m_name), exitCode, m_uptime.elapsed() / 1000);
+        emit finished(exitCode, exitStatus);
+    });
+    connect(&m_process, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        // finished() never comes for a process that didn't even start
+        if (error == QProcess::FailedToStart) {
+            qCWarning(lcSupervisor, "cannot start %ls: %ls", qUtf16Printable(m_name), qUtf16Printable(m_process.errorString()));
+            emit finished(-1, QProcess::CrashExit);
+        }
+    });
+
+    const auto interval = Config::instance()->getConfig("supervisor_sample_interval").toInt();
+    m_sampler.setInterval(interval > 0 ? interval : 1000);
+    connect(&m_sampler, &QTimer::timeout, this, &GameInstance::sample);
+}
+
+void GameInstance::start(const QString &program, const QStringList &arguments, const QString &workingDirectory)
+{
+    m_stats = {};
+    m_lastCpuTicks = 0;
+    m_lastSampleTime = 0;
+
+    m_process.setWorkingDirectory(workingDirectory);
+    m_process.start(program, arguments);
+}
+
+void GameInstance::stop()
+{
+    if (!isRunning())
+        return;
+
+    m_process.terminate();
+    QTimer::singleShot(StopTimeout, this, [this]() {
+        if (isRunning())
+            kill();
+    });
+}
+
+void GameInstance::kill()
+{
+    m_process.kill();
+}
+
+void GameInstance::readOutput()
+{
+    // straight from the pipe into the ring buffer and the log file, without building any lines
+    while (true) {
+        const auto length = m_process.read(m_chunk.data(), m_chunk.size());
+        if (length <= 0)
+            break;
+
+        m_output.append(m_chunk.constData(), length);
+        m_log.write(m_chunk.constData(), length);
+
+        // only until it's found, the rest of the output isn't looked at
+        if (m_stats.firstWindow < 0 && isWindowLine(QByteArrayView{m_chunk.constData(), length}))
+            m_stats.firstWindow = m_uptime.elapsed();
+    }
+}
+
+void GameInstance::sample()
+{
+#ifdef Q_OS_LINUX
+    static const auto ticksPerSecond = sysconf(_SC_CLK_TCK);
+    static const auto pageSize = sysconf(_SC_PAGESIZE);
+
+    QFile stat{QString("/proc/%1/stat").arg(m_stats.pid)};
+    if (!stat.open(QFile::ReadOnly))
+        return;
+
+    // the name in field 2 may contain spaces, so start counting after its closing parenthesis.
+    // index 0 is field 3 (state), see proc(5)
+    const auto line = stat.readAll();
+    const auto fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 22)
+        return;
+
+    const auto cpuTicks = fields[11].toLongLong() + fields[12].toLongLong(); // utime + stime
+    const auto now = m_uptime.elapsed();
+
+    if (m_lastSampleTime > 0 && now > m_lastSampleTime) {
+        const auto cpuSeconds = double(cpuTicks - m_lastCpuTicks) / ticksPerSecond;
+        m_stats.cpuPercent = cpuSeconds * 100'000 / (now - m_lastSampleTime);
+    }
+
+    m_lastCpuTicks = cpuTicks;
+    m_lastSampleTime = now;
+
+    m_stats.threads = fields[17].toInt();
+    m_stats.rss = fields[21].toLongLong() * pageSize;
+    m_stats.peakRss = std::max(m_stats.peakRss, m_stats.rss);
+#endif
+
+    m_stats.uptime = m_uptime.elapsed();
+
+    traceDebug(tcSupervisor, "%1: %2 MiB rss, %3 threads", m_name, m_stats.rss / (1024 * 1024), m_stats.threads);
+
+    emit statsUpdated();
+}
+
+ProcessSupervisor::ProcessSupervisor(QObject *parent)
+    : QObject{parent}
+{}
+
+GameInstance *ProcessSupervisor::launch(const QString &name, const QString &program, const QStringList &arguments)
+{
+    if (auto running = instance(name); running && running->isRunning()) {
+        qCWarning(lcSupervisor, "%ls is already running", qUtf16Printable(name));
+        return running;
+    } else if (running) {
+        m_instances.removeOne(running);
+        running->deleteLater();
+    }
+
+    auto cfg = Config::instance();
+    const auto logPath = QString("%1/logs/launcher/%2.log").arg(cfg->getConfig("mcRoot").toString(), name);
+
+    auto game = new GameInstance(name, logPath, this);
+    m_instances.append(game);
+
+    connect(game, &GameInstance::started, this, [this, game]() {
+        // from now on other launchers can move it too
+        if (m_placement.isEnabled())
+            m_placement.started(game->name(), game->pid());
+
+        QSaveFile pidFile{pidPath(game->name())};
+        if (pidFile.open(QFile::WriteOnly)) {
+            pidFile.write(QByteArray::number(game->pid()));
+            pidFile.commit();
+        }
+
+        emit instanceStarted(game);
+    });
+    connect(game, &GameInstance::finished, this, [this, game]() {
+        QFile::remove(pidPath(game->name()));
+
+        // whoever shared its node gets its cores
+        if (m_placement.isEnabled())
+            applyPlacements(m_placement.remove(game->name()));
+
+        emit instanceFinished(game);
+    });
+
+    auto launchArguments = arguments;
+
+    if (m_placement.isEnabled()) {
+        auto placements = m_placement.add(name);
+        const auto placement = placements.take(name);
+
+        // the others on the node shrink to make room
+        applyPlacements(placements);
+
+        CpuPlacement::applyAtSpawn(game->process(), placement);
+        launchArguments = JvmTuning::scaleToCpus(launchArguments, placement.cpus.size());
+
+        qCInfo(lcSupervisor, "%ls runs on node %i with %lli cpus", qUtf16Printable(name), placement.node, qint64(placement.cpus.size()));
+    }
+
+    qCInfo(lcSupervisor, "launching %ls", qUtf16Printable(name));
+    // the game_directory temp belongs to whichever version was prepared last, not necessarily this one
+    const auto workingDirectory = InstanceStore::gameDirectory(name);
+    QDir{}.mkpath(workingDirectory);
+
+    game->start(program, launchArguments, workingDirectory);
+
+    return game;
+}
+
+bool ProcessSupervisor::isRunning(const QString &name)
+{
+    QFile pidFile{pidPath(name)};
+    if (!pidFile.open(QFile::ReadOnly))
+        return false;
+
+    bool ok = false;
+    const auto pid = pidFile.readAll().trimmed().toLongLong(&ok);
+    if (!ok || pid <= 0)
+        return false;
+
+#ifdef Q_OS_UNIX
+    // a launcher that crashed leaves the file behind, the process tells the truth. EPERM: it runs as another user
+    return ::kill(pid_t(pid), 0) == 0 || errno != ESRCH;
+#else
+    return true;
+#endif
+}
+
+int ProcessSupervisor::rebalance()
+{
+    if (!m_placement.isEnabled())
+        return 0;
+
+    return applyPlacements(m_placement.rebalance());
+}
+
+int ProcessSupervisor::applyPlacements(const QHash<QString, Placement> &placements)
+{
+    int moved = 0;
+
+    // by pid, most of them may have been started by other launchers
+    for (auto it = placements.cbegin(); it != placements.cend(); ++it) {
+        if (it->pid <= 0)
+            continue;
+
+        // the JVM keeps its gc thread counts, they only get other cores to run on
+        if (CpuPlacement::apply(it->pid, *it))
+            ++moved;
+
+        traceInfo(tcSupervisor, "moved %1 to %2 cpus on node %3", it.key(), it->cpus.size(), it->node);
+    }
+
+    return moved;
+}
+
+GameInstance *ProcessSupervisor::instance(const QString &name) const
+{
+    for (auto instance: m_instances) {
+        if (instance->name() == name)
+            return instance;
+    }
+
+    return nullptr;
+}
+
+} // namespace randomly
@@ -0,0 +1,131 @@
+#ifndef PROCESSSUPERVISOR_H
+#define PROCESSSUPERVISOR_H
+
+#include "cpuplacement.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QProcess>
+#include <QTimer>
+
+namespace randomly {
+
+struct InstanceStats
+{
+    qint64 pid = 0;
+    double cpuPercent = 0; // of one core, so 250 means two and a half cores are busy
+    qint64 rss = 0;        // bytes
+    qint64 peakRss = 0;
+    int threads = 0;
+    qint64 uptime = 0;     // ms
+    qint64 firstWindow = -1; // ms from start until the game logged its window, -1 until it did
+};
+
+// keeps the last `capacity` bytes of output, older bytes are simply overwritten
+class LogRingBuffer
+{
+public:
+    explicit LogRingBuffer(qsizetype capacity);
+
+    void append(const char *data, qsizetype length);
+    QByteArray contents() const;
+
+private:
+    QByteArray m_buffer;
+    qsizetype m_start = 0;
+    qsizetype m_size = 0;
+};
+
+// latest.log, latest.log.1, ..., the oldest one gets dropped once `keep` files exist
+class RotatingLogFile
+{
+public:
+    RotatingLogFile(const QString &path, qint64 maxSize, int keep);
+
+    void write(const char *data, qsizetype length);
+
+private:
+    void rotate();
+
+    QFile m_file;
+    qint64 m_maxSize;
+    int m_keep;
+};
+
+class GameInstance : public QObject
+{
+    Q_OBJECT
+public:
+    GameInstance(const QString &name, const QString &logPath, QObject *parent = nullptr);
+
+    void start(const QString &program, const QStringList &arguments, const QString &workingDirectory);
+    void stop(); // asks nicely, kills after a timeout
+    void kill();
+
+    QString name() const { return m_name; }
+    bool isRunning() const { return m_process.state() != QProcess::NotRunning; }
+    qint64 pid() const { return m_process.processId(); }
+    int exitCode() const { return m_process.exitCode(); }
+    QProcess::ExitStatus exitStatus() const { return m_process.exitStatus(); }
+
+    InstanceStats stats() const { return m_stats; }
+    QByteArray recentOutput() const { return m_output.contents(); }
+
+    QProcess &process() { return m_process; }
+
+signals:
+    void started();
+    void statsUpdated();
+    void finished(int exitCode, QProcess::ExitStatus exitStatus);
+
+private:
+    void readOutput();
+    void sample();
+
+    QString m_name;
+    QProcess m_process;
+
+    LogRingBuffer m_output;
+    RotatingLogFile m_log;
+    QByteArray m_chunk; // reused for every read, nothing gets allocated per line
+
+    QTimer m_sampler;
+    QElapsedTimer m_uptime;
+    InstanceStats m_stats;
+    qint64 m_lastCpuTicks = 0;
+    qint64 m_lastSampleTime = 0;
+};
+
+class ProcessSupervisor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ProcessSupervisor(QObject *parent = nullptr);
+
+    GameInstance *launch(const QString &name, const QString &program, const QStringList &arguments);
+
+    GameInstance *instance(const QString &name) const;
+    QList<GameInstance *> instances() const { return m_instances; }
+
+    // started by any launcher on this host and still running
+    static bool isRunning(const QString &name);
+
+    // with cpu_placement, moves the running instances of every launcher on this host to a fresh split of their
+    // nodes' cores. Happens by itself whenever an instance starts or stops. Returns how many were moved
+    int rebalance();
+
+signals:
+    void instanceStarted(GameInstance *instance);
+    void instanceFinished(GameInstance *instance);
+
+private:
+    int applyPlacements(const QHash<QString, Placement> &placements);
+
+    QList<GameInstance *> m_instances;
+    CpuPlacement m_placement;
+};
+
+} // namespace randomly
+
+#endif // PROCESSSUPERVISOR_H
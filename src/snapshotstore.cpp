@@ -0,0 +1,638 @@
+#include "snapshotstore.h"
+
+#include "config.h"
+#include "instancestore.h"
+#include "processsupervisor.h"
+#include "tracelog.h"
+
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QSet>
+#include <QtConcurrent>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <array>
+#include <optional>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcSnapshot, "randomly.MyLauncher.Snapshot")
+
+constexpr auto tcSnapshot = "randomly.MyLauncher.Snapshot";
+
+// FastCDC's normalized chunking: cuts are harder to find before the average size and easier after it, so chunk
+// sizes cluster around it
+constexpr qsizetype MinChunk = 16 * 1024;
+constexpr qsizetype AverageChunk = 64 * 1024;
+constexpr qsizetype MaxChunk = 256 * 1024;
+constexpr quint64 MaskHard = ~0ULL << (64 - 18); // the top bits depend on the last 64 bytes, the low ones on only a few
+constexpr quint64 MaskEasy = ~0ULL << (64 - 14);
+
+constexpr qint64 ReadBlock = 4 * 1024 * 1024;
+
+// runtime state and crash dumps, not worth keeping
+const QStringList Excluded{"logs/", "crash-reports/"};
+
+// splitmix64, fixed forever: other values would cut different chunks and nothing would deduplicate against older
+// snapshots anymore
+constexpr std::array<quint64, 256> makeGearTable()
+{
+    std::array<quint64, 256> table{};
+    quint64 state = 0x4d794c61756e6368; // "MyLaunch"
+
+    for (auto &value: table) {
+        state += 0x9e3779b97f4a7c15;
+        auto z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        value = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+constexpr auto Gear = makeGearTable();
+
+struct FileEntry
+{
+    QString path; // relative to the game directory
+    qint64 size = 0;
+    qint64 modified = 0; // ms since epoch
+    int permissions = 0;
+    QStringList chunks;  // sha256 of each, in order
+
+    // filled in while snapshotting or restoring
+    bool changed = false;
+    bool ok = true;
+    qint64 bytes = 0;
+    int newChunks = 0;
+    qint64 bytesStored = 0;
+};
+
+qsizetype cutPoint(const uchar *data, qsizetype size)
+{
+    if (size <= MinChunk)
+        return size;
+
+    const auto end = std::min(size, MaxChunk);
+    const auto normal = std::min(end, AverageChunk);
+
+    quint64 hash = 0;
+    auto i = MinChunk;
+
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + Gear[data[i]];
+        if (!(hash & MaskHard))
+            return i + 1;
+    }
+
+    for (; i < end; ++i) {
+        hash = (hash << 1) + Gear[data[i]];
+        if (!(hash & MaskEasy))
+            return i + 1;
+    }
+
+    return end;
+}
+
+// a raw stream through libarchive's filters: zstd if it was built with it, gzip otherwise
+std::optional<QByteArray> compress(QByteArrayView data)
+{
+    archive *a = archive_write_new();
+    if (archive_write_add_filter_zstd(a) != ARCHIVE_OK)
+        archive_write_add_filter_gzip(a);
+
+    archive_write_set_format_raw(a);
+    archive_write_set_bytes_in_last_block(a, 1); // no padding
+
+    // incompressible data grows a little
+    QByteArray output(data.size() + data.size() / 16 + 4096, Qt::Uninitialized);
+    size_t used = 0;
+
+    bool ok = archive_write_open_memory(a, output.data(), output.size(), &used) == ARCHIVE_OK;
+
+    if (ok) {
+        auto entry = archive_entry_new();
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_size(entry, data.size());
+
+        ok = archive_write_header(a, entry) == ARCHIVE_OK && archive_write_data(a, data.data(), data.size()) == data.size();
+        archive_entry_free(entry);
+    }
+
+    ok = archive_write_close(a) == ARCHIVE_OK && ok;
+    archive_write_free(a);
+
+    if (!ok)
+        return {};
+
+    output.resize(used);
+    return output;
+}
+
+std::optional<QByteArray> decompress(const QByteArray &data)
+{
+    archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+
+    std::optional<QByteArray> result;
+    archive_entry *entry;
+
+    if (archive_read_open_memory(a, data.constData(), data.size()) == ARCHIVE_OK && archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        QByteArray output;
+        std::array<char, 64 * 1024> buffer;
+
+        la_ssize_t read;
+        while ((read = archive_read_data(a, buffer.data(), buffer.size())) > 0)
+            output.append(buffer.data(), read);
+
+        if (read == 0)
+            result = output;
+    }
+
+    archive_read_free(a);
+    return result;
+}
+
+QString sha256Of(QByteArrayView data)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex());
+}
+
+bool isExcluded(const QString &relativePath)
+{
+    for (const auto &prefix: Excluded) {
+        if (relativePath.startsWith(prefix))
+            return true;
+    }
+
+    return false;
+}
+
+// every regular file below root, relative to it
+QStringList listFiles(const QString &root)
+{
+    QStringList files;
+    const QDir rootDir{root};
+
+    QDirIterator it{root, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories};
+    while (it.hasNext()) {
+        const auto relative = rootDir.relativeFilePath(it.next());
+        if (!isExcluded(relative))
+            files.append(relative);
+    }
+
+    return files;
+}
+
+QCborMap toCbor(const FileEntry &entry)
+{
+    return {
+        {"path", entry.path},
+        {"size", entry.size},
+        {"modified", entry.modified},
+        {"permissions", entry.permissions},
+        {"chunks", QCborArray::fromStringList(entry.chunks)},
+    };
+}
+
+FileEntry fromCbor(const QCborMap &map)
+{
+    FileEntry entry;
+    entry.path = map.value("path").toString();
+    entry.size = map.value("size").toInteger();
+    entry.modified = map.value("modified").toInteger();
+    entry.permissions = map.value("permissions").toInteger();
+
+    for (const auto &chunk: map.value("chunks").toArray())
+        entry.chunks.append(chunk.toString());
+
+    return entry;
+}
+
+std::optional<QCborMap> readManifest(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QFile::ReadOnly))
+        return {};
+
+    // a truncated manifest would read as a snapshot of nothing
+    QCborParserError error;
+    const auto manifest = QCborValue::fromCbor(file.readAll(), &error);
+    if (error.error != QCborError::NoError || !manifest.isMap()) {
+        qCWarning(lcSnapshot, "cannot read %ls: %ls", qUtf16Printable(path), qUtf16Printable(error.errorString()));
+        return {};
+    }
+
+    return manifest.toMap();
+}
+
+// snapshots write chunks before their manifest, restores read them, prune deletes those no manifest refers to.
+// One of them at a time across the store, held for as long as it takes, so only a dead holder's lock is stale
+bool lockStore(QLockFile &lock)
+{
+    lock.setStaleLockTime(0);
+    if (lock.lock())
+        return true;
+
+    qCWarning(lcSnapshot, "cannot lock the snapshot store (error %i)", int(lock.error()));
+    return false;
+}
+
+QList<FileEntry> manifestFiles(const QCborMap &manifest)
+{
+    QList<FileEntry> files;
+    for (const auto &file: manifest.value("files").toArray())
+        files.append(fromCbor(file.toMap()));
+
+    return files;
+}
+
+// a game directory sharing mcRoot would take the store, the libraries and every other instance along, and a restore
+// would delete whatever of that isn't in the snapshot. InstanceStore::clone refuses the same
+bool sharesMcRoot(const QString &root)
+{
+    // canonical where possible, a restore may have to create the game directory first
+    const auto resolve = [](const QString &path) {
+        const QFileInfo info{path};
+        return info.exists() ? info.canonicalFilePath() : QDir::cleanPath(info.absoluteFilePath());
+    };
+
+    const auto mcRoot = resolve(Config::instance()->getConfig("mcRoot").toString());
+    const auto directory = resolve(root);
+
+    return mcRoot == directory || mcRoot.startsWith(directory + '/');
+}
+
+} // namespace
+
+SnapshotResult SnapshotStore::snapshot(const QString &id)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    SnapshotResult result;
+
+    const auto root = InstanceStore::gameDirectory(id);
+    if (!QFileInfo{root}.isDir()) {
+        qCWarning(lcSnapshot, "%ls has no game directory", qUtf16Printable(id));
+        return result;
+    }
+
+    if (sharesMcRoot(root)) {
+        qCWarning(lcSnapshot, "%ls shares mcRoot as game directory, not snapshotting it", qUtf16Printable(id));
+        return result;
+    }
+
+    QDir{}.mkpath(storeRoot());
+    QLockFile lock{storeRoot() + "/store.lock"};
+    if (!lockStore(lock))
+        return result;
+
+    // the previous snapshot knows the chunks of everything that didn't change since
+    QHash<QString, FileEntry> previous;
+    if (const auto snapshots = list(id); !snapshots.isEmpty()) {
+        if (const auto manifest = readManifest(QString("%1/%2.cbor").arg(manifestDirectory(id), snapshots.first().id))) {
+            for (const auto &entry: manifestFiles(*manifest))
+                previous.insert(entry.path, entry);
+        }
+    }
+
+    QList<FileEntry> files;
+
+    for (const auto &path: listFiles(root)) {
+        const QFileInfo info{root + "/" + path};
+
+        FileEntry entry;
+        entry.path = path;
+        entry.size = info.size();
+        entry.modified = info.lastModified().toMSecsSinceEpoch();
+        entry.permissions = info.permissions().toInt();
+
+        if (const auto old = previous.constFind(path); old != previous.cend() && old->size == entry.size && old->modified == entry.modified)
+            entry.chunks = old->chunks;
+        else
+            entry.changed = true;
+
+        files.append(entry);
+    }
+
+    // reading, hashing and compressing is what takes time, so changed files are spread over all cores
+    QtConcurrent::blockingMap(files, [&root](FileEntry &entry) {
+        if (!entry.changed)
+            return;
+
+        QFile file{root + "/" + entry.path};
+        if (!file.open(QFile::ReadOnly)) {
+            qCWarning(lcSnapshot, "cannot read %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+            entry.ok = false;
+            return;
+        }
+
+        // a cut needs MaxChunk bytes ahead, or the end of the file
+        QByteArray buffer;
+        qsizetype offset = 0;
+        bool atEnd = false;
+
+        while (true) {
+            if (!atEnd && buffer.size() - offset < MaxChunk) {
+                buffer.remove(0, offset);
+                offset = 0;
+
+                const auto block = file.read(ReadBlock);
+                if (block.isEmpty())
+                    atEnd = true;
+                else
+                    buffer.append(block);
+
+                continue;
+            }
+
+            const auto available = buffer.size() - offset;
+            if (available == 0)
+                break;
+
+            const auto data = reinterpret_cast<const uchar *>(buffer.constData()) + offset;
+            const QByteArrayView chunk{data, cutPoint(data, available)};
+            const auto hash = sha256Of(chunk);
+            const auto path = chunkPath(hash);
+
+            // other files, instances or snapshots brought it already
+            if (!QFile::exists(path)) {
+                const auto compressed = compress(chunk);
+
+                QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+                // two threads storing the same chunk write the same bytes, whichever rename comes last wins
+                QSaveFile output{path};
+                if (!compressed || !output.open(QFile::WriteOnly) || output.write(*compressed) != compressed->size() || !output.commit()) {
+                    qCWarning(lcSnapshot, "cannot store a chunk of %ls", qUtf16Printable(file.fileName()));
+                    entry.ok = false;
+                    return;
+                }
+
+                ++entry.newChunks;
+                entry.bytesStored += compressed->size();
+            }
+
+            entry.chunks.append(hash);
+            entry.bytes += chunk.size();
+            offset += chunk.size();
+        }
+
+        // it changed while we read it, the next snapshot will look again
+        entry.size = entry.bytes;
+    });
+
+    result.ok = true;
+
+    QCborArray entries;
+    for (const auto &entry: std::as_const(files)) {
+        result.ok &= entry.ok;
+        ++result.files;
+
+        if (entry.changed) {
+            ++result.filesChanged;
+            result.bytesRead += entry.bytes;
+            result.chunksStored += entry.newChunks;
+            result.bytesStored += entry.bytesStored;
+        }
+
+        entries.append(toCbor(entry));
+    }
+
+    if (!result.ok)
+        return result;
+
+    const auto created = QDateTime::currentDateTimeUtc();
+    result.id = created.toString("yyyyMMdd-HHmmss-zzz");
+
+    const auto manifestPath = QString("%1/%2.cbor").arg(manifestDirectory(id), result.id);
+    QDir{}.mkpath(manifestDirectory(id));
+
+    QSaveFile manifest{manifestPath};
+    if (!manifest.open(QFile::WriteOnly)) {
+        qCWarning(lcSnapshot, "cannot write %ls: %ls", qUtf16Printable(manifestPath), qUtf16Printable(manifest.errorString()));
+        result.ok = false;
+        return result;
+    }
+
+    manifest.write(QCborValue{QCborMap{{"created", created.toMSecsSinceEpoch()}, {"files", entries}}}.toCbor());
+    result.ok = manifest.commit();
+    result.elapsed = timer.elapsed();
+
+    qCInfo(lcSnapshot, "snapshot %ls of %ls: %i of %i files changed, %lli KiB stored", qUtf16Printable(result.id), qUtf16Printable(id),
+           result.filesChanged, result.files, result.bytesStored / 1024);
+
+    return result;
+}
+
+RestoreResult SnapshotStore::restore(const QString &id, const QString &snapshotId)
+{
+    RestoreResult result;
+
+    const auto root = InstanceStore::gameDirectory(id);
+    if (sharesMcRoot(root)) {
+        qCWarning(lcSnapshot, "%ls shares mcRoot as game directory, not restoring it", qUtf16Printable(id));
+        return result;
+    }
+
+    // it would keep writing into files we replace, and the world it has open would be whatever it saves next
+    if (ProcessSupervisor::isRunning(id)) {
+        qCWarning(lcSnapshot, "%ls is running, stop it before restoring", qUtf16Printable(id));
+        return result;
+    }
+
+    QDir{}.mkpath(storeRoot());
+    QLockFile lock{storeRoot() + "/store.lock"};
+    if (!lockStore(lock))
+        return result;
+
+    auto resolved = snapshotId;
+    if (resolved == "latest") {
+        const auto snapshots = list(id);
+        if (snapshots.isEmpty()) {
+            qCWarning(lcSnapshot, "%ls has no snapshots", qUtf16Printable(id));
+            return result;
+        }
+
+        resolved = snapshots.first().id;
+    }
+
+    const auto manifest = readManifest(QString("%1/%2.cbor").arg(manifestDirectory(id), resolved));
+    if (!manifest) {
+        qCWarning(lcSnapshot, "%ls has no snapshot %ls", qUtf16Printable(id), qUtf16Printable(resolved));
+        return result;
+    }
+
+    auto files = manifestFiles(*manifest);
+
+    QSet<QString> wanted;
+    for (const auto &entry: std::as_const(files))
+        wanted.insert(entry.path);
+
+    // whatever was created after the snapshot
+    for (const auto &path: listFiles(root)) {
+        if (!wanted.contains(path) && QFile::remove(root + "/" + path))
+            ++result.filesRemoved;
+    }
+
+    QtConcurrent::blockingMap(files, [&root](FileEntry &entry) {
+        const auto path = root + "/" + entry.path;
+
+        // restored files get their old mtime back, so a second restore skips them too
+        const QFileInfo current{path};
+        if (current.exists() && current.size() == entry.size && current.lastModified().toMSecsSinceEpoch() == entry.modified)
+            return;
+
+        entry.changed = true;
+
+        QDir{}.mkpath(current.absolutePath());
+
+        QSaveFile output{path};
+        if (!output.open(QFile::WriteOnly)) {
+            qCWarning(lcSnapshot, "cannot write %ls: %ls", qUtf16Printable(path), qUtf16Printable(output.errorString()));
+            entry.ok = false;
+            return;
+        }
+
+        for (const auto &hash: std::as_const(entry.chunks)) {
+            QFile chunk{chunkPath(hash)};
+            const auto data = chunk.open(QFile::ReadOnly) ? decompress(chunk.readAll()) : std::nullopt;
+
+            if (!data || sha256Of(*data) != hash) {
+                qCWarning(lcSnapshot, "chunk %ls of %ls is missing or corrupt", qUtf16Printable(hash), qUtf16Printable(entry.path));
+                entry.ok = false;
+                return;
+            }
+
+            output.write(*data);
+            entry.bytes += data->size();
+        }
+
+        if (!output.commit()) {
+            entry.ok = false;
+            return;
+        }
+
+        QFile restored{path};
+        restored.setPermissions(QFile::Permissions::fromInt(entry.permissions));
+        if (restored.open(QFile::ReadWrite))
+            restored.setFileTime(QDateTime::fromMSecsSinceEpoch(entry.modified), QFile::FileModificationTime);
+    });
+
+    result.ok = true;
+
+    for (const auto &entry: std::as_const(files)) {
+        result.ok &= entry.ok;
+
+        if (entry.changed) {
+            ++result.filesRestored;
+            result.bytesWritten += entry.bytes;
+        } else {
+            ++result.filesUnchanged;
+        }
+    }
+
+    qCInfo(lcSnapshot, "restored %ls to %ls: %i files written, %i unchanged, %i removed", qUtf16Printable(id), qUtf16Printable(resolved),
+           result.filesRestored, result.filesUnchanged, result.filesRemoved);
+
+    return result;
+}
+
+QList<SnapshotInfo> SnapshotStore::list(const QString &id)
+{
+    QList<SnapshotInfo> snapshots;
+
+    // ids are timestamps, so sorting by name is sorting by age
+    const QDir directory{manifestDirectory(id)};
+    for (const auto &name: directory.entryList({"*.cbor"}, QDir::Files, QDir::Name | QDir::Reversed)) {
+        const auto manifest = readManifest(directory.filePath(name));
+        if (!manifest)
+            continue;
+
+        SnapshotInfo info;
+        info.id = QFileInfo{name}.completeBaseName();
+        info.created = QDateTime::fromMSecsSinceEpoch(manifest->value("created").toInteger());
+
+        for (const auto &file: manifest->value("files").toArray()) {
+            ++info.files;
+            info.size += file.toMap().value("size").toInteger();
+        }
+
+        snapshots.append(info);
+    }
+
+    return snapshots;
+}
+
+int SnapshotStore::prune(const QString &id, int keep)
+{
+    QDir{}.mkpath(storeRoot());
+    QLockFile lock{storeRoot() + "/store.lock"};
+    if (!lockStore(lock))
+        return 0;
+
+    const auto snapshots = list(id);
+    for (auto i = qsizetype(std::max(keep, 0)); i < snapshots.size(); ++i)
+        QFile::remove(QString("%1/%2.cbor").arg(manifestDirectory(id), snapshots[i].id));
+
+    // chunks are shared by every instance, so everything still referenced anywhere stays
+    QSet<QString> referenced;
+
+    QDirIterator manifests{storeRoot() + "/instances", {"*.cbor"}, QDir::Files, QDirIterator::Subdirectories};
+    while (manifests.hasNext()) {
+        const auto manifest = readManifest(manifests.next());
+        if (!manifest)
+            return 0; // better keep too much than lose chunks of a snapshot we couldn't read
+
+        for (const auto &file: manifest->value("files").toArray()) {
+            for (const auto &chunk: file.toMap().value("chunks").toArray())
+                referenced.insert(chunk.toString());
+        }
+    }
+
+    int removed = 0;
+
+    QDirIterator chunks{storeRoot() + "/chunks", QDir::Files, QDirIterator::Subdirectories};
+    while (chunks.hasNext()) {
+        const auto path = chunks.next();
+        if (!referenced.contains(QFileInfo{path}.fileName()) && QFile::remove(path))
+            ++removed;
+    }
+
+    traceInfo(tcSnapshot, "pruned %1 to %2 snapshots, %3 chunks removed", id, keep, removed);
+    return removed;
+}
+
+QString SnapshotStore::storeRoot()
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/snapshots";
+}
+
+QString SnapshotStore::manifestDirectory(const QString &id)
+{
+    return QString("%1/instances/%2").arg(storeRoot(), id);
+}
+
+QString SnapshotStore::chunkPath(const QString &hash)
+{
+    return QString("%1/chunks/%2/%3").arg(storeRoot(), hash.left(2), hash);
+}
+
+} // namespace randomly
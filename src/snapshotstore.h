@@ -0,0 +1,65 @@
+#ifndef SNAPSHOTSTORE_H
+#define SNAPSHOTSTORE_H
+
+#include <QDateTime>
+#include <QStringList>
+
+namespace randomly {
+
+struct SnapshotResult
+{
+    bool ok = false;
+    QString id;
+    int files = 0;
+    int filesChanged = 0;  // since the previous snapshot, only these were read
+    qint64 bytesRead = 0;
+    int chunksStored = 0;  // new to the store, everything else was there already
+    qint64 bytesStored = 0; // compressed
+    qint64 elapsed = 0;    // ms
+};
+
+struct RestoreResult
+{
+    bool ok = false;
+    int filesRestored = 0;
+    int filesUnchanged = 0;
+    int filesRemoved = 0;
+    qint64 bytesWritten = 0;
+};
+
+struct SnapshotInfo
+{
+    QString id;
+    QDateTime created;
+    int files = 0;
+    qint64 size = 0; // of the files, as they are on disk
+};
+
+// snapshots of instance game directories in a deduplicating store, snapshots/chunks, shared by all instances.
+// Files are cut into chunks where their content says so (a gear hash, like FastCDC), so an edit in the middle of a
+// region file only changes the chunks around it. Chunks are named by their sha256 and compressed through libarchive.
+// A snapshot only reads files whose size or mtime changed since the previous one, the others keep their chunks
+class SnapshotStore
+{
+public:
+    static SnapshotResult snapshot(const QString &id);
+
+    // makes the game directory look exactly like the snapshot, files that weren't in it are removed.
+    // "latest" is the newest snapshot. Refused while the instance runs, and for game directories sharing mcRoot
+    static RestoreResult restore(const QString &id, const QString &snapshotId);
+
+    // newest first
+    static QList<SnapshotInfo> list(const QString &id);
+
+    // keeps the newest `keep` snapshots of the instance and removes chunks no snapshot uses anymore
+    static int prune(const QString &id, int keep);
+
+private:
+    static QString storeRoot();
+    static QString manifestDirectory(const QString &id);
+    static QString chunkPath(const QString &hash);
+};
+
+} // namespace randomly
+
+#endif // SNAPSHOTSTORE_H
@@ -0,0 +1,336 @@
+#include "tracelog.h"
+
+#include <QFile>
+#include <QIODevice>
+#include <QJsonValue>
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace randomly::trace {
+
+namespace {
+
+constexpr qsizetype MaxLineLength = 512;
+
+std::chrono::steady_clock::time_point s_start;
+
+#ifdef Q_OS_UNIX
+char s_crashFile[4096];
+#endif
+
+// tiny append-only buffer. everything in here has to stay async-signal-safe, so no Qt and no allocations
+struct LineBuffer
+{
+    char *data;
+    qsizetype capacity;
+    qsizetype used = 0;
+
+    void append(const char *s, qsizetype length)
+    {
+        length = std::min(length, capacity - used);
+        std::memcpy(data + used, s, length);
+        used += length;
+    }
+
+    void append(const char *s) { append(s, qsizetype(std::strlen(s))); }
+    void append(char c) { append(&c, 1); }
+
+    void appendNumber(qint64 value, int minDigits = 1)
+    {
+        char digits[24];
+        int count = 0;
+        const bool negative = value < 0;
+        auto remaining = negative ? -quint64(value) : quint64(value);
+
+        do {
+            digits[count++] = char('0' + remaining % 10);
+            remaining /= 10;
+        } while (remaining != 0 || count < minDigits);
+
+        if (negative)
+            append('-');
+
+        while (count > 0)
+            append(digits[--count]);
+    }
+};
+
+qsizetype formatRecord(const Record &record, char *out, qsizetype capacity) noexcept
+{
+    LineBuffer line{out, capacity - 1}; // leave space for the newline
+
+    line.append('[');
+    line.appendNumber(record.timestamp / 1'000'000'000);
+    line.append('.');
+    line.appendNumber(record.timestamp / 1'000 % 1'000'000, 6);
+    line.append("] ");
+
+    switch (record.level) {
+    case Debug:   line.append("D "); break;
+    case Info:    line.append("I "); break;
+    case Warning: line.append("W "); break;
+    }
+
+    line.append(record.category);
+    line.append(": ");
+
+    for (auto c = record.format; *c != '\0'; ++c) {
+        const int index = c[1] - '1';
+
+        if (*c != '%' || index < 0 || index >= record.argumentCount) {
+            line.append(*c);
+            continue;
+        }
+
+        const auto value = record.values[index];
+        if (record.isText[index])
+            line.append(record.text + (value >> 8), value & 0xff);
+        else
+            line.appendNumber(value);
+
+        ++c; // skip the digit
+    }
+
+    out[line.used] = '\n';
+    return line.used + 1;
+}
+
+#ifdef Q_OS_UNIX
+void writeAll(int fd, const char *data, qsizetype length)
+{
+    while (length > 0) {
+        const auto written = ::write(fd, data, length);
+        if (written <= 0)
+            return;
+
+        data += written;
+        length -= written;
+    }
+}
+
+void handleCrash(int signalNumber)
+{
+    // SA_RESETHAND already restored the default handler, so raising again below really terminates
+    if (const int fd = ::open(s_crashFile, O_WRONLY | O_CREAT | O_TRUNC, 0644); fd >= 0) {
+        TraceLog::instance().dumpToFileDescriptor(fd);
+        ::close(fd);
+    }
+
+    ::raise(signalNumber);
+}
+
+void handleDumpRequest(int)
+{
+    TraceLog::instance().dumpToFileDescriptor(STDERR_FILENO);
+}
+#endif
+
+} // namespace
+
+TraceLog::TraceLog()
+{
+    s_start = std::chrono::steady_clock::now();
+}
+
+TraceLog &TraceLog::instance()
+{
+    static TraceLog globalInstance;
+
+    return globalInstance;
+}
+
+void TraceLog::dump(QIODevice *device) const
+{
+    const auto head = m_head.load(std::memory_order_acquire);
+    char line[MaxLineLength];
+    Record record;
+
+    for (auto ticket = head > Capacity ? head - Capacity : 0; ticket < head; ++ticket) {
+        if (readRecord(ticket, record))
+            device->write(line, formatRecord(record, line, MaxLineLength));
+    }
+}
+
+void TraceLog::installSignalHandlers(const QString &crashFile)
+{
+#ifdef Q_OS_UNIX
+    const auto path = QFile::encodeName(crashFile);
+    std::memcpy(s_crashFile, path.constData(), std::min<qsizetype>(path.size() + 1, sizeof(s_crashFile) - 1));
+
+    struct sigaction crash = {};
+    crash.sa_handler = handleCrash;
+    crash.sa_flags = SA_RESETHAND;
+    sigemptyset(&crash.sa_mask);
+
+    for (const auto signalNumber: {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL})
+        sigaction(signalNumber, &crash, nullptr);
+
+    // `kill -USR1 <pid>` dumps the buffer to stderr without stopping anything
+    struct sigaction dumpRequest = {};
+    dumpRequest.sa_handler = handleDumpRequest;
+    dumpRequest.sa_flags = SA_RESTART;
+    sigemptyset(&dumpRequest.sa_mask);
+
+    sigaction(SIGUSR1, &dumpRequest, nullptr);
+#else
+    Q_UNUSED(crashFile); // only dump() is available here
+#endif
+}
+
+void TraceLog::dumpToFileDescriptor(int fd) const noexcept
+{
+#ifdef Q_OS_UNIX
+    const auto head = m_head.load(std::memory_order_acquire);
+    char line[MaxLineLength];
+    Record record;
+
+    for (auto ticket = head > Capacity ? head - Capacity : 0; ticket < head; ++ticket) {
+        if (readRecord(ticket, record))
+            writeAll(fd, line, formatRecord(record, line, MaxLineLength));
+    }
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+quint64 TraceLog::begin(Record *&record) noexcept
+{
+    const auto ticket = m_head.fetch_add(1, std::memory_order_relaxed);
+    const auto slot = ticket & (Capacity - 1);
+
+    // seqlock: mark the slot as busy before touching it, readers will skip it until commit()
+    m_sequences[slot].store(2 * ticket + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    record = &m_records[slot];
+    record->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count();
+
+    return ticket;
+}
+
+void TraceLog::commit(quint64 ticket) noexcept
+{
+    m_sequences[ticket & (Capacity - 1)].store(2 * ticket + 2, std::memory_order_release);
+}
+
+bool TraceLog::readRecord(quint64 ticket, Record &copy) const noexcept
+{
+    const auto slot = ticket & (Capacity - 1);
+    const auto expected = 2 * ticket + 2;
+
+    if (m_sequences[slot].load(std::memory_order_acquire) != expected)
+        return false; // still being written or already overwritten
+
+    std::memcpy(&copy, &m_records[slot], sizeof(Record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return m_sequences[slot].load(std::memory_order_relaxed) == expected;
+}
+
+void TraceLog::Encoder::add(QStringView value)
+{
+    const int offset = textUsed;
+
+    for (qsizetype i = 0; i < value.size(); ++i) {
+        char32_t c = value[i].unicode();
+
+        if (QChar::isHighSurrogate(c) && i + 1 < value.size() && value[i + 1].isLowSurrogate())
+            c = QChar::surrogateToUcs4(char16_t(c), value[++i].unicode());
+
+        char bytes[4];
+        int length;
+
+        if (c < 0x80) {
+            bytes[0] = char(c);
+            length = 1;
+        } else if (c < 0x800) {
+            bytes[0] = char(0xc0 | (c >> 6));
+            bytes[1] = char(0x80 | (c & 0x3f));
+            length = 2;
+        } else if (c < 0x10000) {
+            bytes[0] = char(0xe0 | (c >> 12));
+            bytes[1] = char(0x80 | ((c >> 6) & 0x3f));
+            bytes[2] = char(0x80 | (c & 0x3f));
+            length = 3;
+        } else {
+            bytes[0] = char(0xf0 | (c >> 18));
+            bytes[1] = char(0x80 | ((c >> 12) & 0x3f));
+            bytes[2] = char(0x80 | ((c >> 6) & 0x3f));
+            bytes[3] = char(0x80 | (c & 0x3f));
+            length = 4;
+        }
+
+        if (textUsed + length > TextCapacity)
+            break; // truncate, this is a log and not an archive
+
+        std::memcpy(record.text + textUsed, bytes, length);
+        textUsed += length;
+    }
+
+    push(true, (qint64(offset) << 8) | (textUsed - offset));
+}
+
+void TraceLog::Encoder::add(const QVariant &value)
+{
+    // only cheap conversions here, everything else just logs its type
+    switch (value.typeId()) {
+    case QMetaType::QString:
+        add(QStringView{*static_cast<const QString *>(value.constData())});
+        break;
+
+    case QMetaType::QByteArray:
+        add(*static_cast<const QByteArray *>(value.constData()));
+        break;
+
+    case QMetaType::Bool:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        push(false, value.toLongLong());
+        break;
+
+    case QMetaType::QJsonValue: {
+        const auto json = value.toJsonValue();
+        if (json.isString())
+            add(json.toString());
+        else if (json.isDouble())
+            push(false, json.toInteger());
+        else
+            add("<json>");
+    } break;
+
+    default:
+        add(value.isValid() ? value.typeName() : "<invalid>");
+    }
+}
+
+void TraceLog::Encoder::push(bool text, qint64 value)
+{
+    if (record.argumentCount >= MaxArguments)
+        return;
+
+    record.isText[record.argumentCount] = text;
+    record.values[record.argumentCount] = value;
+    ++record.argumentCount;
+}
+
+void TraceLog::Encoder::addText(const char *data, qsizetype length)
+{
+    const int offset = textUsed;
+    length = std::min<qsizetype>(length, TextCapacity - textUsed);
+
+    std::memcpy(record.text + textUsed, data, length);
+    textUsed += int(length);
+
+    push(true, (qint64(offset) << 8) | length);
+}
+
+} // namespace randomly::trace
@@ -0,0 +1,138 @@
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+#include <QByteArray>
+#include <QLatin1StringView>
+#include <QString>
+#include <QVariant>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+class QIODevice;
+
+// everything below this level is compiled out completely (0 = debug, 1 = info, 2 = warning, 3 = nothing)
+#ifndef MYLAUNCHER_TRACE_LEVEL
+#define MYLAUNCHER_TRACE_LEVEL 0
+#endif
+
+namespace randomly::trace {
+
+enum Level : quint8 {
+    Debug,
+    Info,
+    Warning,
+};
+
+constexpr int MaxArguments = 4;
+constexpr int TextCapacity = 112;
+
+// one entry of the ring buffer. nothing in here is formatted, the format string is
+// only filled in when somebody actually wants to read the log (dump() or a crash)
+struct Record
+{
+    qint64 timestamp;      // ns since the logger was created
+    const char *category;  // string literal
+    const char *format;    // string literal, %1 to %4 are replaced by the arguments
+    quint8 level;
+    quint8 argumentCount;
+    bool isText[MaxArguments];
+    qint64 values[MaxArguments]; // either the integer itself or (offset << 8 | length) into text
+    char text[TextCapacity];
+};
+
+class TraceLog
+{
+public:
+    static constexpr quint64 Capacity = 4096; // must be a power of two
+
+    static TraceLog &instance();
+
+    template <typename... Args>
+    void write(Level level, const char *category, const char *format, const Args &...args) noexcept;
+
+    // formats everything that's currently in the buffer, oldest first
+    void dump(QIODevice *device) const;
+
+    // writes the buffer to crashFile on SIGSEGV/SIGABRT/..., and to stderr on SIGUSR1
+    void installSignalHandlers(const QString &crashFile);
+
+    // async-signal-safe, that's why this doesn't take a QIODevice
+    void dumpToFileDescriptor(int fd) const noexcept;
+
+private:
+    TraceLog();
+
+    struct Encoder
+    {
+        Record &record;
+        int textUsed = 0;
+
+        void add(bool value) { push(false, value); }
+
+        template <typename T>
+            requires std::is_integral_v<T> || std::is_enum_v<T>
+        void add(T value) { push(false, qint64(value)); }
+
+        void add(const char *value) { addText(value, qsizetype(std::strlen(value))); }
+        void add(const QByteArray &value) { addText(value.constData(), value.size()); }
+        void add(QLatin1StringView value) { addText(value.data(), value.size()); }
+        void add(QStringView value);
+        void add(const QString &value) { add(QStringView{value}); }
+        void add(const QVariant &value);
+
+        void push(bool text, qint64 value);
+        void addText(const char *data, qsizetype length);
+    };
+
+    quint64 begin(Record *&record) noexcept;
+    void commit(quint64 ticket) noexcept;
+
+    bool readRecord(quint64 ticket, Record &copy) const noexcept;
+
+    Record m_records[Capacity];
+    std::atomic<quint64> m_sequences[Capacity]; // per slot, odd while a writer is busy with it
+    std::atomic<quint64> m_head{0};
+};
+
+template <typename... Args>
+void TraceLog::write(Level level, const char *category, const char *format, const Args &...args) noexcept
+{
+    static_assert(sizeof...(Args) <= MaxArguments, "too many trace arguments");
+
+    Record *record;
+    const auto ticket = begin(record);
+
+    record->level = level;
+    record->category = category;
+    record->format = format;
+    record->argumentCount = 0;
+
+    Encoder encoder{*record};
+    (encoder.add(args), ...);
+
+    commit(ticket);
+}
+
+} // namespace randomly::trace
+
+#if MYLAUNCHER_TRACE_LEVEL <= 0
+#define traceDebug(category, ...) ::randomly::trace::TraceLog::instance().write(::randomly::trace::Debug, category, __VA_ARGS__)
+#else
+#define traceDebug(category, ...) do {} while (false)
+#endif
+
+#if MYLAUNCHER_TRACE_LEVEL <= 1
+#define traceInfo(category, ...) ::randomly::trace::TraceLog::instance().write(::randomly::trace::Info, category, __VA_ARGS__)
+#else
+#define traceInfo(category, ...) do {} while (false)
+#endif
+
+#if MYLAUNCHER_TRACE_LEVEL <= 2
+#define traceWarning(category, ...) ::randomly::trace::TraceLog::instance().write(::randomly::trace::Warning, category, __VA_ARGS__)
+#else
+#define traceWarning(category, ...) do {} while (false)
+#endif
+
+#endif // TRACELOG_H
@@ -0,0 +1,133 @@
+#include "transferdecoder.h"
+
+#include "tracelog.h"
+
+#include <QLoggingCategory>
+#include <QtConcurrent>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcDecoder, "randomly.MyLauncher.Download")
+
+constexpr auto tcDecoder = "randomly.MyLauncher.Download";
+
+} // namespace
+
+TransferDecoder::TransferDecoder(DownloadInfo::Compression compression, QThreadPool *pool)
+    : m_compression{compression}
+{
+    m_result = QtConcurrent::run(pool, [this]() { return decode(); });
+}
+
+TransferDecoder::~TransferDecoder()
+{
+    {
+        QMutexLocker lock{&m_mutex};
+        m_aborted = true;
+    }
+
+    m_dataAvailable.wakeAll();
+    m_result.waitForFinished();
+}
+
+void TransferDecoder::feed(const QByteArray &chunk)
+{
+    if (chunk.isEmpty())
+        return; // would look like the end of the stream
+
+    {
+        QMutexLocker lock{&m_mutex};
+        m_chunks.enqueue(chunk);
+        m_received += chunk.size();
+    }
+
+    m_dataAvailable.wakeOne();
+}
+
+QFuture<std::optional<QByteArray>> TransferDecoder::finish()
+{
+    {
+        QMutexLocker lock{&m_mutex};
+        m_finished = true;
+    }
+
+    m_dataAvailable.wakeOne();
+    return m_result;
+}
+
+std::optional<QByteArray> TransferDecoder::decode()
+{
+    archive *a = archive_read_new();
+    archive_read_support_format_raw(a);
+
+    switch (m_compression) {
+    case DownloadInfo::Compression::Gzip:
+        archive_read_support_filter_gzip(a);
+        break;
+    case DownloadInfo::Compression::Xz:
+        archive_read_support_filter_xz(a);
+        break;
+    case DownloadInfo::Compression::Lzma:
+        archive_read_support_filter_lzma(a);
+        break;
+    case DownloadInfo::Compression::None:
+        break;
+    }
+
+    archive_entry *entry;
+    if (archive_read_open(a, this, nullptr, &TransferDecoder::read, nullptr) != ARCHIVE_OK || archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        qCWarning(lcDecoder) << "cannot decode:" << archive_error_string(a);
+        archive_read_free(a);
+        return {};
+    }
+
+    QByteArray decoded;
+
+    const void *buffer;
+    size_t size;
+    la_int64_t offset;
+
+    int r;
+    while ((r = archive_read_data_block(a, &buffer, &size, &offset)) == ARCHIVE_OK)
+        decoded.append(static_cast<const char *>(buffer), size);
+
+    if (r != ARCHIVE_EOF)
+        qCWarning(lcDecoder) << "cannot decode:" << archive_error_string(a);
+
+    archive_read_free(a);
+
+    if (r != ARCHIVE_EOF)
+        return {};
+
+    traceDebug(tcDecoder, "decoded %1 B from %2 B", decoded.size(), m_received);
+
+    return decoded;
+}
+
+la_ssize_t TransferDecoder::read(archive *, void *self, const void **buffer)
+{
+    auto decoder = static_cast<TransferDecoder *>(self);
+
+    QMutexLocker lock{&decoder->m_mutex};
+
+    while (decoder->m_chunks.isEmpty() && !decoder->m_finished && !decoder->m_aborted)
+        decoder->m_dataAvailable.wait(&decoder->m_mutex);
+
+    if (decoder->m_aborted)
+        return ARCHIVE_FATAL;
+
+    if (decoder->m_chunks.isEmpty())
+        return 0; // end of the transfer
+
+    decoder->m_current = decoder->m_chunks.dequeue();
+    *buffer = decoder->m_current.constData();
+
+    return decoder->m_current.size();
+}
+
+} // namespace randomly
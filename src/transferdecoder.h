@@ -0,0 +1,51 @@
+#ifndef TRANSFERDECODER_H
+#define TRANSFERDECODER_H
+
+#include "downloader.h"
+
+#include <QFuture>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+#include <archive.h>
+
+class QThreadPool;
+
+namespace randomly {
+
+// decompresses a transfer with libarchive on a worker thread while it is still arriving,
+// so by the time the last byte is in only the tail is left to decode
+class TransferDecoder
+{
+public:
+    TransferDecoder(DownloadInfo::Compression compression, QThreadPool *pool);
+    ~TransferDecoder(); // aborts if still running
+
+    void feed(const QByteArray &chunk);
+
+    // no more data will come, the future holds the decoded data or nothing if it was corrupt
+    QFuture<std::optional<QByteArray>> finish();
+
+    qint64 bytesReceived() const { return m_received; }
+
+private:
+    std::optional<QByteArray> decode();
+    static la_ssize_t read(archive *a, void *self, const void **buffer);
+
+    DownloadInfo::Compression m_compression;
+
+    QMutex m_mutex;
+    QWaitCondition m_dataAvailable;
+    QQueue<QByteArray> m_chunks;
+    QByteArray m_current; // libarchive may keep pointing into it until the next read
+    bool m_finished = false;
+    bool m_aborted = false;
+    qint64 m_received = 0;
+
+    QFuture<std::optional<QByteArray>> m_result;
+};
+
+} // namespace randomly
+
+#endif // TRANSFERDECODER_H
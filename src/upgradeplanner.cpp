@@ -0,0 +1,114 @@
+#include "upgradeplanner.h"
+
+#include "assetstage.h"
+#include "javaruntimemanager.h"
+#include "minecraftcommandlineprovider.h"
+#include "tracelog.h"
+#include "versioncatalogue.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcUpgrade, "randomly.MyLauncher.Upgrade")
+
+constexpr auto tcUpgrade = "randomly.MyLauncher.Upgrade";
+
+QStringList libraryNames(const QJsonDocument &versionConfig)
+{
+    QStringList names;
+    for (const auto &library: versionConfig["libraries"].toArray())
+        names.append(library.toObject()["name"].toString());
+
+    names.removeDuplicates();
+    return names;
+}
+
+} // namespace
+
+qint64 UpgradePlan::totalBytes() const
+{
+    qint64 total = 0;
+    for (const auto classBytes: bytes)
+        total += classBytes;
+
+    return total;
+}
+
+UpgradePlanner::UpgradePlanner(Downloader *downloads, QObject *parent)
+    : QObject{parent}
+    , m_downloads{downloads}
+    , m_provider{new MinecraftCommandLineProvider(downloads, this)}
+    , m_assets{new AssetStage(downloads, this)}
+    , m_runtimes{new JavaRuntimeManager(downloads, this)}
+{}
+
+std::optional<UpgradePlan> UpgradePlanner::plan(const QString &from, const QString &to)
+{
+    VersionCatalogue catalogue;
+    for (const auto &version: {from, to}) {
+        if (!catalogue.ensureVersionJson(version, m_downloads)) {
+            qCWarning(lcUpgrade, "cannot plan %ls -> %ls, %ls is unknown", qUtf16Printable(from), qUtf16Printable(to), qUtf16Printable(version));
+            return {};
+        }
+    }
+
+    const auto current = m_provider->getCombinedVersionConfig(from);
+    const auto target = m_provider->getCombinedVersionConfig(to);
+
+    UpgradePlan plan;
+    plan.from = from;
+    plan.to = to;
+
+    const auto currentLibraries = libraryNames(current);
+    const auto targetLibraries = libraryNames(target);
+
+    for (const auto &name: targetLibraries) {
+        if (!currentLibraries.contains(name))
+            plan.librariesAdded.append(name);
+    }
+
+    for (const auto &name: currentLibraries) {
+        if (!targetLibraries.contains(name))
+            plan.librariesRemoved.append(name);
+    }
+
+    plan.assetIndexFrom = current["assetIndex"]["id"].toString();
+    plan.assetIndexTo = target["assetIndex"]["id"].toString();
+    plan.runtimeFrom = current["javaVersion"]["component"].toString();
+    plan.runtimeTo = target["javaVersion"]["component"].toString();
+    plan.clientChanged = current["downloads"]["client"]["sha1"] != target["downloads"]["client"]["sha1"];
+
+    // whatever is on disk already doesn't count, even if another version brought it
+    plan.files = m_provider->missingFiles(to);
+    plan.files += m_assets->missingObjects(target["assetIndex"].toObject());
+
+    if (!plan.runtimeTo.isEmpty())
+        plan.files += m_runtimes->missingFiles(plan.runtimeTo).value_or(QList<DownloadInfo>{});
+
+    for (const auto &info: std::as_const(plan.files)) {
+        if (info.size > 0)
+            plan.bytes[int(info.transferClass)] += info.size;
+        else
+            ++plan.unknownSizes;
+    }
+
+    qCInfo(lcUpgrade, "%ls -> %ls: %lli files, %lli MiB", qUtf16Printable(from), qUtf16Printable(to), qint64(plan.files.size()), plan.totalBytes() >> 20);
+
+    return plan;
+}
+
+void UpgradePlanner::prefetch(const UpgradePlan &plan)
+{
+    traceInfo(tcUpgrade, "prefetching %1 files for %2", plan.files.size(), plan.to);
+
+    // natives are extracted on the first launch, from the cache that's quick
+    for (const auto &info: plan.files)
+        m_downloads->download(info);
+}
+
+} // namespace randomly
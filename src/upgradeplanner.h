@@ -0,0 +1,62 @@
+#ifndef UPGRADEPLANNER_H
+#define UPGRADEPLANNER_H
+
+#include "downloader.h"
+
+#include <QObject>
+
+#include <array>
+
+namespace randomly {
+
+class AssetStage;
+class JavaRuntimeManager;
+class MinecraftCommandLineProvider;
+
+struct UpgradePlan
+{
+    QString from;
+    QString to;
+
+    // what differs between the two merged version jsons
+    QStringList librariesAdded; // maven names
+    QStringList librariesRemoved;
+    QString assetIndexFrom;
+    QString assetIndexTo;
+    QString runtimeFrom;
+    QString runtimeTo;
+    bool clientChanged = false;
+
+    // the delta: everything `to` needs that isn't on disk, whichever version it came with
+    QList<DownloadInfo> files;
+    std::array<qint64, TransferClassCount> bytes{}; // by transfer class, as written to disk
+    int unknownSizes = 0;                           // files the metadata has no size for, not in bytes
+
+    qint64 totalBytes() const;
+};
+
+// what switching an installation from one version to another costs, known before the switch.
+// The plan is exact: libraries, natives and the client jar by path, asset objects by hash and runtime files by
+// hash, each only if it's missing. Prefetching it ahead of time makes the first launch of the new version warm
+class UpgradePlanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UpgradePlanner(Downloader *downloads, QObject *parent = nullptr);
+
+    // blocks for metadata only: version jsons (installing loaders), the asset index and the runtime manifest
+    std::optional<UpgradePlan> plan(const QString &from, const QString &to);
+
+    // queues the plan's files and returns, they count against the usual bandwidth limits
+    void prefetch(const UpgradePlan &plan);
+
+private:
+    Downloader *m_downloads;
+    MinecraftCommandLineProvider *m_provider;
+    AssetStage *m_assets;
+    JavaRuntimeManager *m_runtimes;
+};
+
+} // namespace randomly
+
+#endif // UPGRADEPLANNER_H
@@ -0,0 +1,398 @@
+#include "versioncatalogue.h"
+
+#include "config.h"
+#include "loaderinstaller.h"
+#include "tracelog.h"
+
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QTimeZone>
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcCatalogue, "randomly.MyLauncher.VersionCatalogue")
+
+constexpr auto tcCatalogue = "randomly.MyLauncher.VersionCatalogue";
+
+// can be pointed at a local file (file:///...) to work offline
+constexpr auto DefaultManifestUrl = "https://piston-meta.mojang.com/mc/game/version_manifest_v2.json";
+
+QCborMap resourceToCbor(const CachedResource &resource)
+{
+    return {
+        {QStringLiteral("sha1"), resource.sha1},
+        {QStringLiteral("etag"), resource.etag},
+        {QStringLiteral("lastModified"), resource.lastModified},
+    };
+}
+
+CachedResource resourceFromCbor(const QCborMap &map)
+{
+    return {
+        map.value(QStringLiteral("sha1")).toString(),
+        map.value(QStringLiteral("etag")).toByteArray(),
+        map.value(QStringLiteral("lastModified")).toByteArray(),
+    };
+}
+
+void addValidators(QNetworkRequest &req, const CachedResource &cached)
+{
+    if (!cached.etag.isEmpty())
+        req.setRawHeader("If-None-Match", cached.etag);
+
+    if (!cached.lastModified.isEmpty())
+        req.setRawHeader("If-Modified-Since", cached.lastModified);
+}
+
+bool notModified(QNetworkReply *reply)
+{
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304;
+}
+
+} // namespace
+
+VersionCatalogue::VersionCatalogue(QObject *parent)
+    : QObject{parent}
+    , m_ctrl{new QNetworkAccessManager(this)}
+{
+    loadIndex();
+}
+
+void VersionCatalogue::refresh()
+{
+    auto url = Config::instance()->getConfig("version_manifest_url").toString();
+    if (url.isEmpty())
+        url = DefaultManifestUrl;
+
+    QNetworkRequest req{QUrl{url}};
+    addValidators(req, m_manifest);
+
+    traceDebug(tcCatalogue, "revalidating manifest %1", url);
+
+    auto reply = m_ctrl->get(req);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() { receiveManifest(reply); });
+}
+
+bool VersionCatalogue::ensureVersionJson(const QString &id, Downloader *downloads)
+{
+    QSet<QString> visited;
+
+    for (auto current = id; !current.isEmpty();) {
+        // a json inheriting from itself, directly or not, would keep us here forever
+        if (visited.contains(current)) {
+            qCWarning(lcCatalogue, "version %ls inherits from itself", qUtf16Printable(current));
+            return false;
+        }
+
+        visited.insert(current);
+        auto entry = find(current);
+
+        // loaders aren't in the manifest, they're installed from their own metadata
+        if (!entry && !QFile::exists(versionJsonPath(current)) && LoaderInstaller::parse(current)) {
+            LoaderInstaller installer{downloads};
+            if (!installer.install(current))
+                return false;
+        }
+
+        // we've never seen the manifest, or it doesn't know this version yet
+        if (!entry && !QFile::exists(versionJsonPath(current))) {
+            QEventLoop loop;
+            connect(this, &VersionCatalogue::refreshed, &loop, &QEventLoop::quit);
+            connect(this, &VersionCatalogue::failed, &loop, &QEventLoop::quit);
+            refresh();
+            loop.exec();
+
+            entry = find(current);
+        }
+
+        QFile versionJson{versionJsonPath(current)};
+
+        if (entry) {
+            auto &cached = m_versionJsons[current];
+
+            // deleted behind our back, neither the hash nor the validators describe anything anymore. A 304 wouldn't
+            // bring it back
+            if (!cached.sha1.isEmpty() && !versionJson.exists()) {
+                cached = {};
+                saveIndex();
+            }
+
+            // installed by someone else, hash it once so we know if it's the real thing
+            if (cached.sha1.isEmpty() && versionJson.open(QFile::ReadOnly)) {
+                cached.sha1 = QString::fromLatin1(QCryptographicHash::hash(versionJson.readAll(), QCryptographicHash::Sha1).toHex());
+                versionJson.close();
+                saveIndex();
+            }
+
+            if (cached.sha1 != entry->sha1 && !fetchVersionJson(*entry))
+                return false;
+        }
+
+        if (!versionJson.open(QFile::ReadOnly)) {
+            qCWarning(lcCatalogue, "version %ls is neither installed nor known upstream", qUtf16Printable(current));
+            return false;
+        }
+
+        // follow the inheritance chain, i.e. fabric -> vanilla
+        current = QJsonDocument::fromJson(versionJson.readAll())["inheritsFrom"].toString();
+    }
+
+    return true;
+}
+
+QList<VersionEntry> VersionCatalogue::versions(const QString &type) const
+{
+    if (type.isEmpty())
+        return m_versions;
+
+    QList<VersionEntry> matching;
+    for (const auto &entry: m_versions) {
+        if (entry.type == type)
+            matching.append(entry);
+    }
+
+    return matching;
+}
+
+QList<VersionEntry> VersionCatalogue::versions(const QString &type, const QRegularExpression &filter) const
+{
+    QList<VersionEntry> matching;
+    for (const auto &entry: m_versions) {
+        if ((type.isEmpty() || entry.type == type) && filter.match(entry.id).hasMatch())
+            matching.append(entry);
+    }
+
+    return matching;
+}
+
+std::optional<VersionEntry> VersionCatalogue::find(const QString &id) const
+{
+    const auto index = m_versionIndices.value(id, -1);
+    if (index < 0)
+        return {};
+
+    return m_versions.at(index);
+}
+
+QString VersionCatalogue::indexPath() const
+{
+    return Config::instance()->getConfig("mcRoot").toString() + "/cache/version_manifest.cbor";
+}
+
+QString VersionCatalogue::versionJsonPath(const QString &id) const
+{
+    return QString("%1/versions/%2/%2.json").arg(Config::instance()->getConfig("mcRoot").toString(), id);
+}
+
+void VersionCatalogue::loadIndex()
+{
+    QFile file{indexPath()};
+    if (!file.open(QFile::ReadOnly))
+        return; // first start, nothing cached yet
+
+    const auto root = QCborValue::fromCbor(file.readAll()).toMap();
+
+    m_manifest = resourceFromCbor(root.value(QStringLiteral("manifest")).toMap());
+    m_latestRelease = root.value(QStringLiteral("latestRelease")).toString();
+    m_latestSnapshot = root.value(QStringLiteral("latestSnapshot")).toString();
+
+    const auto versions = root.value(QStringLiteral("versions")).toArray();
+    m_versions.reserve(versions.size());
+
+    for (const auto &value: versions) {
+        const auto map = value.toMap();
+
+        m_versionIndices.insert(map.value(QStringLiteral("id")).toString(), m_versions.size());
+        m_versions.append({
+            map.value(QStringLiteral("id")).toString(),
+            map.value(QStringLiteral("type")).toString(),
+            map.value(QStringLiteral("url")).toString(),
+            map.value(QStringLiteral("sha1")).toString(),
+            QDateTime::fromMSecsSinceEpoch(map.value(QStringLiteral("releaseTime")).toInteger(), QTimeZone::UTC),
+        });
+    }
+
+    const auto versionJsons = root.value(QStringLiteral("versionJsons")).toMap();
+    for (auto it = versionJsons.cbegin(); it != versionJsons.cend(); ++it)
+        m_versionJsons.insert(it.key().toString(), resourceFromCbor(it.value().toMap()));
+
+    qCInfo(lcCatalogue) << "loaded" << m_versions.size() << "cached versions";
+}
+
+void VersionCatalogue::saveIndex() const
+{
+    QCborArray versions;
+    for (const auto &entry: m_versions) {
+        versions.append(QCborMap{
+            {QStringLiteral("id"), entry.id},
+            {QStringLiteral("type"), entry.type},
+            {QStringLiteral("url"), entry.url},
+            {QStringLiteral("sha1"), entry.sha1},
+            {QStringLiteral("releaseTime"), entry.releaseTime.toMSecsSinceEpoch()},
+        });
+    }
+
+    QCborMap versionJsons;
+    for (auto it = m_versionJsons.cbegin(); it != m_versionJsons.cend(); ++it)
+        versionJsons.insert(it.key(), resourceToCbor(it.value()));
+
+    const QCborMap root{
+        {QStringLiteral("manifest"), resourceToCbor(m_manifest)},
+        {QStringLiteral("latestRelease"), m_latestRelease},
+        {QStringLiteral("latestSnapshot"), m_latestSnapshot},
+        {QStringLiteral("versions"), versions},
+        {QStringLiteral("versionJsons"), versionJsons},
+    };
+
+    QDir{}.mkpath(QFileInfo{indexPath()}.absolutePath());
+
+    QSaveFile file{indexPath()};
+    if (!file.open(QFile::WriteOnly)) {
+        qCWarning(lcCatalogue, "cannot write %ls: %ls", qUtf16Printable(file.fileName()), qUtf16Printable(file.errorString()));
+        return;
+    }
+
+    file.write(QCborValue{root}.toCbor());
+    file.commit();
+}
+
+void VersionCatalogue::receiveManifest(QNetworkReply *reply)
+{
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qCWarning(lcCatalogue, "cannot fetch version manifest: %ls", qUtf16Printable(reply->errorString()));
+        emit failed(reply->errorString());
+        return;
+    }
+
+    if (notModified(reply)) {
+        traceDebug(tcCatalogue, "manifest not modified");
+        emit refreshed(false);
+        return;
+    }
+
+    const auto manifest = QJsonDocument::fromJson(reply->readAll());
+    if (!manifest.isObject()) {
+        qCWarning(lcCatalogue) << "version manifest is not a json object";
+        emit failed("invalid manifest");
+        return;
+    }
+
+    m_latestRelease = manifest["latest"]["release"].toString();
+    m_latestSnapshot = manifest["latest"]["snapshot"].toString();
+
+    const auto versions = manifest["versions"].toArray();
+
+    m_versions.clear();
+    m_versionIndices.clear();
+    m_versions.reserve(versions.size());
+
+    for (const auto &value: versions) {
+        const auto version = value.toObject();
+
+        m_versionIndices.insert(version["id"].toString(), m_versions.size());
+        m_versions.append({
+            version["id"].toString(),
+            version["type"].toString(),
+            version["url"].toString(),
+            version["sha1"].toString(),
+            QDateTime::fromString(version["releaseTime"].toString(), Qt::ISODate),
+        });
+    }
+
+    m_manifest.etag = reply->rawHeader("ETag");
+    m_manifest.lastModified = reply->rawHeader("Last-Modified");
+
+    saveIndex();
+
+    qCInfo(lcCatalogue) << "manifest updated," << m_versions.size() << "versions";
+    emit refreshed(true);
+}
+
+bool VersionCatalogue::fetchVersionJson(const VersionEntry &entry)
+{
+    QNetworkRequest req{QUrl{entry.url}};
+
+    // only revalidate if we still have the file the validators belong to
+    if (QFile::exists(versionJsonPath(entry.id)))
+        addValidators(req, m_versionJsons.value(entry.id));
+
+    traceDebug(tcCatalogue, "fetching version json %1", entry.id);
+
+    auto reply = m_ctrl->get(req);
+
+    QEventLoop loop;
+    connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    return receiveVersion(reply, entry);
+}
+
+bool VersionCatalogue::receiveVersion(QNetworkReply *reply, const VersionEntry &entry)
+{
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qCWarning(lcCatalogue, "cannot fetch %ls: %ls", qUtf16Printable(entry.url), qUtf16Printable(reply->errorString()));
+        emit failed(reply->errorString());
+        return false;
+    }
+
+    auto &cached = m_versionJsons[entry.id];
+
+    if (notModified(reply)) {
+        cached.sha1 = entry.sha1;
+        saveIndex();
+        return true;
+    }
+
+    const auto data = reply->readAll();
+    const auto sha1 = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+
+    if (!entry.sha1.isEmpty() && sha1 != entry.sha1.toLatin1()) {
+        qCWarning(lcCatalogue, "failed to fetch %ls: hash doesn't match", qUtf16Printable(entry.url));
+        emit failed("hash mismatch");
+        return false;
+    }
+
+    const auto path = versionJsonPath(entry.id);
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+
+    QSaveFile output{path};
+    if (!output.open(QFile::WriteOnly)) {
+        qCWarning(lcCatalogue, "failed to open %ls: %ls", qUtf16Printable(path), qUtf16Printable(output.errorString()));
+        return false;
+    }
+
+    output.write(data);
+    if (!output.commit())
+        return false;
+
+    cached.sha1 = QString::fromLatin1(sha1);
+    cached.etag = reply->rawHeader("ETag");
+    cached.lastModified = reply->rawHeader("Last-Modified");
+    saveIndex();
+
+    emit versionUpdated(entry.id);
+    return true;
+}
+
+} // namespace randomly
@@ -0,0 +1,83 @@
+#ifndef VERSIONCATALOGUE_H
+#define VERSIONCATALOGUE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QRegularExpression;
+
+namespace randomly {
+
+class Downloader;
+
+struct VersionEntry
+{
+    QString id;
+    QString type;
+    QString url;
+    QString sha1;
+    QDateTime releaseTime;
+};
+
+// validators of something we already have on disk, sent back for conditional requests
+struct CachedResource
+{
+    QString sha1;
+    QByteArray etag;
+    QByteArray lastModified;
+};
+
+class VersionCatalogue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VersionCatalogue(QObject *parent = nullptr);
+
+    // revalidates the manifest in the background, the cached index stays usable meanwhile
+    void refresh();
+
+    // makes sure versions/<id>/<id>.json (and everything it inherits from) exists and is up to date.
+    // blocks until done, but only touches the network if something is actually missing or outdated.
+    // Loaders are installed through `downloads` if given, one of their own otherwise
+    bool ensureVersionJson(const QString &id, Downloader *downloads = nullptr);
+
+    QList<VersionEntry> versions(const QString &type = {}) const;
+    QList<VersionEntry> versions(const QString &type, const QRegularExpression &filter) const;
+    std::optional<VersionEntry> find(const QString &id) const;
+
+    QString latestRelease() const { return m_latestRelease; }
+    QString latestSnapshot() const { return m_latestSnapshot; }
+
+signals:
+    void refreshed(bool changed);
+    void versionUpdated(QString id);
+    void failed(QString reason);
+
+private:
+    QString indexPath() const;
+    QString versionJsonPath(const QString &id) const;
+
+    void loadIndex();
+    void saveIndex() const;
+
+    void receiveManifest(QNetworkReply *reply);
+    bool receiveVersion(QNetworkReply *reply, const VersionEntry &entry);
+    bool fetchVersionJson(const VersionEntry &entry);
+
+    QNetworkAccessManager *m_ctrl;
+
+    QList<VersionEntry> m_versions;
+    QHash<QString, qsizetype> m_versionIndices;
+    QString m_latestRelease;
+    QString m_latestSnapshot;
+
+    CachedResource m_manifest;
+    QHash<QString, CachedResource> m_versionJsons;
+};
+
+} // namespace randomly
+
+#endif // VERSIONCATALOGUE_H
@@ -0,0 +1,328 @@
+#include "writepipeline.h"
+
+#include "config.h"
+#include "tracelog.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QtConcurrent>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace randomly {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcWrite, "randomly.MyLauncher.Write")
+
+constexpr auto tcWrite = "randomly.MyLauncher.Write";
+
+// an asset sync completes hundreds of small files a second, they shouldn't wait long for company
+constexpr int FlushDelay = 25; // ms
+constexpr int MaxBatchFiles = 512;
+constexpr qint64 MaxBatchBytes = 64 * 1024 * 1024;
+
+constexpr qint64 OrphanAge = 60 * 60; // s
+
+// the only places downloads are written to. Worlds, snapshots and whatever else lives in mcRoot are none of our business
+const QStringList StagingDirectories{"libraries", "assets/objects", "versions", "runtime"};
+
+// <path>.<pid>.<n>.part, neither another launcher on the same mcRoot nor a second pipeline of ours ever stages to the
+// same file. O_TRUNC on a shared name would let their writes interleave
+QString stagingPath(const QString &path)
+{
+    static std::atomic<quint64> counter;
+    return QString("%1.%2.%3.part").arg(path).arg(QCoreApplication::applicationPid()).arg(counter++);
+}
+
+#ifdef Q_OS_UNIX
+bool writeAll(int fd, const char *data, qint64 size, qint64 offset)
+{
+    while (offset < size) {
+        const auto written = ::pwrite(fd, data + offset, size - offset, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        offset += written;
+    }
+
+    return true;
+}
+#endif
+
+#ifdef HAVE_LIBURING
+constexpr unsigned QueueDepth = 256;
+
+// one submission per QueueDepth files instead of one write() each. false if io_uring isn't usable here
+// (old kernel, seccomp), so the caller can fall back to plain writes
+bool writeWithUring(const QList<PendingWrite> &batch, QList<int> &fds, QList<bool> &results)
+{
+    io_uring ring;
+    if (io_uring_queue_init(QueueDepth, &ring, 0) < 0)
+        return false;
+
+    for (qsizetype first = 0; first < batch.size(); first += QueueDepth) {
+        unsigned submitted = 0;
+
+        for (auto i = first; i < std::min(first + qsizetype(QueueDepth), batch.size()); ++i) {
+            if (fds[i] < 0 || batch[i].data.isEmpty())
+                continue;
+
+            auto sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_write(sqe, fds[i], batch[i].data.constData(), batch[i].data.size(), 0);
+            io_uring_sqe_set_data64(sqe, i);
+            ++submitted;
+        }
+
+        if (submitted > 0 && io_uring_submit_and_wait(&ring, submitted) < 0) {
+            io_uring_queue_exit(&ring);
+            return false;
+        }
+
+        for (unsigned done = 0; done < submitted; ++done) {
+            io_uring_cqe *cqe;
+            if (io_uring_wait_cqe(&ring, &cqe) < 0)
+                break;
+
+            const auto i = qsizetype(io_uring_cqe_get_data64(cqe));
+            const auto &data = batch[i].data;
+
+            // short writes are finished the ordinary way
+            results[i] = cqe->res >= 0 && writeAll(fds[i], data.constData(), data.size(), cqe->res);
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+
+    io_uring_queue_exit(&ring);
+    return true;
+}
+#endif
+
+} // namespace
+
+WritePipeline::WritePipeline(QObject *parent)
+    : QObject{parent}
+{
+    m_pool.setMaxThreadCount(1);
+
+    // once per process, every downloader has a pipeline of its own
+    static std::once_flag swept;
+    std::call_once(swept, []() {
+        QtConcurrent::run(&WritePipeline::removeOrphans, Config::instance()->getConfig("mcRoot").toString());
+    });
+
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(FlushDelay);
+    connect(&m_flushTimer, &QTimer::timeout, this, &WritePipeline::flush);
+}
+
+WritePipeline::~WritePipeline()
+{
+    flush();
+    m_pool.waitForDone();
+}
+
+void WritePipeline::write(PendingWrite write)
+{
+    m_batchBytes += write.data.size();
+    m_batch.append(std::move(write));
+    ++m_inFlight;
+
+    if (m_batch.size() >= MaxBatchFiles || m_batchBytes >= MaxBatchBytes)
+        flush();
+    else if (!m_flushTimer.isActive())
+        m_flushTimer.start();
+}
+
+void WritePipeline::flush()
+{
+    m_flushTimer.stop();
+
+    if (m_batch.isEmpty())
+        return;
+
+    const auto batch = std::exchange(m_batch, {});
+    m_batchBytes = 0;
+
+    traceDebug(tcWrite, "committing %1 files", batch.size());
+
+    QtConcurrent::run(&m_pool, &WritePipeline::commit, batch).then(this, [this, batch](const QList<bool> &results) {
+        for (qsizetype i = 0; i < batch.size(); ++i) {
+            --m_inFlight;
+
+            if (batch[i].done)
+                batch[i].done(results[i]);
+        }
+    });
+}
+
+int WritePipeline::removeOrphans(const QString &root)
+{
+    // other launchers may share mcRoot and be staging right now, theirs are renamed within seconds
+    const auto cutoff = QDateTime::currentDateTime().addSecs(-OrphanAge);
+    static const QRegularExpression staged{"\\.\\d+\\.\\d+\\.part$"};
+    int removed = 0;
+
+    for (const auto &directory: StagingDirectories) {
+        QDirIterator it{QDir{root}.filePath(directory), {"*.part"}, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories};
+        while (it.hasNext()) {
+            const auto file = it.nextFileInfo();
+            if (staged.match(file.fileName()).hasMatch() && file.lastModified() < cutoff && QFile::remove(file.filePath()))
+                ++removed;
+        }
+    }
+
+    if (removed > 0)
+        qCInfo(lcWrite, "removed %i files staged before a crash", removed);
+
+    return removed;
+}
+
+QList<bool> WritePipeline::commit(const QList<PendingWrite> &batch)
+{
+    QList<bool> results(batch.size(), false);
+
+#ifdef Q_OS_UNIX
+    QList<int> fds(batch.size(), -1);
+    QList<QByteArray> staged(batch.size());
+    stage(batch, fds, staged, results);
+
+    // every staged file has to be on disk before it's renamed, or a crash could leave a complete looking path with
+    // missing data. Only our own files are synced, syncfs() would flush the world saves of every server on the
+    // filesystem too. Writeback of the whole batch is started first, so the fdatasyncs mostly wait for the same I/O
+#ifdef Q_OS_LINUX
+    for (const auto fd: std::as_const(fds)) {
+        if (fd >= 0)
+            ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+
+    QSet<QString> directories;
+
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        if (fds[i] < 0)
+            continue;
+
+#ifdef Q_OS_LINUX
+        if (::fdatasync(fds[i]) != 0)
+            results[i] = false;
+#else
+        if (::fsync(fds[i]) != 0)
+            results[i] = false;
+#endif
+
+        ::close(fds[i]);
+
+        if (results[i] && ::rename(staged[i].constData(), QFile::encodeName(batch[i].path).constData()) == 0) {
+            directories.insert(QFileInfo{batch[i].path}.absolutePath());
+            continue;
+        }
+
+        qCWarning(lcWrite, "cannot write %ls: %s", qUtf16Printable(batch[i].path), std::strerror(errno));
+        ::unlink(staged[i].constData());
+        results[i] = false;
+    }
+
+    // the renames themselves, once per directory
+    for (const auto &directory: std::as_const(directories)) {
+        const auto fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    // QSaveFile stages and renames as well, just without control over when data is flushed
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        QDir{}.mkpath(QFileInfo{batch[i].path}.absolutePath());
+
+        QSaveFile file{batch[i].path};
+        if (!file.open(QFile::WriteOnly)) {
+            qCWarning(lcWrite, "cannot write %ls: %ls", qUtf16Printable(batch[i].path), qUtf16Printable(file.errorString()));
+            continue;
+        }
+
+        file.write(batch[i].data);
+
+        if (batch[i].executable)
+            file.setPermissions(file.permissions() | QFile::ExeOwner | QFile::ExeGroup | QFile::ExeOther);
+
+        results[i] = file.commit();
+    }
+#endif
+
+    return results;
+}
+
+void WritePipeline::stage(const QList<PendingWrite> &batch, QList<int> &fds, QList<QByteArray> &staged, QList<bool> &results)
+{
+#ifdef Q_OS_UNIX
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        const auto &write = batch[i];
+
+        QDir{}.mkpath(QFileInfo{write.path}.absolutePath());
+
+        // O_EXCL: the name is ours alone, anything already there is not
+        staged[i] = QFile::encodeName(stagingPath(write.path));
+        fds[i] = ::open(staged[i].constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, write.executable ? 0777 : 0666);
+        if (fds[i] < 0)
+            qCWarning(lcWrite, "cannot stage %ls: %s", qUtf16Printable(write.path), std::strerror(errno));
+
+        // empty files are complete as soon as they exist
+        results[i] = fds[i] >= 0 && write.data.isEmpty();
+    }
+
+    bool written = false;
+
+#ifdef HAVE_LIBURING
+    written = writeWithUring(batch, fds, results);
+#endif
+
+    if (!written) {
+        for (qsizetype i = 0; i < batch.size(); ++i) {
+            if (fds[i] >= 0 && !batch[i].data.isEmpty())
+                results[i] = writeAll(fds[i], batch[i].data.constData(), batch[i].data.size(), 0);
+        }
+    }
+
+    // failed ones are dropped right away, they never get renamed
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        if (fds[i] < 0 || results[i])
+            continue;
+
+        qCWarning(lcWrite, "cannot write %ls: %s", qUtf16Printable(batch[i].path), std::strerror(errno));
+        ::close(fds[i]);
+        ::unlink(staged[i].constData());
+        fds[i] = -1;
+    }
+#else
+    Q_UNUSED(batch);
+    Q_UNUSED(fds);
+    Q_UNUSED(staged);
+    Q_UNUSED(results);
+#endif
+}
+
+} // namespace randomly
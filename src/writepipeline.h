@@ -0,0 +1,57 @@
+#ifndef WRITEPIPELINE_H
+#define WRITEPIPELINE_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <functional>
+
+namespace randomly {
+
+struct PendingWrite
+{
+    QString path;
+    QByteArray data;
+    bool executable = false;
+    std::function<void(bool success)> done; // called on the pipeline's thread
+};
+
+// writes downloaded files off the event loop, crash-safe: each file is staged as <path>.<pid>.<n>.part and only renamed
+// into place once its data is on disk, so a path that exists is always complete. Writes are collected into
+// batches whose writeback is started together; each file is synced on its own (never the whole filesystem),
+// each directory once for all renames in it.
+// On Linux the data goes through io_uring when built with liburing, a plain worker thread otherwise
+class WritePipeline : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WritePipeline(QObject *parent = nullptr);
+    ~WritePipeline(); // waits for everything queued to be committed
+
+    void write(PendingWrite write);
+
+    // commits the current batch right away instead of waiting for it to fill up
+    void flush();
+
+    int inFlight() const { return m_inFlight; }
+
+    // staged files a crashed run left in the download directories, older than an hour so no other launcher is still
+    // writing them
+    static int removeOrphans(const QString &root);
+
+private:
+    static QList<bool> commit(const QList<PendingWrite> &batch);
+    static void stage(const QList<PendingWrite> &batch, QList<int> &fds, QList<QByteArray> &staged, QList<bool> &results);
+
+    QThreadPool m_pool; // a single thread, batches are committed in order
+    QTimer m_flushTimer;
+
+    QList<PendingWrite> m_batch;
+    qint64 m_batchBytes = 0;
+    int m_inFlight = 0;
+};
+
+} // namespace randomly
+
+#endif // WRITEPIPELINE_H